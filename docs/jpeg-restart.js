@@ -0,0 +1,280 @@
+// Losslessly rewrites a baseline JPEG so that it has a restart marker at the
+// start of every MCU row, like `jpegtran -restart 1`. The device uses these
+// markers to decode the top and bottom of a frame on separate cores.
+//
+// Only the DC coefficients next to a restart marker change, everything else
+// is copied symbol for symbol, so the image is bit-identical once decoded.
+// The Huffman tables must be able to code every DC difference, which is
+// always true of the standard tables (ffmpeg's `-huffman default`).
+
+class BitReader {
+  constructor(data, pos) {
+    this.data = data;
+    this.pos = pos;
+    this.bits = 0;
+    this.count = 0;
+  }
+
+  readBit() {
+    if (this.count === 0) {
+      if (this.pos >= this.data.length) {
+        throw new Error('Unexpected end of entropy data');
+      }
+      let byte = this.data[this.pos++];
+      if (byte === 0xff) {
+        const next = this.data[this.pos];
+        if (next === 0x00) {
+          this.pos++;
+        } else {
+          throw new Error(`Unexpected marker 0xff${next.toString(16)} in entropy data`);
+        }
+      }
+      this.bits = byte;
+      this.count = 8;
+    }
+    this.count--;
+    return (this.bits >> this.count) & 1;
+  }
+
+  readBits(length) {
+    let value = 0;
+    for (let i = 0; i < length; i++) {
+      value = (value << 1) | this.readBit();
+    }
+    return value;
+  }
+
+  decode(table) {
+    let code = 0;
+    for (let length = 1; length <= 16; length++) {
+      code = (code << 1) | this.readBit();
+      const symbol = table.lookup.get((length << 16) | code);
+      if (symbol !== undefined) {
+        return symbol;
+      }
+    }
+    throw new Error('Invalid Huffman code');
+  }
+}
+
+class BitWriter {
+  constructor(capacity) {
+    this.data = new Uint8Array(capacity);
+    this.length = 0;
+    this.bits = 0;
+    this.count = 0;
+  }
+
+  pushByte(byte) {
+    if (this.length + 2 > this.data.length) {
+      const grown = new Uint8Array(this.data.length * 2);
+      grown.set(this.data);
+      this.data = grown;
+    }
+    this.data[this.length++] = byte;
+  }
+
+  writeBits(value, length) {
+    for (let i = length - 1; i >= 0; i--) {
+      this.bits = (this.bits << 1) | ((value >> i) & 1);
+      this.count++;
+      if (this.count === 8) {
+        this.pushByte(this.bits);
+        if (this.bits === 0xff) {
+          this.pushByte(0x00);
+        }
+        this.bits = 0;
+        this.count = 0;
+      }
+    }
+  }
+
+  // pad the last byte with 1 bits
+  flush() {
+    if (this.count > 0) {
+      this.writeBits((1 << (8 - this.count)) - 1, 8 - this.count);
+    }
+  }
+
+  writeMarker(marker) {
+    this.flush();
+    this.pushByte(0xff);
+    this.pushByte(marker);
+  }
+
+  encode(table, symbol) {
+    const code = table.codes.get(symbol);
+    if (code === undefined) {
+      throw new Error(`Huffman table has no code for symbol ${symbol}`);
+    }
+    this.writeBits(code.code, code.length);
+  }
+}
+
+// Build the canonical codes for a DHT table (JPEG spec annex C)
+function buildHuffmanTable(counts, symbols) {
+  const lookup = new Map();
+  const codes = new Map();
+  let code = 0;
+  let k = 0;
+  for (let length = 1; length <= 16; length++) {
+    for (let i = 0; i < counts[length - 1]; i++) {
+      lookup.set((length << 16) | code, symbols[k]);
+      codes.set(symbols[k], { code, length });
+      code++;
+      k++;
+    }
+    code <<= 1;
+  }
+  return { lookup, codes };
+}
+
+function extend(value, length) {
+  return length > 0 && value < (1 << (length - 1)) ? value - (1 << length) + 1 : value;
+}
+
+function category(value) {
+  let magnitude = Math.abs(value);
+  let length = 0;
+  while (magnitude > 0) {
+    length++;
+    magnitude >>= 1;
+  }
+  return length;
+}
+
+function encodeValue(writer, value, length) {
+  writer.writeBits(value < 0 ? value + (1 << length) - 1 : value, length);
+}
+
+export function addRestartMarkers(jpeg) {
+  if (jpeg[0] !== 0xff || jpeg[1] !== 0xd8) {
+    throw new Error('Not a JPEG file');
+  }
+  const dcTables = [];
+  const acTables = [];
+  const frameComponents = [];
+  let width = 0;
+  let height = 0;
+  const header = [];
+  let pos = 2;
+  while (pos + 4 <= jpeg.length) {
+    if (jpeg[pos] !== 0xff) {
+      throw new Error('Corrupt JPEG header');
+    }
+    const marker = jpeg[pos + 1];
+    if (marker === 0xff) {
+      pos++;
+      continue;
+    }
+    const length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+    const segment = jpeg.subarray(pos + 4, pos + 2 + length);
+    if (marker === 0xdd) {
+      // already has restart markers, leave it alone
+      return jpeg;
+    }
+    if (marker >= 0xc1 && marker <= 0xcf && marker !== 0xc4 && marker !== 0xc8 && marker !== 0xcc) {
+      // only baseline images are supported
+      return jpeg;
+    }
+    if (marker === 0xc0) {
+      height = (segment[1] << 8) | segment[2];
+      width = (segment[3] << 8) | segment[4];
+      for (let i = 0; i < segment[5]; i++) {
+        frameComponents.push({
+          id: segment[6 + i * 3],
+          h: segment[7 + i * 3] >> 4,
+          v: segment[7 + i * 3] & 0x0f,
+        });
+      }
+    } else if (marker === 0xc4) {
+      let p = 0;
+      while (p < segment.length) {
+        const tableClass = segment[p] >> 4;
+        const tableId = segment[p] & 0x0f;
+        const counts = segment.subarray(p + 1, p + 17);
+        const total = counts.reduce((sum, count) => sum + count, 0);
+        const table = buildHuffmanTable(counts, segment.subarray(p + 17, p + 17 + total));
+        (tableClass === 0 ? dcTables : acTables)[tableId] = table;
+        p += 17 + total;
+      }
+    }
+    if (marker === 0xda) {
+      const scanCount = segment[0];
+      if (scanCount !== frameComponents.length) {
+        return jpeg;
+      }
+      const scan = [];
+      for (let i = 0; i < scanCount; i++) {
+        const component = frameComponents.find((c) => c.id === segment[1 + i * 2]);
+        const tables = segment[2 + i * 2];
+        scan.push({
+          // a single component scan is not interleaved
+          blocks: scanCount === 1 ? 1 : component.h * component.v,
+          dc: dcTables[tables >> 4],
+          ac: acTables[tables & 0x0f],
+        });
+      }
+      const maxH = Math.max(...frameComponents.map((c) => c.h));
+      const maxV = Math.max(...frameComponents.map((c) => c.v));
+      const mcuWidth = scanCount === 1 ? 8 : maxH * 8;
+      const mcuHeight = scanCount === 1 ? 8 : maxV * 8;
+      const mcusPerRow = Math.ceil(width / mcuWidth);
+      const mcuCount = mcusPerRow * Math.ceil(height / mcuHeight);
+
+      const reader = new BitReader(jpeg, pos + 2 + length);
+      const writer = new BitWriter(jpeg.length + jpeg.length / 8 + 1024);
+      const readPredictors = new Array(scanCount).fill(0);
+      const writePredictors = new Array(scanCount).fill(0);
+      for (let mcu = 0; mcu < mcuCount; mcu++) {
+        if (mcu > 0 && mcu % mcusPerRow === 0) {
+          writer.writeMarker(0xd0 + ((mcu / mcusPerRow - 1) & 7));
+          writePredictors.fill(0);
+        }
+        for (let c = 0; c < scanCount; c++) {
+          const { blocks, dc, ac } = scan[c];
+          for (let b = 0; b < blocks; b++) {
+            const dcLength = reader.decode(dc);
+            readPredictors[c] += extend(reader.readBits(dcLength), dcLength);
+            const diff = readPredictors[c] - writePredictors[c];
+            writePredictors[c] = readPredictors[c];
+            const diffLength = category(diff);
+            writer.encode(dc, diffLength);
+            encodeValue(writer, diff, diffLength);
+            for (let k = 1; k < 64; k++) {
+              const symbol = reader.decode(ac);
+              writer.encode(ac, symbol);
+              const run = symbol >> 4;
+              const size = symbol & 0x0f;
+              if (size === 0) {
+                if (run !== 15) {
+                  break; // end of block
+                }
+                k += 15;
+              } else {
+                k += run;
+                writer.writeBits(reader.readBits(size), size);
+              }
+            }
+          }
+        }
+      }
+      writer.writeMarker(0xd9);
+
+      const dri = new Uint8Array([0xff, 0xdd, 0x00, 0x04, mcusPerRow >> 8, mcusPerRow & 0xff]);
+      header.push(dri, jpeg.subarray(pos, pos + 2 + length));
+      const out = new Uint8Array(2 + header.reduce((sum, part) => sum + part.length, 0) + writer.length);
+      out.set([0xff, 0xd8]);
+      let offset = 2;
+      for (const part of header) {
+        out.set(part, offset);
+        offset += part.length;
+      }
+      out.set(writer.data.subarray(0, writer.length), offset);
+      return out;
+    }
+    header.push(jpeg.subarray(pos, pos + 2 + length));
+    pos += 2 + length;
+  }
+  throw new Error('No scan found');
+}
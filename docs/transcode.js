@@ -1,5 +1,6 @@
 import { FFmpeg } from './ffmpeg/index.js';
 import { toBlobURL } from './ffmpeg-util/index.js';
+import { addRestartMarkers } from './jpeg-restart.js';
 
 document.addEventListener('DOMContentLoaded', () => {
   const transcodeVideoFile = document.getElementById('transcodeVideoFile');
@@ -8,6 +9,7 @@ document.addEventListener('DOMContentLoaded', () => {
   const transcodeProgress = document.getElementById('transcodeProgress');
   const transcodeStatus = document.getElementById('transcodeStatus');
   const downloadLink = document.getElementById('downloadLink');
+  const restartMarkers = document.getElementById('restartMarkers');
 
   let ffmpeg = null;
   let detectedFps = 30; // Default fallback
@@ -84,20 +86,44 @@ document.addEventListener('DOMContentLoaded', () => {
       const targetFps = Math.min(detectedFps, 25);
       log(`Found ${detectedFps} FPS.${detectedFps > targetFps ? ` Output will be capped at ${targetFps} FPS to reduce file size` : ''}`);
 
-      const command = [
+      const encodeArgs = [
         '-y',
         '-i', 'input.mp4',
         '-an',
         '-c:v', 'mjpeg',
         '-q:v', '10',
         '-vf', `scale=-1:240:flags=lanczos,crop=320:240:(in_w-320)/2:0,fps=${targetFps}`,
-        'out.avi'
       ];
 
-      log(`Running command: ffmpeg ${command.join(' ')}`);
-      log(`Transcoding...`);
-
-      await ffmpeg.exec(command);
+      if (restartMarkers.checked) {
+        // Encode to separate frames with the standard Huffman tables, add a
+        // restart marker to every MCU row, then mux the frames unchanged.
+        const command = [...encodeArgs, '-huffman', 'default', '-f', 'image2', 'frame%06d.jpg'];
+        log(`Running command: ffmpeg ${command.join(' ')}`);
+        log(`Transcoding...`);
+        await ffmpeg.exec(command);
+
+        log('Adding restart markers...');
+        const frames = (await ffmpeg.listDir('/'))
+          .map((entry) => entry.name)
+          .filter((name) => /^frame\d+\.jpg$/.test(name));
+        for (const name of frames) {
+          const frame = await ffmpeg.readFile(name);
+          await ffmpeg.writeFile(name, addRestartMarkers(frame));
+        }
+
+        const muxCommand = ['-y', '-framerate', `${targetFps}`, '-i', 'frame%06d.jpg', '-c:v', 'copy', 'out.avi'];
+        log(`Running command: ffmpeg ${muxCommand.join(' ')}`);
+        await ffmpeg.exec(muxCommand);
+        for (const name of frames) {
+          await ffmpeg.deleteFile(name);
+        }
+      } else {
+        const command = [...encodeArgs, 'out.avi'];
+        log(`Running command: ffmpeg ${command.join(' ')}`);
+        log(`Transcoding...`);
+        await ffmpeg.exec(command);
+      }
 
       // Success handling
       const data = await ffmpeg.readFile('out.avi');
@@ -0,0 +1,166 @@
+#include "BufferedFile.h"
+#include <Arduino.h>
+#include <algorithm>
+#include <esp_heap_caps.h>
+#include <fcntl.h>
+#include <limits>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// off_t is a 32 bit long on the ESP32, so files from 2GB on can't be sized
+// or seeked into. They're turned away rather than read at wrapped positions.
+static const uint64_t MAX_FILE_POSITION = std::numeric_limits<off_t>::max();
+
+BufferedFile::BufferedFile(size_t bufferSize) : mBufferSize(bufferSize) {}
+
+BufferedFile::~BufferedFile()
+{
+  close();
+  if (mBuffer)
+  {
+    free(mBuffer);
+  }
+}
+
+bool BufferedFile::open(const char *path)
+{
+  close();
+  if (!mBuffer)
+  {
+    // a DMA capable buffer lets the SD driver skip its bounce buffer
+    mBuffer = (uint8_t *)heap_caps_malloc(mBufferSize, MALLOC_CAP_DMA);
+    if (!mBuffer)
+    {
+      mBuffer = (uint8_t *)malloc(mBufferSize);
+    }
+    if (!mBuffer)
+    {
+      Serial.printf("Failed to allocate %u byte read buffer\n", mBufferSize);
+      return false;
+    }
+  }
+  mFd = ::open(path, O_RDONLY);
+  if (mFd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if (fstat(mFd, &st) != 0)
+  {
+    close();
+    return false;
+  }
+  // a 2GB or larger file wraps to a negative size
+  if (st.st_size < 0)
+  {
+    Serial.printf("Can't open %s, files must be under 2GB on this device\n",
+                  path);
+    close();
+    return false;
+  }
+  mFileSize = st.st_size;
+  mPosition = 0;
+  mFdPosition = 0;
+  mBufferStart = 0;
+  mBufferFill = 0;
+  return true;
+}
+
+void BufferedFile::close()
+{
+  if (mFd >= 0)
+  {
+    ::close(mFd);
+    mFd = -1;
+  }
+  mBufferFill = 0;
+}
+
+bool BufferedFile::fillBuffer(uint64_t position)
+{
+  // always read whole allocation units so the card sees aligned transfers
+  uint64_t alignedStart = position - position % mBufferSize;
+  if (mFdPosition != alignedStart)
+  {
+    if (alignedStart > MAX_FILE_POSITION ||
+        lseek(mFd, (off_t)alignedStart, SEEK_SET) < 0)
+    {
+      return false;
+    }
+    mFdPosition = alignedStart;
+  }
+  ssize_t bytesRead = ::read(mFd, mBuffer, mBufferSize);
+  if (bytesRead <= 0)
+  {
+    mBufferFill = 0;
+    return false;
+  }
+  mFdPosition += bytesRead;
+  mBufferStart = alignedStart;
+  mBufferFill = bytesRead;
+  return position < mBufferStart + mBufferFill;
+}
+
+size_t BufferedFile::readDirect(uint8_t *dest, size_t length)
+{
+  if (mFdPosition != mPosition)
+  {
+    if (mPosition > MAX_FILE_POSITION ||
+        lseek(mFd, (off_t)mPosition, SEEK_SET) < 0)
+    {
+      return 0;
+    }
+    mFdPosition = mPosition;
+  }
+  ssize_t bytesRead = ::read(mFd, dest, length);
+  if (bytesRead <= 0)
+  {
+    return 0;
+  }
+  mFdPosition += bytesRead;
+  return bytesRead;
+}
+
+size_t BufferedFile::read(void *dest, size_t length)
+{
+  if (mFd < 0)
+  {
+    return 0;
+  }
+  uint8_t *out = (uint8_t *)dest;
+  size_t total = 0;
+  while (length > 0)
+  {
+    if (mPosition >= mBufferStart && mPosition < mBufferStart + mBufferFill)
+    {
+      // serve what we can from the buffer
+      size_t offset = mPosition - mBufferStart;
+      size_t count = std::min(length, mBufferFill - offset);
+      memcpy(out, mBuffer + offset, count);
+      out += count;
+      length -= count;
+      total += count;
+      mPosition += count;
+      continue;
+    }
+    if (length >= mBufferSize && mPosition % SDCard::SECTOR_SIZE == 0)
+    {
+      // large sector aligned payloads skip the buffer, the tail is buffered
+      size_t count = readDirect(out, length - length % SDCard::SECTOR_SIZE);
+      if (count == 0)
+      {
+        break;
+      }
+      out += count;
+      length -= count;
+      total += count;
+      mPosition += count;
+      continue;
+    }
+    if (!fillBuffer(mPosition))
+    {
+      break;
+    }
+  }
+  return total;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SDCard.h"
+
+// Read-only file that talks to the card in large reads aligned to the FAT
+// allocation unit. Small reads (chunk headers, padding) are served from the
+// buffer and large payloads are read straight into the caller's memory.
+class BufferedFile
+{
+public:
+#ifdef BOARD_HAS_PSRAM
+  static const size_t DEFAULT_BUFFER_SIZE = SDCard::ALLOCATION_UNIT_SIZE;
+#else
+  // Internal DMA memory is scarce without PSRAM and several files can be
+  // open at once. A quarter unit still keeps reads aligned within a unit.
+  static const size_t DEFAULT_BUFFER_SIZE = SDCard::ALLOCATION_UNIT_SIZE / 4;
+#endif
+
+private:
+  int mFd = -1;
+  uint8_t *mBuffer = NULL;
+  size_t mBufferSize;
+  // file offset of the first byte in the buffer and how many are valid
+  uint64_t mBufferStart = 0;
+  size_t mBufferFill = 0;
+  // where the next read() starts and where the file descriptor points
+  uint64_t mPosition = 0;
+  uint64_t mFdPosition = 0;
+  uint64_t mFileSize = 0;
+
+  bool fillBuffer(uint64_t position);
+  size_t readDirect(uint8_t *dest, size_t length);
+
+public:
+  BufferedFile(size_t bufferSize = DEFAULT_BUFFER_SIZE);
+  ~BufferedFile();
+  bool open(const char *path);
+  void close();
+  bool isOpen() { return mFd >= 0; }
+  // Returns the number of bytes read, which is short at the end of the file.
+  size_t read(void *dest, size_t length);
+  // Seeking is free, nothing is read until the next read().
+  void seek(uint64_t position) { mPosition = position; }
+  void skip(uint64_t length) { mPosition += length; }
+  uint64_t tell() { return mPosition; }
+  uint64_t size() { return mFileSize; }
+  bool eof() { return mPosition >= mFileSize; }
+};
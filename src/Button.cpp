@@ -19,6 +19,7 @@ void Button::reset()
   longPressDetected = false;
   clickDetected = false;
   doubleClickDetected = false;
+  tripleClickDetected = false;
   clickCount = 0;
   // read initial state
   lastButtonState = digitalRead(_pin);
@@ -33,6 +34,7 @@ void Button::update()
 {
   clickDetected = false;
   doubleClickDetected = false;
+  tripleClickDetected = false;
 
   int reading = digitalRead(_pin);
 
@@ -74,7 +76,7 @@ void Button::update()
   {
     Serial.println("Long Press");
     longPressDetected = true;
-    digitalWrite(_sys_en_pin, LOW);
+    powerOff();
   }
 
   if (clickCount > 0 && (millis() - lastClickTime) >= clickInterval)
@@ -89,6 +91,11 @@ void Button::update()
       doubleClickDetected = true;
       Serial.println("Double Click");
     }
+    else if (clickCount == 3)
+    {
+      tripleClickDetected = true;
+      Serial.println("Triple Click");
+    }
     clickCount = 0;
   }
 
@@ -105,7 +112,21 @@ bool Button::isDoubleClicked()
   return doubleClickDetected;
 }
 
+bool Button::isTripleClicked()
+{
+  return tripleClickDetected;
+}
+
 void Button::powerOff()
 {
+  if (power_off_callback)
+  {
+    power_off_callback();
+  }
   digitalWrite(_sys_en_pin, LOW);
 }
+
+void Button::onPowerOff(std::function<void()> callback)
+{
+  power_off_callback = callback;
+}
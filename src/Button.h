@@ -2,6 +2,7 @@
 #define BUTTON_H
 
 #include <Arduino.h>
+#include <functional>
 
 class Button
 {
@@ -11,7 +12,10 @@ public:
   void reset();
   bool isClicked();
   bool isDoubleClicked();
+  bool isTripleClicked();
   void powerOff();
+  // called just before the power is cut, by a long press or powerOff
+  void onPowerOff(std::function<void()> callback);
 
 private:
   int _pin;
@@ -28,8 +32,11 @@ private:
   bool longPressDetected;
   bool clickDetected;
   bool doubleClickDetected;
+  bool tripleClickDetected;
 
   int clickCount;
+
+  std::function<void()> power_off_callback;
 };
 
 #endif // BUTTON_H
@@ -1,12 +1,38 @@
 #include <Arduino.h>
 #include <TFT_eSPI.h>
 #include "Display.h"
+#include <algorithm>
+#ifdef USE_DMA
+#include <soc/soc_memory_layout.h>
+#endif
 
 // PWM channel for backlight
 #define LEDC_CHANNEL_0 0
 #define LEDC_TIMER_8_BIT 8
 #define LEDC_BASE_FREQ 5000
 
+TFT_eSprite *Display::createFrameSprite()
+{
+  TFT_eSprite *sprite = new TFT_eSprite(tft);
+#ifdef USE_DMA
+  // DMA can only read internal memory, so try there first
+  sprite->setAttribute(PSRAM_ENABLE, false);
+  if (sprite->createSprite(tft->width(), tft->height()) == nullptr)
+  {
+    sprite->setAttribute(PSRAM_ENABLE, true);
+  }
+#endif
+  if (!sprite->created() &&
+      sprite->createSprite(tft->width(), tft->height()) == nullptr)
+  {
+    delete sprite;
+    return nullptr;
+  }
+  sprite->setTextFont(2);
+  sprite->setTextSize(1);
+  return sprite;
+}
+
 Display::Display(Prefs *prefs) : tft(new TFT_eSPI()), _prefs(prefs)
 {
   tft_mutex = xSemaphoreCreateRecursiveMutex();
@@ -16,16 +42,47 @@ Display::Display(Prefs *prefs) : tft(new TFT_eSPI()), _prefs(prefs)
   tft->setRotation(3);
 
   // Now create the sprite with the correct, rotated dimensions
-  frameSprite = new TFT_eSprite(tft);
-  
-  // Try to create the sprite. If it fails (returns nullptr), we fall back to direct drawing.
-  if (frameSprite->createSprite(tft->width(), tft->height()) == nullptr) {
-    Serial.println("Warning: Failed to create full-screen sprite. Falling back to direct draw.");
-    delete frameSprite;
-    frameSprite = nullptr;
+  // Try to create the sprite. If it fails (returns nullptr), we fall back to banded drawing.
+#ifdef BOARD_HAS_PSRAM
+  frameSprite = createFrameSprite();
+#else
+  // a full screen sprite would take most of the heap, draw in bands instead
+  frameSprite = nullptr;
+#endif
+  if (frameSprite == nullptr) {
+    Serial.println("No full-screen sprite. Falling back to banded drawing.");
+    bandBuffers[0] = (uint16_t *)heap_caps_malloc(
+        tft->width() * BAND_HEIGHT * sizeof(uint16_t), MALLOC_CAP_DMA);
+    bandBuffers[1] = (uint16_t *)heap_caps_malloc(
+        tft->width() * BAND_HEIGHT * sizeof(uint16_t), MALLOC_CAP_DMA);
+    if (!bandBuffers[0] || !bandBuffers[1]) {
+      Serial.println("Not enough memory for banded drawing. Falling back to direct draw.");
+      free(bandBuffers[0]);
+      free(bandBuffers[1]);
+      bandBuffers[0] = bandBuffers[1] = NULL;
+    }
   } else {
-    frameSprite->setTextFont(2);
-    frameSprite->setTextSize(1);
+    // a second sprite lets the next frame be decoded while this one is sent
+    spareSprite = createFrameSprite();
+    if (spareSprite == nullptr) {
+      Serial.println("Not enough memory for double buffering.");
+    }
+  }
+  if (frameSprite) {
+    tileColumns = (width() + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    tileRows = (height() + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    // starts zeroed, so the first frame is sent in full
+    tileHashes = (uint32_t *)calloc(tileColumns * tileRows, sizeof(uint32_t));
+  }
+  if (!osd.begin(tft)) {
+    Serial.println("Not enough memory for the OSD glyphs.");
+  }
+  flushIdle = xSemaphoreCreateBinary();
+  xSemaphoreGive(flushIdle);
+  if (spareSprite) {
+    // the decoder runs on core 0
+    xTaskCreatePinnedToCore(_flushTask, "Flush", 2048, this, 2,
+                            &flushTaskHandle, 1);
   }
 
 // setup the backlight
@@ -75,7 +132,9 @@ void Display::drawPixels(int x, int y, int width, int height, uint16_t *pixels)
   
   if (dmaBuffer[dmaBufferIndex] != NULL) {
     memcpy(dmaBuffer[dmaBufferIndex], pixels, numPixels * 2);
+    waitForFlush();
     xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+    invalidateTiles(x, y, width, height);
     tft->setAddrWindow(x, y, width, height);
   #ifdef USE_DMA
     tft->pushPixelsDMA(dmaBuffer[dmaBufferIndex], numPixels);
@@ -86,7 +145,9 @@ void Display::drawPixels(int x, int y, int width, int height, uint16_t *pixels)
     dmaBufferIndex = (dmaBufferIndex + 1) % 2;
   } else {
     // Fallback if malloc failed: synchronous slow draw
+    waitForFlush();
     xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+    invalidateTiles(x, y, width, height);
     tft->pushImage(x, y, width, height, pixels);
     xSemaphoreGiveRecursive(tft_mutex);
   }
@@ -97,6 +158,8 @@ void Display::drawPixelsToSprite(int x, int y, int width, int height, uint16_t *
 {
   if (frameSprite) {
     frameSprite->pushImage(x, y, width, height, pixels);
+  } else if (bandBuffers[0]) {
+    drawPixelsToBand(x, y, width, height, pixels);
   } else {
     // Direct draw fallback
     xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
@@ -105,15 +168,324 @@ void Display::drawPixelsToSprite(int x, int y, int width, int height, uint16_t *
   }
 }
 
+// FNV-1a over the tile's pixels, two at a time
+uint32_t Display::hashTile(const uint16_t *pixels, int stride, int x, int y,
+                           int w, int h)
+{
+  uint32_t hash = 2166136261u;
+  for (int row = y; row < y + h; row++)
+  {
+    const uint16_t *p = pixels + row * stride + x;
+    int i = 0;
+    for (; i + 1 < w; i += 2)
+    {
+      hash = (hash ^ (p[i] | (p[i + 1] << 16))) * 16777619u;
+    }
+    if (i < w)
+    {
+      hash = (hash ^ p[i]) * 16777619u;
+    }
+  }
+  // zero is kept for unknown tiles
+  return hash ? hash : 1;
+}
+
+// Forget what the panel shows in the given area, it'll be sent in full next
+// time. Bars around the image are cleared again too.
+void Display::invalidateTiles(int x, int y, int w, int h)
+{
+  clearedWidth = -1;
+  if (!tileHashes || w <= 0 || h <= 0) {
+    return;
+  }
+  int firstColumn = std::max(x / DIRTY_TILE_SIZE, 0);
+  int lastColumn = std::min((x + w - 1) / DIRTY_TILE_SIZE, tileColumns - 1);
+  int firstRow = std::max(y / DIRTY_TILE_SIZE, 0);
+  int lastRow = std::min((y + h - 1) / DIRTY_TILE_SIZE, tileRows - 1);
+  for (int row = firstRow; row <= lastRow; row++) {
+    for (int column = firstColumn; column <= lastColumn; column++) {
+      tileHashes[row * tileColumns + column] = 0;
+    }
+  }
+}
+
+// Copy the block into the band buffer a row at a time, sending the band on
+// and starting a new one as the rows move past it. Blocks arrive top to
+// bottom, as the JPEG decoder produces them, with a row of MCUs often split
+// into several blocks side by side. A band starts at the top of the block
+// that didn't fit in the last one, so the rest of that row of blocks lands
+// in the same band rather than one that's already been sent.
+void Display::drawPixelsToBand(int x, int y, int width, int height,
+                               uint16_t *pixels)
+{
+  int screenWidth = tft->width();
+  int x0 = std::max(x, 0);
+  int x1 = std::min(x + width, screenWidth);
+  int firstRow = std::max(y, 0);
+  int lastRow = std::min(y + height, (int)tft->height());
+  if (x0 >= x1 || firstRow >= lastRow) {
+    return;
+  }
+  if (bandY < 0) {
+    // the frame is sent band by band, keep the bus until it's done
+    xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+    osd.beginBands(screenWidth);
+#ifdef USE_DMA
+    tft->startWrite();
+#endif
+    startBand(firstRow);
+  } else if (lastRow - firstRow <= BAND_HEIGHT &&
+             (firstRow < bandY || lastRow > bandY + BAND_HEIGHT)) {
+    flushBand();
+    startBand(firstRow);
+  }
+  for (int row = firstRow; row < lastRow; row++) {
+    // only a block taller than a band gets here, e.g. a whole decoded frame
+    if (row < bandY || row >= bandY + BAND_HEIGHT) {
+      flushBand();
+      startBand(row);
+    }
+    memcpy(bandBuffers[bandIndex] + (row - bandY) * screenWidth + x0,
+           pixels + (row - y) * width + (x0 - x), (x1 - x0) * sizeof(uint16_t));
+  }
+  bandEnd = std::max(bandEnd, lastRow);
+}
+
+void Display::startBand(int row)
+{
+  bandY = row;
+  bandEnd = row;
+  // anything the image doesn't cover is black
+  memset(bandBuffers[bandIndex], 0,
+         tft->width() * BAND_HEIGHT * sizeof(uint16_t));
+}
+
+// Send the rows drawn into the band, the rows below them may belong to the
+// next band
+void Display::flushBand()
+{
+  if (bandY < 0 || bandEnd <= bandY) {
+    return;
+  }
+  int rows = bandEnd - bandY;
+  uint16_t *band = bandBuffers[bandIndex];
+  osd.composeBand(band, tft->width(), tft->height(), bandY, rows);
+#ifdef USE_DMA
+  // the other buffer is free again once the previous band has gone
+  tft->dmaWait();
+  tft->pushImageDMA(0, bandY, tft->width(), rows, band);
+#else
+  tft->pushImage(0, bandY, tft->width(), rows, band);
+#endif
+  bandIndex ^= 1;
+}
+
+void Display::endBandedFrame()
+{
+  if (bandY < 0) {
+    return;
+  }
+  flushBand();
+#ifdef USE_DMA
+  tft->dmaWait();
+  tft->endWrite();
+#endif
+  bandY = -1;
+  // text added after the frame started goes on top until the next frame
+  osd.drawPending(tft);
+  xSemaphoreGiveRecursive(tft_mutex);
+}
+
+void Display::pushRect(TFT_eSprite *sprite, int x, int y, int w, int h)
+{
+#ifdef USE_DMA
+  uint16_t *pixels = (uint16_t *)sprite->getPointer();
+  // full width rows are contiguous in the sprite
+  if (w == sprite->width() && esp_ptr_dma_capable(pixels)) {
+    // the rest of the sprite is hashed while this goes out, a transfer
+    // still in flight is waited for by the next one
+    if (!dmaActive) {
+      tft->startWrite();
+      dmaActive = true;
+    }
+    tft->pushImageDMA(0, y, w, h, pixels + y * w);
+    return;
+  }
+  finishDMA();
+#endif
+  sprite->pushSprite(x, y, x, y, w, h);
+}
+
+// Wait for the sprite transfers pushRect started, the sprite mustn't change
+// or the panel be used for anything else until they're done.
+void Display::finishDMA()
+{
+#ifdef USE_DMA
+  if (dmaActive) {
+    tft->dmaWait();
+    tft->endWrite();
+    dmaActive = false;
+  }
+#endif
+}
+
+void Display::pushSprite(TFT_eSprite *sprite, bool wholeSprite)
+{
+  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  if (!tileHashes) {
+    pushRect(sprite, 0, 0, sprite->width(), sprite->height());
+    finishDMA();
+    xSemaphoreGiveRecursive(tft_mutex);
+    return;
+  }
+  const uint16_t *pixels = (const uint16_t *)sprite->getPointer();
+  int spriteWidth = sprite->width();
+  int spriteHeight = sprite->height();
+  // rows of tiles with the same changed columns are sent together
+  int runY = 0;
+  int runHeight = 0;
+  int runX = 0;
+  int runWidth = 0;
+  for (int row = 0; row < tileRows; row++) {
+    int y = row * DIRTY_TILE_SIZE;
+    int h = std::min(DIRTY_TILE_SIZE, spriteHeight - y);
+    int firstColumn = -1;
+    int lastColumn = -1;
+    for (int column = 0; column < tileColumns; column++) {
+      int x = column * DIRTY_TILE_SIZE;
+      int w = std::min(DIRTY_TILE_SIZE, spriteWidth - x);
+      uint32_t hash = hashTile(pixels, spriteWidth, x, y, w, h);
+      uint32_t &shown = tileHashes[row * tileColumns + column];
+      if (wholeSprite || hash != shown) {
+        shown = hash;
+        if (firstColumn < 0) {
+          firstColumn = column;
+        }
+        lastColumn = column;
+      }
+    }
+    int x = firstColumn * DIRTY_TILE_SIZE;
+    int w = std::min((lastColumn + 1) * DIRTY_TILE_SIZE, spriteWidth) - x;
+    if (runHeight > 0 && (firstColumn < 0 || x != runX || w != runWidth)) {
+      pushRect(sprite, runX, runY, runWidth, runHeight);
+      runHeight = 0;
+    }
+    if (firstColumn < 0) {
+      continue;
+    }
+    if (runHeight == 0) {
+      runY = y;
+      runX = x;
+      runWidth = w;
+    }
+    runHeight += h;
+  }
+  if (runHeight > 0) {
+    pushRect(sprite, runX, runY, runWidth, runHeight);
+  }
+  finishDMA();
+  xSemaphoreGiveRecursive(tft_mutex);
+}
+
+void Display::waitForFlush()
+{
+  xSemaphoreTake(flushIdle, portMAX_DELAY);
+  xSemaphoreGive(flushIdle);
+}
+
+void Display::_flushTask(void *param)
+{
+  Display *display = (Display *)param;
+  display->flushTask();
+}
+
+void Display::flushTask()
+{
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    pushSprite(flushingSprite);
+    restoreOSD(flushingSprite);
+    xSemaphoreGive(flushIdle);
+  }
+}
+
 // new function to push the framebuffer to the screen
 void Display::flushSprite()
 {
   if (frameSprite) {
-    xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
-    frameSprite->pushSprite(0, 0);
-    xSemaphoreGiveRecursive(tft_mutex);
+    xSemaphoreTake(flushIdle, portMAX_DELAY);
+    composeOSD(frameSprite);
+    pushSprite(frameSprite);
+    restoreOSD(frameSprite);
+    shownSprite = frameSprite;
+    xSemaphoreGive(flushIdle);
+  } else {
+    endBandedFrame();
+  }
+}
+
+void Display::presentSprite()
+{
+  if (!spareSprite) {
+    flushSprite();
+    return;
+  }
+  // the spare is free once the previous frame has been sent
+  xSemaphoreTake(flushIdle, portMAX_DELAY);
+  // nothing else may draw into the sprite while it changes hands
+  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  composeOSD(frameSprite);
+  flushingSprite = frameSprite;
+  shownSprite = frameSprite;
+  frameSprite = spareSprite;
+  spareSprite = flushingSprite;
+  xSemaphoreGiveRecursive(tft_mutex);
+  xTaskNotifyGive(flushTaskHandle);
+}
+
+bool Display::repaint(bool wholeFrame)
+{
+  if (!shownSprite) {
+    return false;
+  }
+  xSemaphoreTake(flushIdle, portMAX_DELAY);
+  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  // the old text has to be painted over as well as the new text drawn
+  OSDRect oldRects[OSD_POSITION_COUNT];
+  int oldRectCount = osd.getRectCount();
+  for (int i = 0; i < oldRectCount; i++) {
+    oldRects[i] = osd.getRect(i);
   }
-  // If no sprite, we drew directly, so nothing to flush.
+  composeOSD(shownSprite);
+  if (wholeFrame) {
+    pushSprite(shownSprite, true);
+  } else {
+    // the tile hashes don't cover these partial updates
+    for (int i = 0; i < oldRectCount; i++) {
+      const OSDRect &r = oldRects[i];
+      shownSprite->pushSprite(r.x, r.y, r.x, r.y, r.w, r.h);
+      invalidateTiles(r.x, r.y, r.w, r.h);
+    }
+    for (int i = 0; i < osd.getRectCount(); i++) {
+      const OSDRect &r = osd.getRect(i);
+      shownSprite->pushSprite(r.x, r.y, r.x, r.y, r.w, r.h);
+      invalidateTiles(r.x, r.y, r.w, r.h);
+    }
+  }
+  restoreOSD(shownSprite);
+  xSemaphoreGiveRecursive(tft_mutex);
+  xSemaphoreGive(flushIdle);
+  return true;
+}
+
+bool Display::refreshOSD()
+{
+  return repaint(false);
+}
+
+bool Display::redrawShownSprite()
+{
+  return repaint(true);
 }
 
 void Display::fillSprite(uint16_t color)
@@ -124,11 +496,50 @@ void Display::fillSprite(uint16_t color)
     xSemaphoreGiveRecursive(tft_mutex);
   } else {
     xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+    clearedWidth = -1;
     tft->fillScreen(color);
     xSemaphoreGiveRecursive(tft_mutex);
   }
 }
 
+void Display::clearAround(int x, int y, int width, int height)
+{
+  int screenWidth = tft->width();
+  int screenHeight = tft->height();
+  TFT_eSPI *target = frameSprite;
+  if (!frameSprite) {
+    // the panel keeps the bars from last time, unless the image moved
+    if (x == clearedX && y == clearedY && width == clearedWidth &&
+        height == clearedHeight) {
+      return;
+    }
+    clearedX = x;
+    clearedY = y;
+    clearedWidth = width;
+    clearedHeight = height;
+    target = tft;
+  }
+  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  if (y > 0) {
+    target->fillRect(0, 0, screenWidth, y, TFT_BLACK);
+  }
+  if (y + height < screenHeight) {
+    target->fillRect(0, y + height, screenWidth, screenHeight - y - height,
+                     TFT_BLACK);
+  }
+  // bands are cleared across the whole width as they're drawn
+  if (frameSprite || !bandBuffers[0]) {
+    if (x > 0) {
+      target->fillRect(0, y, x, height, TFT_BLACK);
+    }
+    if (x + width < screenWidth) {
+      target->fillRect(x + width, y, screenWidth - x - width, height,
+                       TFT_BLACK);
+    }
+  }
+  xSemaphoreGiveRecursive(tft_mutex);
+}
+
 int Display::width()
 {
   return tft->width();
@@ -144,10 +555,25 @@ void Display::fillScreen(uint16_t color)
   if (frameSprite) {
     frameSprite->fillSprite(color);
   } else {
+    clearedWidth = -1;
     tft->fillScreen(color);
   }
 }
 
+void Display::composeOSD(TFT_eSprite *sprite)
+{
+  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  osd.compose(sprite);
+  xSemaphoreGiveRecursive(tft_mutex);
+}
+
+void Display::restoreOSD(TFT_eSprite *sprite)
+{
+  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  osd.restore(sprite);
+  xSemaphoreGiveRecursive(tft_mutex);
+}
+
 void Display::drawOSD(const char *text, OSDPosition position, OSDLevel level)
 {
   if (_prefs->getOsdLevel() < level)
@@ -155,46 +581,27 @@ void Display::drawOSD(const char *text, OSDPosition position, OSDLevel level)
     return;
   }
   xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
-  
-  // Decide where to draw
-  TFT_eSPI* target = frameSprite ? (TFT_eSPI*)frameSprite : tft;
-  
-  // Set up font/colors
+  if (osd.isReady())
+  {
+    osd.set(position, text);
+    if (!frameSprite && bandY < 0)
+    {
+      // no sprite to composite over, draw straight to the screen
+      osd.drawDirect(tft, position);
+    }
+    xSemaphoreGiveRecursive(tft_mutex);
+    return;
+  }
+
+  // not enough memory for the glyph strip, draw the text the slow way
+  TFT_eSPI *target = frameSprite ? (TFT_eSPI *)frameSprite : tft;
   target->setTextColor(TFT_ORANGE, TFT_BLACK);
-  // Re-ensure font/size if using direct tft as it might have changed? 
-  // Good practice to set it before use.
   target->setTextFont(2);
   target->setTextSize(1);
-
-  int textWidth = target->textWidth(text);
-  int textHeight = target->fontHeight();
-  int x = 0;
-  int y = 0;
-
-  switch (position)
-  {
-  case TOP_LEFT:
-    x = 20;
-    y = 20;
-    break;
-  case TOP_RIGHT:
-    x = width() - textWidth - 20;
-    y = 20;
-    break;
-  case BOTTOM_LEFT:
-    x = 20;
-    y = height() - textHeight - 20;
-    break;
-  case BOTTOM_RIGHT:
-    x = width() - textWidth - 20;
-    y = height() - textHeight - 20;
-    break;
-  case CENTER:
-    x = (width() - textWidth) / 2;
-    y = (height() - textHeight) / 2;
-    break;
-  }
+  int x, y;
+  OSDOverlay::getPosition(position, target->textWidth(text),
+                          target->fontHeight(), width(), height(), x, y);
   target->setCursor(x, y);
   target->println(text);
   xSemaphoreGiveRecursive(tft_mutex);
-}
\ No newline at end of file
+}
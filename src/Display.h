@@ -4,6 +4,7 @@
 #include <TFT_eSPI.h>
 #include "Prefs.h"
 #include "OSD.h"
+#include "OSDOverlay.h"
 #include "freertos/semphr.h"
 
 class Prefs;
@@ -12,22 +13,96 @@ class Display
 {
 private:
   TFT_eSPI *tft;
+  // the sprite being drawn into
   TFT_eSprite *frameSprite;
+  // second sprite for double buffering, on screen or being sent to it
+  TFT_eSprite *spareSprite = NULL;
   Prefs *_prefs;
   uint16_t *dmaBuffer[2] = {NULL, NULL};
   int dmaBufferIndex = 0;
   SemaphoreHandle_t tft_mutex;
 
+  // pushes presented sprites to the panel on the other core
+  TaskHandle_t flushTaskHandle = NULL;
+  TFT_eSprite *flushingSprite = NULL;
+  // held while a presented sprite is being sent
+  SemaphoreHandle_t flushIdle = NULL;
+  // the sprite that was last sent to the panel
+  TFT_eSprite *shownSprite = NULL;
+
+  // OSD text composited over frames as they're sent
+  OSDOverlay osd;
+
+  // hash of each tile of what's on the panel, so that only the tiles that
+  // change are sent. Zero marks a tile whose contents aren't known.
+  static const int DIRTY_TILE_SIZE = 16;
+  uint32_t *tileHashes = NULL;
+  int tileColumns = 0;
+  int tileRows = 0;
+  // a sprite transfer has been started and not waited for
+  bool dmaActive = false;
+
+  // Without a sprite, frames are assembled a band of rows at a time in
+  // internal RAM. One band is sent while the next is drawn.
+  static const int BAND_HEIGHT = 16;
+  uint16_t *bandBuffers[2] = {NULL, NULL};
+  int bandIndex = 0;
+  // first screen row of the band being drawn, -1 between frames
+  int bandY = -1;
+  // one past the last row drawn into the band
+  int bandEnd = -1;
+  // image area last cleared around on the panel when drawing without a sprite
+  int clearedX = -1, clearedY = -1, clearedWidth = -1, clearedHeight = -1;
+
+  TFT_eSprite *createFrameSprite();
+  // Send the tiles of the sprite that differ from the panel, or all of them.
+  void pushSprite(TFT_eSprite *sprite, bool wholeSprite = false);
+  void pushRect(TFT_eSprite *sprite, int x, int y, int w, int h);
+  void finishDMA();
+  uint32_t hashTile(const uint16_t *pixels, int stride, int x, int y, int w,
+                    int h);
+  void invalidateTiles(int x, int y, int w, int h);
+  void drawPixelsToBand(int x, int y, int width, int height, uint16_t *pixels);
+  void flushBand();
+  void startBand(int row);
+  void endBandedFrame();
+  void waitForFlush();
+  void composeOSD(TFT_eSprite *sprite);
+  void restoreOSD(TFT_eSprite *sprite);
+  bool repaint(bool wholeFrame);
+  static void _flushTask(void *param);
+  void flushTask();
+
 public:
   Display(Prefs *prefs);
   void setBrightness(uint8_t brightness);
   void drawPixels(int x, int y, int width, int height, uint16_t *pixels);
   void drawPixelsToSprite(int x, int y, int width, int height, uint16_t *pixels);
+  // Send the sprite to the panel and wait for it to get there.
   void flushSprite();
+  // Send the sprite to the panel in the background and switch drawing to the
+  // other buffer. The next frame must redraw the whole sprite. Falls back to
+  // flushSprite when there is only one buffer.
+  void presentSprite();
+  // Re-composite the OSD over the frame that's on screen and send only the
+  // pixels that changed. The frame is not touched so nothing is re-decoded.
+  // Returns false if there's no retained frame to composite over.
+  bool refreshOSD();
+  // Send the frame that's on screen again, with the current OSD.
+  bool redrawShownSprite();
   void fillSprite(uint16_t color);
+  // Clear the screen around an image that doesn't fill it.
+  void clearAround(int x, int y, int width, int height);
+  // true once a sprite has been sent that refreshOSD can composite over
+  bool hasShownSprite() { return shownSprite != nullptr; }
+  // frames are sent in bands as they're drawn, which needs rows to arrive in
+  // order
+  bool drawsInBands() { return bandBuffers[0] != NULL; }
   int width();
   int height();
   void fillScreen(uint16_t color);
+  // Queue OSD text for the next frame. It replaces any text at the same
+  // position and is drawn on top of the frame when it's sent to the panel.
   void drawOSD(const char *text, OSDPosition position, OSDLevel level);
   void drawSDCardFailed();
   static uint16_t color565(uint8_t r, uint8_t g, uint8_t b)
@@ -0,0 +1,84 @@
+#include "FramePool.h"
+#include <esp_heap_caps.h>
+
+// slot buffers grow in steps of this many bytes
+#define SLOT_GROWTH_STEP 4096
+
+void *reallocFrameMemory(void *ptr, size_t size)
+{
+#ifdef BOARD_HAS_PSRAM
+  void *mem = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM);
+  if (mem)
+  {
+    return mem;
+  }
+#endif
+  return realloc(ptr, size);
+}
+
+FramePool::FramePool(int slotCount, size_t initialCapacity)
+    : mSlotCount(slotCount)
+{
+  mSlots = (FrameSlot *)calloc(slotCount, sizeof(FrameSlot));
+  mFreeSlots = xQueueCreate(slotCount, sizeof(FrameSlot *));
+  for (int i = 0; i < slotCount; i++)
+  {
+    FrameSlot *slot = &mSlots[i];
+    slot->pool = this;
+    if (initialCapacity > 0)
+    {
+      reserve(slot, initialCapacity);
+    }
+    xQueueSend(mFreeSlots, &slot, 0);
+  }
+}
+
+FramePool::~FramePool()
+{
+  for (int i = 0; i < mSlotCount; i++)
+  {
+    free(mSlots[i].data);
+  }
+  free(mSlots);
+  vQueueDelete(mFreeSlots);
+}
+
+FrameSlot *FramePool::acquire(TickType_t wait)
+{
+  FrameSlot *slot = NULL;
+  if (xQueueReceive(mFreeSlots, &slot, wait) != pdTRUE)
+  {
+    return NULL;
+  }
+  slot->length = 0;
+  slot->frameIndex = 0;
+  slot->format = FrameFormat::JPEG;
+  return slot;
+}
+
+bool FramePool::reserve(FrameSlot *slot, size_t length)
+{
+  if (length <= slot->capacity)
+  {
+    return true;
+  }
+  size_t capacity =
+      (length + SLOT_GROWTH_STEP - 1) / SLOT_GROWTH_STEP * SLOT_GROWTH_STEP;
+  uint8_t *data = (uint8_t *)reallocFrameMemory(slot->data, capacity);
+  if (!data)
+  {
+    Serial.printf("Failed to grow frame slot to %u bytes\n", capacity);
+    return false;
+  }
+  slot->data = data;
+  slot->capacity = capacity;
+  return true;
+}
+
+void FramePool::release(FrameSlot *slot)
+{
+  if (slot && slot->pool)
+  {
+    xQueueSend(slot->pool->mFreeSlots, &slot, 0);
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+
+class FramePool;
+
+enum class FrameFormat
+{
+  JPEG,
+  // the NUL terminated path of a JPEG that's too big to load, it's read from
+  // the card as it's decoded
+  JPEG_FILE,
+  // already decoded, big endian pixels of the given size
+  RGB565,
+  // Tinytron codec frame, see TinyFrameFormat.h
+  TINY_FRAME
+};
+
+// realloc() for large buffers such as frames and frame tables. They go in
+// PSRAM when there is some, keeping internal RAM for the stacks and DMA.
+void *reallocFrameMemory(void *ptr, size_t size);
+
+// A frame leased from a FramePool. Whoever acquired the slot owns it, and
+// the data it points to, until it is released back to the pool.
+struct FrameSlot
+{
+  uint8_t *data;
+  size_t capacity;
+  size_t length;
+  // position of the frame in its stream, for sources that have one
+  size_t frameIndex;
+  // NULL for slots that are owned by something else, releasing them does
+  // nothing
+  FramePool *pool;
+  FrameFormat format;
+  // size of RGB565 frames
+  uint16_t width;
+  uint16_t height;
+};
+
+// Fixed set of frame buffers, preallocated in PSRAM when available, that are
+// handed from a source to the player and back without copying. Buffers only
+// ever grow so a steady stream of frames causes no heap churn.
+class FramePool
+{
+private:
+  FrameSlot *mSlots;
+  int mSlotCount;
+  QueueHandle_t mFreeSlots;
+
+public:
+  FramePool(int slotCount, size_t initialCapacity);
+  ~FramePool();
+  // Lease a free slot, waiting up to the given number of ticks for one to be
+  // released. Returns NULL if none became free.
+  FrameSlot *acquire(TickType_t wait = portMAX_DELAY);
+  // Make sure the slot can hold length bytes.
+  static bool reserve(FrameSlot *slot, size_t length);
+  // Return a leased slot to the pool it came from. Safe to call with NULL or
+  // with a slot that has no pool.
+  static void release(FrameSlot *slot);
+  int getFreeCount() { return uxQueueMessagesWaiting(mFreeSlots); }
+};
@@ -0,0 +1,100 @@
+#include "DecodedImageCache.h"
+#include <esp_heap_caps.h>
+
+DecodedImageCache::DecodedImageCache(int width, int height)
+    : mWidth(width), mHeight(height)
+{
+  for (Entry &entry : mEntries)
+  {
+    entry = {};
+    entry.index = -1;
+  }
+#ifdef BOARD_HAS_PSRAM
+  mEnabled = true;
+#else
+  // a few screens of pixels don't fit alongside everything else in RAM
+  mEnabled = false;
+#endif
+}
+
+DecodedImageCache::~DecodedImageCache()
+{
+  for (Entry &entry : mEntries)
+  {
+    heap_caps_free(entry.slot.data);
+  }
+}
+
+FrameSlot *DecodedImageCache::find(int index)
+{
+  for (Entry &entry : mEntries)
+  {
+    if (entry.index == index && entry.slot.length > 0)
+    {
+      entry.lastUsed = ++mUseCount;
+      return &entry.slot;
+    }
+  }
+  return NULL;
+}
+
+FrameSlot *DecodedImageCache::reserve(int index, int keepIndex)
+{
+  if (!mEnabled)
+  {
+    return NULL;
+  }
+  Entry *victim = NULL;
+  for (Entry &entry : mEntries)
+  {
+    if (entry.index == keepIndex && entry.index != -1)
+    {
+      continue;
+    }
+    if (!victim || entry.index == -1 ||
+        (victim->index != -1 && entry.lastUsed < victim->lastUsed))
+    {
+      victim = &entry;
+    }
+  }
+  if (!victim)
+  {
+    return NULL;
+  }
+  size_t size = mWidth * mHeight * sizeof(uint16_t);
+  if (!victim->slot.data)
+  {
+#ifdef BOARD_HAS_PSRAM
+    victim->slot.data = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+#endif
+    if (!victim->slot.data)
+    {
+      Serial.println("Failed to allocate image cache buffer");
+      return NULL;
+    }
+    victim->slot.capacity = size;
+  }
+  victim->index = index;
+  victim->lastUsed = ++mUseCount;
+  victim->slot.length = 0;
+  victim->slot.frameIndex = index;
+  victim->slot.pool = NULL;
+  victim->slot.format = FrameFormat::RGB565;
+  victim->slot.width = mWidth;
+  victim->slot.height = mHeight;
+  return &victim->slot;
+}
+
+void DecodedImageCache::commit(FrameSlot *slot)
+{
+  slot->length = slot->capacity;
+}
+
+void DecodedImageCache::clear()
+{
+  for (Entry &entry : mEntries)
+  {
+    entry.index = -1;
+    entry.slot.length = 0;
+  }
+}
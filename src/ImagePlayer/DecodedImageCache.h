@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../FramePool.h"
+
+// Screen sized RGB565 renderings of recently shown and prefetched images, kept
+// in PSRAM so that stepping through a slideshow doesn't decode the same JPEG
+// again. Buffers are allocated the first time they're needed and reused after
+// that, the least recently used image is dropped to make room.
+class DecodedImageCache
+{
+public:
+  static const int CAPACITY = 4;
+
+private:
+  struct Entry
+  {
+    // image index, -1 when the entry is free
+    int index;
+    uint32_t lastUsed;
+    FrameSlot slot;
+  };
+
+  Entry mEntries[CAPACITY];
+  int mWidth;
+  int mHeight;
+  uint32_t mUseCount = 0;
+  bool mEnabled;
+
+public:
+  DecodedImageCache(int width, int height);
+  ~DecodedImageCache();
+  // false when there's no PSRAM to keep the images in
+  bool isEnabled() { return mEnabled; }
+  // The rendered image, or NULL if it isn't cached. The slot has no pool so
+  // releasing it does nothing.
+  FrameSlot *find(int index);
+  // A buffer to render the image into, replacing the least recently used
+  // entry other than the one for keepIndex. The entry only becomes visible
+  // to find once commit is called. Returns NULL if there's no memory.
+  FrameSlot *reserve(int index, int keepIndex);
+  void commit(FrameSlot *slot);
+  void clear();
+};
@@ -5,6 +5,7 @@
 #include "../Prefs.h"
 #include "ImageSource.h"
 #include <Arduino.h>
+#include <esp_heap_caps.h>
 
 static void fadeBacklight(Display &display, int fromBrightness,
                           int toBrightness, int steps, int delayMs)
@@ -33,11 +34,18 @@ void ImagePlayer::start()
 ImagePlayer::ImagePlayer(ImageSource *imageSource, Display &display,
                          Prefs &prefs, Battery &battery)
     : MediaPlayer(display, prefs, battery),
-      mImageSource(imageSource)
+      mImageSource(imageSource),
+      mCache(display.width(), display.height()),
+      mCacheScaleMode(mScaleMode), mCacheAnchor(mViewportAnchor)
 {
   mLastAdvanceMs = millis();
 }
 
+ImagePlayer::~ImagePlayer()
+{
+  heap_caps_free(mCardRendering.data);
+}
+
 void ImagePlayer::set(int index)
 {
   if (!mImageSource)
@@ -47,6 +55,7 @@ void ImagePlayer::set(int index)
   if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
   {
     mImageSource->setImage(index);
+    mImageRequests++;
     mLastAdvanceMs = millis();
     xSemaphoreGive(mMutex);
   }
@@ -65,22 +74,181 @@ void ImagePlayer::next()
   if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
   {
     mImageSource->nextImage();
+    mImageRequests++;
     mLastAdvanceMs = millis();
     xSemaphoreGive(mMutex);
   }
 }
 
-bool ImagePlayer::getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength)
+FrameSlot *ImagePlayer::getFrame()
 {
   if (!mImageSource)
+  {
+    return NULL;
+  }
+  if (!mImageSource->takeNewImage())
+  {
+    return NULL;
+  }
+  int index = mImageSource->getImageNumber();
+  FrameSlot *cached = mCache.find(index);
+  if (cached)
+  {
+    return cached;
+  }
+  return mImageSource->loadImage(index);
+}
+
+// Render an image into the cache, and onto the card if the source keeps
+// renderings of large images.
+bool ImagePlayer::renderToCache(int index, int keepIndex)
+{
+  FrameSlot *image = NULL;
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    image = mImageSource->loadImage(index);
+    xSemaphoreGive(mMutex);
+  }
+  if (!image)
   {
     return false;
   }
-  return mImageSource->getImageFrame(buffer, bufferLength, frameLength);
+  FrameSlot *rendered = mCache.reserve(index, keepIndex);
+  if (rendered)
+  {
+    bool decoded = renderFrame(image, (uint16_t *)rendered->data);
+    mCache.commit(rendered);
+    // a broken image is only kept for this session, not on the card
+    if (decoded && image->format != FrameFormat::RGB565)
+    {
+      mImageSource->storeRendering(index, rendered);
+    }
+  }
+  FramePool::release(image);
+  return rendered != NULL;
+}
+
+// Render a large image for the card only, without touching the cache
+bool ImagePlayer::renderForCard(int index)
+{
+  FrameSlot *image = NULL;
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    image = mImageSource->loadImage(index);
+    xSemaphoreGive(mMutex);
+  }
+  if (!image)
+  {
+    return true;
+  }
+  bool complete = true;
+  size_t size = mDisplay.width() * mDisplay.height() * sizeof(uint16_t);
+  if (!mCardRendering.data)
+  {
+    mCardRendering.data =
+        (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    mCardRendering.capacity = size;
+    mCardRendering.format = FrameFormat::RGB565;
+    mCardRendering.width = mDisplay.width();
+    mCardRendering.height = mDisplay.height();
+  }
+  if (mCardRendering.data)
+  {
+    mCardRenderingRequests = mImageRequests;
+    mRenderingForCard = true;
+    bool decoded = renderFrame(image, (uint16_t *)mCardRendering.data);
+    mRenderingForCard = false;
+    complete = !mRenderAborted;
+    if (decoded && image->format != FrameFormat::RGB565)
+    {
+      mCardRendering.length = size;
+      mCardRendering.frameIndex = index;
+      mImageSource->storeRendering(index, &mCardRendering);
+    }
+  }
+  FramePool::release(image);
+  return complete;
+}
+
+bool ImagePlayer::shouldAbortRender()
+{
+  return mRenderingForCard && mImageRequests != mCardRenderingRequests;
+}
+
+// While an image is on screen, render its neighbours into the cache so that
+// the next or previous image can be shown without reading and decoding it.
+// Once they're done, large images anywhere in the slideshow get renderings
+// on the card. One image is done per loop, and a rendering for the card is
+// given up when another image is asked for, so a button press isn't kept
+// waiting.
+void ImagePlayer::prefetch()
+{
+  if (!mCache.isEnabled() || mDisplay.drawsInBands())
+  {
+    return;
+  }
+  if (!mCacheConfigured || mScaleMode != mCacheScaleMode ||
+      mViewportAnchor != mCacheAnchor)
+  {
+    mCache.clear();
+    mCacheConfigured = true;
+    mCacheScaleMode = mScaleMode;
+    mCacheAnchor = mViewportAnchor;
+    mPrefetchedFor = -1;
+    mWarmIndex = 0;
+    mImageSource->setRenderingFormat(
+        mDisplay.width(), mDisplay.height(),
+        ((uint32_t)mScaleMode << 8) | (uint32_t)mViewportAnchor);
+  }
+  int current = mImageSource->getImageNumber();
+  int count = mImageSource->getImageCount();
+  // wait until the current image is on screen
+  if (count < 1 || current != lastRenderedIndex)
+  {
+    return;
+  }
+  if (current != mPrefetchedFor)
+  {
+    // a large image on screen is rendered again for the card the first time
+    // it's shown
+    if (!mCache.find(current) && mImageSource->needsRendering(current))
+    {
+      if (renderToCache(current, current))
+      {
+        return;
+      }
+    }
+    int candidates[] = {(current + 1) % count, (current + count - 1) % count};
+    for (int index : candidates)
+    {
+      if (!mCache.find(index))
+      {
+        if (renderToCache(index, current))
+        {
+          return;
+        }
+        break;
+      }
+    }
+    mPrefetchedFor = current;
+    return;
+  }
+  if (mWarmIndex < count)
+  {
+    int index = mWarmIndex++;
+    if (index != current && mImageSource->needsRendering(index) &&
+        !renderForCard(index))
+    {
+      // try it again once the new image has settled
+      mWarmIndex = index;
+    }
+  }
 }
 
 void ImagePlayer::onLoop()
 {
+  prefetch();
+
   // Auto-advance
   uint32_t intervalMs = mPrefs.getSlideshowInterval() * 1000;
   if (intervalMs > 0)
@@ -110,7 +278,7 @@ void ImagePlayer::onFrameDisplayed()
     // Draw our image-specific OSD to the sprite
     if (mImageSource->showImageNameOSD())
     {
-      drawOSDTimed(mImageSource->getImageName(), TOP_LEFT, OSDLevel::STANDARD);
+      drawOSDTimed(mImageSource->getImageName().c_str(), TOP_LEFT, OSDLevel::STANDARD);
     }
 
     // Manually flush the sprite to get the new image (and its OSD) on screen.
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "DecodedImageCache.h"
 #include "ImageSource.h"
 #include "../MediaPlayer.h"
 
@@ -9,15 +10,40 @@ private:
   ImageSource *mImageSource = NULL;
   uint32_t mLastAdvanceMs = 0;
   int lastRenderedIndex = -1;
+  DecodedImageCache mCache;
+  // what the cached images were rendered with, once it's been set up
+  bool mCacheConfigured = false;
+  ScaleMode mCacheScaleMode;
+  ViewportAnchor mCacheAnchor;
+  // the image whose neighbours have all been prefetched or failed to load
+  int mPrefetchedFor = -1;
+  // next image to check for a missing rendering on the card
+  int mWarmIndex = 0;
+  // Renderings for the card of images that aren't near the current one go
+  // through here, leaving the cached neighbours alone. Allocated when it's
+  // first needed.
+  FrameSlot mCardRendering = {};
+  // bumped by set and next, a rendering for the card started before then is
+  // given up so the new image isn't kept waiting
+  volatile uint32_t mImageRequests = 0;
+  uint32_t mCardRenderingRequests = 0;
+  bool mRenderingForCard = false;
+
+  void prefetch();
+  bool renderToCache(int index, int keepIndex);
+  // false if it was given up for another image
+  bool renderForCard(int index);
 
 protected:
-  virtual bool getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength) override;
+  virtual FrameSlot *getFrame() override;
   virtual void onFrameDisplayed() override;
   virtual void onLoop() override;
+  virtual bool shouldAbortRender() override;
 
 public:
   ImagePlayer(ImageSource *imageSource, Display &display, Prefs &prefs,
               Battery &battery);
+  ~ImagePlayer();
 
   virtual void set(int index) override;
   virtual void next() override;
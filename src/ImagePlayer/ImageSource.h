@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <string>
 
+#include "../FramePool.h"
+
 class ImageSource
 {
 public:
@@ -14,8 +16,21 @@ public:
   virtual std::string getImageName() = 0;
   virtual void setImage(int index) = 0;
   virtual void nextImage() = 0;
-  virtual bool getImageFrame(uint8_t **buffer, size_t &bufferLength,
-                             size_t &frameLength) = 0;
+  // Lease the current image if it hasn't been shown yet, NULL otherwise. The
+  // caller releases the slot back to its pool.
+  virtual FrameSlot *getImageFrame() = 0;
+  // true once after the current image changes, for players that may already
+  // have it without loading it
+  virtual bool takeNewImage() = 0;
+  // Lease any image by index, for prefetching. NULL if it can't be loaded.
+  virtual FrameSlot *loadImage(int index) = 0;
+  // Sources may keep panel sized renderings of large images and return them
+  // from loadImage in place of the original. The variant tells renderings
+  // made with different settings apart.
+  virtual void setRenderingFormat(int width, int height, uint32_t variant) {}
+  // true if the image is large and has no rendering yet
+  virtual bool needsRendering(int index) { return false; }
+  virtual void storeRendering(int index, const FrameSlot *rendered) {}
   virtual uint32_t getAutoAdvanceIntervalMs() { return 0; }
   virtual bool showImageNameOSD() { return true; }
 };
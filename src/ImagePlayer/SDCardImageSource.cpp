@@ -1,12 +1,24 @@
 #include "SDCardImageSource.h"
+#include "../MediaCatalog.h"
 #include "../SDCard.h"
 #include <Arduino.h>
-#include <algorithm>
-#include <stdio.h>
 
-SDCardImageSource::SDCardImageSource(SDCard *sdCard, const char *path,
-                                     bool showFilename)
-    : mSDCard(sdCard), mPath(path), mShowFilename(showFilename) {}
+// one image on screen and one being loaded or prefetched
+#define IMAGE_SLOTS 2
+
+// larger images are streamed from the card while they're decoded instead of
+// being loaded whole
+#ifdef BOARD_HAS_PSRAM
+#define MAX_LOADED_IMAGE_SIZE (512 * 1024)
+#else
+#define MAX_LOADED_IMAGE_SIZE (48 * 1024)
+#endif
+
+SDCardImageSource::SDCardImageSource(SDCard *sdCard, MediaCatalog *catalog,
+                                     const char *path, bool showFilename)
+    : mSDCard(sdCard), mCatalog(catalog), mPath(path),
+      mShowFilename(showFilename),
+      mFramePool(IMAGE_SLOTS, 0) {}
 
 bool SDCardImageSource::fetchImageData()
 {
@@ -16,22 +28,11 @@ bool SDCardImageSource::fetchImageData()
     return false;
   }
 
-  mImageFiles.clear();
-
-  auto jpg = mSDCard->listFiles(mPath, ".jpg");
-  auto jpeg = mSDCard->listFiles(mPath, ".jpeg");
-  auto JPG = mSDCard->listFiles(mPath, ".JPG");
-  auto JPEG = mSDCard->listFiles(mPath, ".JPEG");
-
-  mImageFiles.insert(mImageFiles.end(), jpg.begin(), jpg.end());
-  mImageFiles.insert(mImageFiles.end(), jpeg.begin(), jpeg.end());
-  mImageFiles.insert(mImageFiles.end(), JPG.begin(), JPG.end());
-  mImageFiles.insert(mImageFiles.end(), JPEG.begin(), JPEG.end());
-
-  std::sort(mImageFiles.begin(), mImageFiles.end());
-  mImageFiles.erase(std::unique(mImageFiles.begin(), mImageFiles.end()),
-                    mImageFiles.end());
-
+  if (!mCatalog->begin())
+  {
+    return false;
+  }
+  mImageFiles = mCatalog->find(MediaType::IMAGE, mPath);
   if (mImageFiles.empty())
   {
     Serial.println("No image files found");
@@ -86,63 +87,114 @@ std::string SDCardImageSource::getImageName()
 {
   if (mImageNumber >= 0 && mImageNumber < (int)mImageFiles.size())
   {
-    std::string fullPath = mImageFiles[mImageNumber];
-    size_t lastSlash = fullPath.find_last_of('/');
-    if (lastSlash != std::string::npos)
-    {
-      return fullPath.substr(lastSlash + 1);
-    }
-    return fullPath;
+    const char *fullPath = mCatalog->getPath(mImageFiles[mImageNumber]);
+    const char *lastSlash = strrchr(fullPath, '/');
+    return lastSlash ? lastSlash + 1 : fullPath;
   }
   return "Unknown";
 }
 
-bool SDCardImageSource::loadCurrentImage(uint8_t **buffer, size_t &bufferLength,
-                                         size_t &frameLength)
+FrameSlot *SDCardImageSource::loadImage(int index)
 {
-  if (mImageNumber < 0 || mImageNumber >= (int)mImageFiles.size())
+  if (index < 0 || index >= (int)mImageFiles.size())
   {
-    return false;
+    return NULL;
   }
 
-  const std::string &filename = mImageFiles[mImageNumber];
-  FILE *f = fopen(filename.c_str(), "rb");
-  if (!f)
+  FrameSlot *slot = mFramePool.acquire(0);
+  if (!slot)
   {
-    Serial.printf("Failed to open image file %s\n", filename.c_str());
-    return false;
+    Serial.println("No free frame slot for image");
+    return NULL;
   }
+  slot->frameIndex = index;
 
-  fseek(f, 0, SEEK_END);
-  long size = ftell(f);
-  if (size <= 0)
+  const char *filename = mCatalog->getPath(mImageFiles[index]);
+  char thumbnail[ThumbnailCache::PATH_LENGTH];
+  if (mThumbnails.getPath(filename, thumbnail) &&
+      mThumbnails.load(thumbnail, mFile, slot))
   {
-    fclose(f);
-    return false;
+    return slot;
+  }
+
+  if (!mFile.open(filename))
+  {
+    Serial.printf("Failed to open image file %s\n", filename);
+    FramePool::release(slot);
+    return NULL;
   }
-  rewind(f);
 
-  if ((size_t)size > bufferLength)
+  uint64_t size = mFile.size();
+  if (size == 0)
+  {
+    mFile.close();
+    FramePool::release(slot);
+    return NULL;
+  }
+  if (size > MAX_LOADED_IMAGE_SIZE)
+  {
+    mFile.close();
+    size_t pathLength = strlen(filename) + 1;
+    if (!FramePool::reserve(slot, pathLength))
+    {
+      FramePool::release(slot);
+      return NULL;
+    }
+    memcpy(slot->data, filename, pathLength);
+    slot->length = pathLength;
+    slot->format = FrameFormat::JPEG_FILE;
+    return slot;
+  }
+  if (!FramePool::reserve(slot, (size_t)size))
   {
-    *buffer = (uint8_t *)realloc(*buffer, (size_t)size);
-    bufferLength = (size_t)size;
+    FramePool::release(slot);
+    mFile.close();
+    return NULL;
   }
 
-  size_t readCount = fread(*buffer, 1, (size_t)size, f);
-  fclose(f);
+  size_t readCount = mFile.read(slot->data, (size_t)size);
+  mFile.close();
 
   if (readCount != (size_t)size)
   {
-    Serial.printf("Short read for %s\n", filename.c_str());
+    Serial.printf("Short read for %s\n", filename);
+    FramePool::release(slot);
+    return NULL;
+  }
+
+  slot->length = (size_t)size;
+  return slot;
+}
+
+bool SDCardImageSource::needsRendering(int index)
+{
+  if (index < 0 || index >= (int)mImageFiles.size())
+  {
     return false;
   }
+  const char *filename = mCatalog->getPath(mImageFiles[index]);
+  char thumbnail[ThumbnailCache::PATH_LENGTH];
+  return mThumbnails.getPath(filename, thumbnail) &&
+         !mThumbnails.exists(thumbnail);
+}
 
-  frameLength = (size_t)size;
-  return true;
+void SDCardImageSource::storeRendering(int index, const FrameSlot *rendered)
+{
+  if (index < 0 || index >= (int)mImageFiles.size() ||
+      rendered->length != mThumbnails.getFrameSize())
+  {
+    return;
+  }
+  const char *filename = mCatalog->getPath(mImageFiles[index]);
+  char thumbnail[ThumbnailCache::PATH_LENGTH];
+  if (mThumbnails.getPath(filename, thumbnail) &&
+      !mThumbnails.exists(thumbnail))
+  {
+    mThumbnails.store(thumbnail, rendered->data);
+  }
 }
 
-bool SDCardImageSource::getImageFrame(uint8_t **buffer, size_t &bufferLength,
-                                      size_t &frameLength)
+bool SDCardImageSource::takeNewImage()
 {
   if (mImageFiles.empty())
   {
@@ -151,11 +203,16 @@ bool SDCardImageSource::getImageFrame(uint8_t **buffer, size_t &bufferLength,
 
   // For still images, only emit a frame when forced by a channel change.
   // VideoPlayer owns the slideshow timer to avoid conflicts with manual next.
-  if (!mForceNext)
+  bool forced = mForceNext;
+  mForceNext = false;
+  return forced;
+}
+
+FrameSlot *SDCardImageSource::getImageFrame()
+{
+  if (!takeNewImage())
   {
-    return false;
+    return NULL;
   }
-
-  mForceNext = false;
-  return loadCurrentImage(buffer, bufferLength, frameLength);
+  return loadImage(mImageNumber);
 }
@@ -3,15 +3,20 @@
 #include <string>
 #include <vector>
 
+#include "../BufferedFile.h"
 #include "ImageSource.h"
+#include "ThumbnailCache.h"
 
 class SDCard;
+class MediaCatalog;
 
 class SDCardImageSource : public ImageSource
 {
 private:
-  std::vector<std::string> mImageFiles;
+  // catalog entries of the images
+  std::vector<uint32_t> mImageFiles;
   SDCard *mSDCard;
+  MediaCatalog *mCatalog;
   const char *mPath;
   bool mShowFilename;
   int mImageNumber = 0;
@@ -19,20 +24,28 @@ private:
   unsigned long mIntervalMs = 5000;
   bool mForceNext = true;
   volatile bool mWrapped = false;
-
-  bool loadCurrentImage(uint8_t **buffer, size_t &bufferLength,
-                        size_t &frameLength);
+  BufferedFile mFile;
+  FramePool mFramePool;
+  ThumbnailCache mThumbnails;
 
 public:
-  SDCardImageSource(SDCard *sdCard, const char *path, bool showFilename = true);
+  SDCardImageSource(SDCard *sdCard, MediaCatalog *catalog, const char *path,
+                    bool showFilename = true);
   bool fetchImageData() override;
   int getImageCount() override { return mImageFiles.size(); }
   int getImageNumber() override { return mImageNumber; }
   std::string getImageName() override;
   void setImage(int index) override;
   void nextImage() override;
-  bool getImageFrame(uint8_t **buffer, size_t &bufferLength,
-                     size_t &frameLength) override;
+  FrameSlot *getImageFrame() override;
+  bool takeNewImage() override;
+  FrameSlot *loadImage(int index) override;
+  void setRenderingFormat(int width, int height, uint32_t variant) override
+  {
+    mThumbnails.setFormat(width, height, variant);
+  }
+  bool needsRendering(int index) override;
+  void storeRendering(int index, const FrameSlot *rendered) override;
   uint32_t getAutoAdvanceIntervalMs() override { return (uint32_t)mIntervalMs; }
   bool showImageNameOSD() override { return mShowFilename; }
   bool consumeWrapped()
@@ -0,0 +1,110 @@
+#include "ThumbnailCache.h"
+#include <Arduino.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define THUMBNAIL_DIRECTORY "/sdcard/.thumbs"
+
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t length)
+{
+  // FNV-1a
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void ThumbnailCache::setFormat(int width, int height, uint32_t variant)
+{
+  mWidth = width;
+  mHeight = height;
+  mVariant = variant;
+}
+
+bool ThumbnailCache::getPath(const char *image, char *path)
+{
+  if (mWidth <= 0 || mHeight <= 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if (stat(image, &st) != 0 || (size_t)st.st_size <= getFrameSize())
+  {
+    return false;
+  }
+  uint64_t size = st.st_size;
+  int64_t modified = st.st_mtime;
+  int32_t format[] = {mWidth, mHeight, (int32_t)mVariant};
+  uint64_t hash = hashBytes(0xcbf29ce484222325ULL, image, strlen(image));
+  hash = hashBytes(hash, &size, sizeof(size));
+  hash = hashBytes(hash, &modified, sizeof(modified));
+  hash = hashBytes(hash, format, sizeof(format));
+  snprintf(path, PATH_LENGTH, THUMBNAIL_DIRECTORY "/%016llx.565",
+           (unsigned long long)hash);
+  return true;
+}
+
+bool ThumbnailCache::exists(const char *path)
+{
+  struct stat st;
+  return stat(path, &st) == 0 && (size_t)st.st_size == getFrameSize();
+}
+
+bool ThumbnailCache::load(const char *path, BufferedFile &file,
+                          FrameSlot *slot)
+{
+  size_t size = getFrameSize();
+  if (!file.open(path))
+  {
+    return false;
+  }
+  bool loaded = file.size() == size && FramePool::reserve(slot, size) &&
+                file.read(slot->data, size) == size;
+  file.close();
+  if (!loaded)
+  {
+    return false;
+  }
+  slot->length = size;
+  slot->format = FrameFormat::RGB565;
+  slot->width = mWidth;
+  slot->height = mHeight;
+  return true;
+}
+
+bool ThumbnailCache::store(const char *path, const uint8_t *pixels)
+{
+  if (!mDirectoryReady)
+  {
+    if (mkdir(THUMBNAIL_DIRECTORY, 0775) != 0 && errno != EEXIST)
+    {
+      Serial.printf("Failed to create %s\n", THUMBNAIL_DIRECTORY);
+      return false;
+    }
+    mDirectoryReady = true;
+  }
+  // written under another name first so that a half written file is never
+  // mistaken for a rendering
+  char tempPath[PATH_LENGTH + 4];
+  snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+  int fd = ::open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+  if (fd < 0)
+  {
+    Serial.printf("Failed to create %s\n", tempPath);
+    return false;
+  }
+  size_t size = getFrameSize();
+  bool written = ::write(fd, pixels, size) == (ssize_t)size;
+  ::close(fd);
+  if (!written || rename(tempPath, path) != 0)
+  {
+    unlink(tempPath);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "../BufferedFile.h"
+#include "../FramePool.h"
+
+// Panel sized RGB565 renderings of large photos, kept in a hidden directory
+// on the card so that later showings read a small file instead of decoding
+// the whole JPEG again. Files are named after a hash of the image's path,
+// size and modification time and of the settings it was rendered with, so a
+// changed image or setting simply misses and stale files are never read.
+class ThumbnailCache
+{
+private:
+  int mWidth = 0;
+  int mHeight = 0;
+  uint32_t mVariant = 0;
+  bool mDirectoryReady = false;
+
+public:
+  static const int PATH_LENGTH = 48;
+
+  // Set what renderings look like. Nothing is cached until this is called.
+  void setFormat(int width, int height, uint32_t variant);
+  size_t getFrameSize() { return (size_t)mWidth * mHeight * sizeof(uint16_t); }
+  // Where the image's rendering is or would be kept. False if the image is
+  // small enough that decoding it is as quick as reading a rendering.
+  bool getPath(const char *image, char *path);
+  bool exists(const char *path);
+  // Read a rendering into the slot.
+  bool load(const char *path, BufferedFile &file, FrameSlot *slot);
+  bool store(const char *path, const uint8_t *pixels);
+};
@@ -0,0 +1,293 @@
+#include "MediaCatalog.h"
+#include "BufferedFile.h"
+#include "SDCard.h"
+#include <Arduino.h>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CATALOG_PATH "/sdcard/.catalog"
+#define CATALOG_MAGIC 0x4743544d
+// bump when the layout of the file changes, older catalogs are rebuilt
+#define CATALOG_VERSION 1
+#define MAX_FOLDER_DEPTH 8
+#define MAX_PATH_LENGTH 256
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t infoCount;
+  uint32_t poolSize;
+} CatalogHeader;
+
+static bool getMediaType(const char *name, MediaType *type)
+{
+  const char *extension = strrchr(name, '.');
+  if (!extension)
+  {
+    return false;
+  }
+  if (strcasecmp(extension, ".avi") == 0 || strcasecmp(extension, ".tvf") == 0)
+  {
+    *type = MediaType::VIDEO;
+    return true;
+  }
+  if (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0)
+  {
+    *type = MediaType::IMAGE;
+    return true;
+  }
+  return false;
+}
+
+bool MediaCatalog::begin()
+{
+  if (mReady)
+  {
+    return true;
+  }
+  if (!mSDCard->isMounted())
+  {
+    Serial.println("SD card is not mounted");
+    return false;
+  }
+  unsigned long start = millis();
+  MediaCatalog previous(mSDCard);
+  previous.load();
+
+  bool changed = false;
+  char path[MAX_PATH_LENGTH] = "/sdcard";
+  scanFolder(path, strlen(path), 0, previous, changed);
+  // every file was known, but some known files may have gone
+  changed = changed || mEntries.size() != previous.mEntries.size();
+  const char *pool = mPool.data();
+  std::sort(mEntries.begin(), mEntries.end(),
+            [pool](const MediaCatalogEntry &a, const MediaCatalogEntry &b)
+            { return strcmp(pool + a.pathOffset, pool + b.pathOffset) < 0; });
+  Serial.printf("Catalog of %u files %s in %lu ms\n", mEntries.size(),
+                changed ? "updated" : "checked", millis() - start);
+  if (changed)
+  {
+    save();
+  }
+  mReady = true;
+  return true;
+}
+
+void MediaCatalog::scanFolder(char *path, size_t length, int depth,
+                              const MediaCatalog &previous, bool &changed)
+{
+  DIR *dir = opendir(path);
+  if (!dir)
+  {
+    Serial.printf("Failed to open folder %s\n", path);
+    return;
+  }
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL)
+  {
+    // hidden files and folders, which includes what we keep on the card
+    if (ent->d_name[0] == '.')
+    {
+      continue;
+    }
+    size_t nameLength = strlen(ent->d_name);
+    if (length + 1 + nameLength >= MAX_PATH_LENGTH)
+    {
+      continue;
+    }
+    path[length] = '/';
+    memcpy(path + length + 1, ent->d_name, nameLength + 1);
+    MediaType type;
+    if (ent->d_type == DT_DIR)
+    {
+      if (depth < MAX_FOLDER_DEPTH)
+      {
+        scanFolder(path, length + 1 + nameLength, depth + 1, previous,
+                   changed);
+      }
+    }
+    else if (ent->d_type == DT_REG && getMediaType(ent->d_name, &type))
+    {
+      addFile(path, type, previous, changed);
+    }
+  }
+  closedir(dir);
+  path[length] = '\0';
+}
+
+void MediaCatalog::addFile(const char *path, MediaType type,
+                           const MediaCatalog &previous, bool &changed)
+{
+  MediaCatalogEntry entry = {};
+  entry.type = type;
+  const MediaCatalogEntry *known = previous.findEntry(path);
+  if (type == MediaType::VIDEO)
+  {
+    if (mVideoInfo.size() > UINT16_MAX)
+    {
+      return;
+    }
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+      return;
+    }
+    VideoInfo info = {};
+    if (known && known->type == type && known->size == (uint32_t)st.st_size &&
+        known->modified == (uint32_t)st.st_mtime)
+    {
+      entry.valid = known->valid;
+      info = previous.mVideoInfo[known->infoIndex];
+    }
+    else
+    {
+      VideoFile *video = VideoFile::create(path);
+      entry.valid = video && video->readInfo(&info);
+      delete video;
+      changed = true;
+    }
+    entry.size = st.st_size;
+    entry.modified = st.st_mtime;
+    entry.infoIndex = mVideoInfo.size();
+    mVideoInfo.push_back(info);
+  }
+  else if (!known)
+  {
+    changed = true;
+  }
+  entry.pathOffset = mPool.size();
+  mPool.insert(mPool.end(), path, path + strlen(path) + 1);
+  mEntries.push_back(entry);
+}
+
+const MediaCatalogEntry *MediaCatalog::findEntry(const char *path) const
+{
+  const char *pool = mPool.data();
+  auto it = std::lower_bound(
+      mEntries.begin(), mEntries.end(), path,
+      [pool](const MediaCatalogEntry &entry, const char *path)
+      { return strcmp(pool + entry.pathOffset, path) < 0; });
+  if (it == mEntries.end() || strcmp(pool + it->pathOffset, path) != 0)
+  {
+    return NULL;
+  }
+  return &*it;
+}
+
+bool MediaCatalog::load()
+{
+  BufferedFile file;
+  if (!file.open(CATALOG_PATH))
+  {
+    return false;
+  }
+  CatalogHeader header;
+  bool loaded =
+      file.read(&header, sizeof(header)) == sizeof(header) &&
+      header.magic == CATALOG_MAGIC && header.version == CATALOG_VERSION &&
+      file.size() == sizeof(header) +
+                         (uint64_t)header.entryCount * sizeof(MediaCatalogEntry) +
+                         (uint64_t)header.infoCount * sizeof(VideoInfo) +
+                         header.poolSize;
+  if (loaded)
+  {
+    mEntries.resize(header.entryCount);
+    mVideoInfo.resize(header.infoCount);
+    mPool.resize(header.poolSize);
+    size_t entriesSize = mEntries.size() * sizeof(MediaCatalogEntry);
+    size_t infoSize = mVideoInfo.size() * sizeof(VideoInfo);
+    loaded = file.read(mEntries.data(), entriesSize) == entriesSize &&
+             file.read(mVideoInfo.data(), infoSize) == infoSize &&
+             file.read(mPool.data(), mPool.size()) == mPool.size() &&
+             (mPool.empty() || mPool.back() == '\0');
+  }
+  file.close();
+  for (size_t i = 0; loaded && i < mEntries.size(); i++)
+  {
+    const MediaCatalogEntry &entry = mEntries[i];
+    loaded = entry.pathOffset < mPool.size() &&
+             (entry.type != MediaType::VIDEO ||
+              entry.infoIndex < mVideoInfo.size());
+  }
+  if (!loaded)
+  {
+    Serial.println("Catalog is damaged, rebuilding it");
+    mEntries.clear();
+    mVideoInfo.clear();
+    mPool.clear();
+  }
+  return loaded;
+}
+
+bool MediaCatalog::save()
+{
+  // written under another name first so a half written catalog is never read
+  const char *tempPath = CATALOG_PATH ".tmp";
+  int fd = ::open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+  if (fd < 0)
+  {
+    Serial.println("Failed to write the catalog");
+    return false;
+  }
+  CatalogHeader header = {CATALOG_MAGIC, CATALOG_VERSION,
+                          (uint32_t)mEntries.size(),
+                          (uint32_t)mVideoInfo.size(), (uint32_t)mPool.size()};
+  size_t entriesSize = mEntries.size() * sizeof(MediaCatalogEntry);
+  size_t infoSize = mVideoInfo.size() * sizeof(VideoInfo);
+  bool written =
+      ::write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+      ::write(fd, mEntries.data(), entriesSize) == (ssize_t)entriesSize &&
+      ::write(fd, mVideoInfo.data(), infoSize) == (ssize_t)infoSize &&
+      ::write(fd, mPool.data(), mPool.size()) == (ssize_t)mPool.size();
+  ::close(fd);
+  // FAT can't rename over an existing file
+  unlink(CATALOG_PATH);
+  if (!written || rename(tempPath, CATALOG_PATH) != 0)
+  {
+    Serial.println("Failed to write the catalog");
+    unlink(tempPath);
+    return false;
+  }
+  return true;
+}
+
+const VideoInfo *MediaCatalog::getVideoInfo(size_t index)
+{
+  const MediaCatalogEntry &entry = mEntries[index];
+  if (entry.type != MediaType::VIDEO || !entry.valid)
+  {
+    return NULL;
+  }
+  return &mVideoInfo[entry.infoIndex];
+}
+
+std::vector<uint32_t> MediaCatalog::find(MediaType type, const char *folder)
+{
+  char prefix[MAX_PATH_LENGTH];
+  snprintf(prefix, sizeof(prefix), "/sdcard%s", folder);
+  size_t length = strlen(prefix);
+  while (length > 0 && prefix[length - 1] == '/')
+  {
+    length--;
+  }
+  std::vector<uint32_t> found;
+  for (size_t i = 0; i < mEntries.size(); i++)
+  {
+    const MediaCatalogEntry &entry = mEntries[i];
+    const char *path = getPath(i);
+    // videos whose headers can't be read aren't worth offering
+    if (entry.type == type && (type != MediaType::VIDEO || entry.valid) &&
+        strncmp(path, prefix, length) == 0 && path[length] == '/')
+    {
+      found.push_back(i);
+    }
+  }
+  return found;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "VideoPlayer/VideoFile.h"
+
+class SDCard;
+
+enum class MediaType : uint8_t
+{
+  VIDEO,
+  IMAGE
+};
+
+typedef struct __attribute__((packed))
+{
+  // into the string pool, a NUL terminated full path
+  uint32_t pathOffset;
+  // size and modification time, only known for videos
+  uint32_t size;
+  uint32_t modified;
+  MediaType type;
+  // the headers of a video could be read
+  uint8_t valid;
+  // into the video facts, videos only
+  uint16_t infoIndex;
+} MediaCatalogEntry;
+
+// Every video and image on the card, found by one recursive pass over the
+// folders and kept in a file on the card between boots. On boot the folders
+// are listed again but only new files are looked at: images are trusted by
+// name, videos are checked against their size and modification time and only
+// have their headers read when they changed. Paths live in a single pool and
+// entries are sorted by path.
+class MediaCatalog
+{
+private:
+  SDCard *mSDCard;
+  std::vector<MediaCatalogEntry> mEntries;
+  std::vector<VideoInfo> mVideoInfo;
+  std::vector<char> mPool;
+  bool mReady = false;
+
+  bool load();
+  bool save();
+  void scanFolder(char *path, size_t length, int depth,
+                  const MediaCatalog &previous, bool &changed);
+  void addFile(const char *path, MediaType type, const MediaCatalog &previous,
+               bool &changed);
+  const MediaCatalogEntry *findEntry(const char *path) const;
+
+public:
+  MediaCatalog(SDCard *sdCard) : mSDCard(sdCard) {}
+  // Load the catalog and bring it up to date with the card. Only the first
+  // call does any work.
+  bool begin();
+  size_t getCount() { return mEntries.size(); }
+  const MediaCatalogEntry &getEntry(size_t index) { return mEntries[index]; }
+  const char *getPath(size_t index)
+  {
+    return &mPool[mEntries[index].pathOffset];
+  }
+  // Header facts of a video entry, NULL if they couldn't be read.
+  const VideoInfo *getVideoInfo(size_t index);
+  // Entries of one type in the folder and below it, in path order. The
+  // folder is relative to the card, "/" for all of it.
+  std::vector<uint32_t> find(MediaType type, const char *folder);
+};
@@ -2,21 +2,70 @@
 #include "Display.h"
 #include "Prefs.h"
 #include "Battery.h"
+#include <algorithm>
+#include <esp_timer.h>
+
+// read buffer for JPEGs that are streamed from the card
+#define STREAM_BUFFER_SIZE 4096
+// tallest MCU, and so the tallest block JPEGDEC draws
+#define MAX_MCU_HEIGHT 16
+
+// Sleep until the given esp_timer time. Whole ticks are slept, the remainder
+// is spun off so the deadline is hit to the microsecond rather than the tick.
+static void sleepUntilUs(int64_t dueUs)
+{
+  const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+  int64_t remaining = dueUs - esp_timer_get_time();
+  if (remaining >= tickUs)
+  {
+    // vTaskDelay(n) never sleeps more than n ticks
+    vTaskDelay(remaining / tickUs);
+    remaining = dueUs - esp_timer_get_time();
+  }
+  if (remaining > 0)
+  {
+    delayMicroseconds(remaining);
+  }
+}
 
 int _doDraw(JPEGDRAW *pDraw)
 {
   MediaPlayer *player = (MediaPlayer *)pDraw->pUser;
-  // calculate the x offset to center the image
-  int x_offset = 0;
-  int imageWidth = player->mJpeg.getWidth();
-  int screenWidth = player->mDisplay.width();
-  x_offset = (screenWidth - imageWidth) / 2;
-  player->mDisplay.drawPixelsToSprite(pDraw->x + x_offset, pDraw->y,
-                                      pDraw->iWidth, pDraw->iHeight,
-                                      pDraw->pPixels);
+  if (player->mRenderBuffer && player->shouldAbortRender())
+  {
+    player->mRenderAborted = true;
+    return 0;
+  }
+  // cropped blocks are positioned from the corner of the crop area, the
+  // resampler works from positions in the whole decoded image
+  pDraw->x += player->mCropOriginX;
+  pDraw->y += player->mCropOriginY;
+  if (player->mResampleStep)
+  {
+    return player->drawResampled(pDraw);
+  }
+  player->drawBlock(pDraw->x + player->mDrawOffsetX,
+                    pDraw->y + player->mDrawOffsetY, pDraw->iWidth,
+                    pDraw->iHeight, pDraw->pPixels);
   return 1;
 }
 
+static int32_t readStream(JPEGFILE *file, uint8_t *buffer, int32_t length)
+{
+  return ((BufferedFile *)file->fHandle)->read(buffer, length);
+}
+
+static int32_t seekStream(JPEGFILE *file, int32_t position)
+{
+  ((BufferedFile *)file->fHandle)->seek(position);
+  return position;
+}
+
+static void closeStream(void *handle)
+{
+  // the player closes the file once decoding is done
+}
+
 void MediaPlayer::_task(void *param)
 {
   MediaPlayer *player = (MediaPlayer *)param;
@@ -24,7 +73,8 @@ void MediaPlayer::_task(void *param)
 }
 
 MediaPlayer::MediaPlayer(Display &display, Prefs &prefs, Battery &battery)
-    : mDisplay(display), mPrefs(prefs), mBattery(battery)
+    : mDisplay(display), mPrefs(prefs), mBattery(battery),
+      mStreamFile(STREAM_BUFFER_SIZE)
 {
   mMutex = xSemaphoreCreateMutex();
 }
@@ -39,10 +89,9 @@ MediaPlayer::~MediaPlayer()
       vTaskDelay(10);
     }
   }
-  if (mCurrentFrame)
-  {
-    free(mCurrentFrame);
-  }
+  FramePool::release(mCurrentFrame);
+  delete mParallelDecoder;
+  free(mResampleBuffer);
   vSemaphoreDelete(mMutex);
 }
 
@@ -103,8 +152,8 @@ void MediaPlayer::pause()
   char batText[12];
   sprintf(batText, mBattery.isCharging() ? "Chrg %d%%" : "Batt. %d%%",
           mBattery.getBatteryLevel());
-  drawOSDTimed(std::string(batText), TOP_RIGHT, OSDLevel::STANDARD);
-  drawOSDTimed(std::string("Paused"), CENTER, OSDLevel::STANDARD);
+  drawOSDTimed(batText, TOP_RIGHT, OSDLevel::STANDARD);
+  drawOSDTimed("Paused", CENTER, OSDLevel::STANDARD);
   auto oldState = mState;
   mState = MediaPlayerState::PAUSED;
   onStateChanged(oldState, mState);
@@ -122,35 +171,334 @@ void MediaPlayer::playPauseToggle()
   }
 }
 
-void MediaPlayer::drawOSDTimed(const std::string &text, OSDPosition position,
+void MediaPlayer::drawOSDTimed(const char *text, OSDPosition position,
                                OSDLevel level, uint32_t durationMs)
 {
-  if (text.empty())
+  if (text[0] == '\0')
+    return;
+  TimedOsd &osd = mTimedOsds[position];
+  // the task skips the slot while it's being filled in
+  osd.active = false;
+  strncpy(osd.text, text, sizeof(osd.text) - 1);
+  osd.text[sizeof(osd.text) - 1] = '\0';
+  osd.level = level;
+  osd.endTime = millis() + durationMs;
+  osd.active = true;
+  mDisplay.drawOSD(osd.text, position, level);
+  mOsdChanged = true;
+}
+
+// Work out which part of the image is visible and where it goes. When the
+// decoder can crop, the blocks outside the screen are never converted. The
+// image size is the shown one, after any scaling chooseScale picked.
+void MediaPlayer::setViewport(int imageWidth, int imageHeight, bool canCrop)
+{
+  int screenWidth = mDisplay.width();
+  int screenHeight = mDisplay.height();
+  Viewport viewport = Viewport::fit(imageWidth, imageHeight, screenWidth,
+                                    screenHeight, mViewportAnchor);
+  // a render buffer starts out black
+  if (!mRenderBuffer && !viewport.coversScreen(screenWidth, screenHeight))
+  {
+    mDisplay.clearAround(viewport.screenX, viewport.screenY,
+                         viewport.cropWidth, viewport.cropHeight);
+  }
+  mDrawOffsetX = viewport.screenX - viewport.cropX;
+  mDrawOffsetY = viewport.screenY - viewport.cropY;
+  mCropOriginX = 0;
+  mCropOriginY = 0;
+  if (canCrop && viewport.isCropped(imageWidth, imageHeight))
+  {
+    // the crop area is in unscaled image pixels, the shown pixels are mapped
+    // back through the resampler and JPEGDEC's scaling
+    uint32_t step = mResampleStep ? mResampleStep : 0x10000;
+    int x0 = ((uint64_t)viewport.cropX * step >> 16) << mDecodeShift;
+    int y0 = ((uint64_t)viewport.cropY * step >> 16) << mDecodeShift;
+    int x1 = (((uint64_t)(viewport.cropX + viewport.cropWidth) * step +
+               0xFFFF) >> 16) << mDecodeShift;
+    int y1 = (((uint64_t)(viewport.cropY + viewport.cropHeight) * step +
+               0xFFFF) >> 16) << mDecodeShift;
+    x1 = std::min(x1, mJpeg.getWidth());
+    y1 = std::min(y1, mJpeg.getHeight());
+    mJpeg.setCropArea(x0, y0, x1 - x0, y1 - y0);
+    // the crop area is widened to whole MCUs
+    int width, height;
+    mJpeg.getCropArea(&mCropOriginX, &mCropOriginY, &width, &height);
+    mCropOriginX >>= mDecodeShift;
+    mCropOriginY >>= mDecodeShift;
+  }
+}
+
+// Work out how far an image has to shrink for the scale mode. JPEGDEC can
+// reduce by 2, 4 or 8 while decoding, anything left over is resampled as the
+// blocks are drawn. Updates the size to the scaled one and returns true if
+// there's any scaling.
+bool MediaPlayer::chooseScale(int &width, int &height)
+{
+  mDecodeOptions = 0;
+  mDecodeShift = 0;
+  mResampleStep = 0;
+  if (mScaleMode == ScaleMode::ORIGINAL || width <= 0 || height <= 0)
+  {
+    return false;
+  }
+  // rounded up so that a filled screen has no gap at the edge
+  uint32_t scaleX = (((uint32_t)mDisplay.width() << 16) + width - 1) / width;
+  uint32_t scaleY =
+      (((uint32_t)mDisplay.height() << 16) + height - 1) / height;
+  uint32_t scale = mScaleMode == ScaleMode::FIT ? std::min(scaleX, scaleY)
+                                                : std::max(scaleX, scaleY);
+  // images are never enlarged
+  if (scale >= 0x10000)
+  {
+    return false;
+  }
+  int shift = 0;
+  while (shift < 3 && (scale << (shift + 1)) <= 0x10000)
+  {
+    shift++;
+  }
+  static const int scaleOptions[] = {0, JPEG_SCALE_HALF, JPEG_SCALE_QUARTER,
+                                     JPEG_SCALE_EIGHTH};
+  mDecodeOptions = scaleOptions[shift];
+  mDecodeShift = shift;
+  width >>= shift;
+  height >>= shift;
+  uint32_t remaining = scale << shift;
+  if (remaining < 0x10000)
+  {
+    mResampleStep = ((uint64_t)1 << 32) / remaining;
+    width = ((uint64_t)width * remaining) >> 16;
+    height = ((uint64_t)height * remaining) >> 16;
+    // Blocks are at most an MCU row of 16 decoded pixels tall and as wide
+    // as the image. Resampled, they're no bigger, give or take a pixel
+    // each way of rounding, so the buffer is sized here once per image
+    // rather than in the draw callback.
+    size_t pixels = (size_t)(width + 1) * (MAX_MCU_HEIGHT + 1);
+    if (pixels > mResampleCapacity)
+    {
+      free(mResampleBuffer);
+      mResampleBuffer = (uint16_t *)malloc(pixels * sizeof(uint16_t));
+      mResampleCapacity = mResampleBuffer ? pixels : 0;
+    }
+  }
+  return true;
+}
+
+// Nearest neighbour downscale of a block, in fixed point. Each output pixel
+// whose source lands in the block is drawn from it.
+int MediaPlayer::drawResampled(JPEGDRAW *pDraw)
+{
+  uint32_t step = mResampleStep;
+  int outX0 = (((uint32_t)pDraw->x << 16) + step - 1) / step;
+  int outX1 = (((uint32_t)(pDraw->x + pDraw->iWidth) << 16) + step - 1) / step;
+  int outY0 = (((uint32_t)pDraw->y << 16) + step - 1) / step;
+  int outY1 =
+      (((uint32_t)(pDraw->y + pDraw->iHeight) << 16) + step - 1) / step;
+  int width = outX1 - outX0;
+  int height = outY1 - outY0;
+  if (width <= 0 || height <= 0)
+  {
+    return 1;
+  }
+  if ((size_t)width * height > mResampleCapacity)
+  {
+    // chooseScale couldn't allocate the buffer
+    return 0;
+  }
+  uint16_t *out = mResampleBuffer;
+  for (int y = outY0; y < outY1; y++)
+  {
+    const uint16_t *row =
+        pDraw->pPixels + (int)(((uint32_t)y * step >> 16) - pDraw->y) *
+                             pDraw->iWidth;
+    for (int x = outX0; x < outX1; x++)
+    {
+      *out++ = row[((uint32_t)x * step >> 16) - pDraw->x];
+    }
+  }
+  drawBlock(outX0 + mDrawOffsetX, outY0 + mDrawOffsetY, width, height,
+            mResampleBuffer);
+  return 1;
+}
+
+bool MediaPlayer::decodeFrame(FrameSlot *frame)
+{
+  if (frame->format == FrameFormat::RGB565)
+  {
+    setViewport(frame->width, frame->height, false);
+    drawBlock(mDrawOffsetX, mDrawOffsetY, frame->width, frame->height,
+              (uint16_t *)frame->data);
+    return true;
+  }
+  if (frame->format == FrameFormat::TINY_FRAME)
+  {
+    return decodeTinyFrame(frame);
+  }
+  if (frame->format == FrameFormat::JPEG_FILE)
+  {
+    // memory use doesn't depend on the file size, and scaled down decoding
+    // skips most of the work for large photos
+    const char *path = (const char *)frame->data;
+    if (!mStreamFile.open(path))
+    {
+      Serial.printf("Failed to open image file %s\n", path);
+      return false;
+    }
+    bool decoded = mJpeg.open(&mStreamFile, (int)mStreamFile.size(),
+                              closeStream, readStream, seekStream, _doDraw) &&
+                   decodeOpenedJpeg();
+    mStreamFile.close();
+    return decoded;
+  }
+  int width, height;
+  if (mParallelDecode &&
+      mParallelDecoder->open(frame->data, frame->length))
+  {
+    width = mParallelDecoder->getWidth();
+    height = mParallelDecoder->getHeight();
+    // scaled images are decoded the usual way, the resampler isn't shared
+    if (!chooseScale(width, height))
+    {
+      // the slices crop rows themselves, columns are clipped by the display
+      setViewport(width, height, false);
+      return mParallelDecoder->decode();
+    }
+  }
+  return mJpeg.openRAM(frame->data, frame->length, _doDraw) &&
+         decodeOpenedJpeg();
+}
+
+// Tinytron codec frames decode into a frame held by the decoder, which is
+// then drawn like an RGB565 frame. A delta frame that can't be applied
+// leaves the held picture on screen until the next key frame.
+bool MediaPlayer::decodeTinyFrame(FrameSlot *frame)
+{
+  if (mResetTinyFrames)
+  {
+    mResetTinyFrames = false;
+    mTinyFrameDecoder.reset();
+  }
+  bool decoded = mTinyFrameDecoder.decode(frame->data, frame->length);
+  if (!mTinyFrameDecoder.hasPicture())
+  {
+    // the sprite still holds an older frame, it has to be redrawn
+    if (!mRenderBuffer)
+    {
+      mDisplay.fillSprite(DisplayColors::BLACK);
+    }
+    return false;
+  }
+  int width = mTinyFrameDecoder.getWidth();
+  int height = mTinyFrameDecoder.getHeight();
+  setViewport(width, height, false);
+  drawBlock(mDrawOffsetX, mDrawOffsetY, width, height,
+            mTinyFrameDecoder.getPixels());
+  return decoded;
+}
+
+// Photos often carry a small EXIF thumbnail. It's good enough when it's at
+// least as big as the image will be shown and has the same shape, and then
+// it's decoded in place of the whole image.
+bool MediaPlayer::useThumbnail(int &width, int &height)
+{
+  if (!mJpeg.hasThumb())
+  {
+    return false;
+  }
+  int thumbWidth = mJpeg.getThumbWidth();
+  int thumbHeight = mJpeg.getThumbHeight();
+  int shownWidth = width;
+  int shownHeight = height;
+  if (!chooseScale(shownWidth, shownHeight) || thumbWidth < shownWidth ||
+      thumbHeight < shownHeight)
+  {
+    return false;
+  }
+  // some cameras pad thumbnails to 4:3
+  if (abs(thumbWidth * height - thumbHeight * width) * 50 > width * thumbHeight)
+  {
+    return false;
+  }
+  width = thumbWidth;
+  height = thumbHeight;
+  return true;
+}
+
+bool MediaPlayer::decodeOpenedJpeg()
+{
+  int width = mJpeg.getWidth();
+  int height = mJpeg.getHeight();
+  int thumbnailOption = useThumbnail(width, height) ? JPEG_EXIF_THUMBNAIL : 0;
+  // the overflow of a filled screen is cropped before it's scaled, so it's
+  // never converted or resampled
+  chooseScale(width, height);
+  setViewport(width, height, !thumbnailOption);
+  mJpeg.setUserPointer(this);
+  mJpeg.setPixelType(RGB565_BIG_ENDIAN);
+  bool decoded = mJpeg.decode(0, 0, mDecodeOptions | thumbnailOption) != 0;
+  mJpeg.close();
+  return decoded;
+}
+
+void MediaPlayer::decodeCurrentFrame()
+{
+  decodeFrame(mCurrentFrame);
+}
+
+void MediaPlayer::drawBlock(int x, int y, int width, int height,
+                            uint16_t *pixels)
+{
+  if (!mRenderBuffer)
+  {
+    mDisplay.drawPixelsToSprite(x, y, width, height, pixels);
     return;
-  mTimedOsds.push_back({text, position, level, millis() + durationMs});
-  mDisplay.drawOSD(text.c_str(), position, level);
+  }
+  int screenWidth = mDisplay.width();
+  int x0 = std::max(x, 0);
+  int x1 = std::min(x + width, screenWidth);
+  int y0 = std::max(y, 0);
+  int y1 = std::min(y + height, mDisplay.height());
+  for (int row = y0; row < y1 && x0 < x1; row++)
+  {
+    memcpy(mRenderBuffer + row * screenWidth + x0,
+           pixels + (row - y) * width + (x0 - x),
+           (x1 - x0) * sizeof(uint16_t));
+  }
+}
+
+bool MediaPlayer::renderFrame(FrameSlot *frame, uint16_t *buffer)
+{
+  memset(buffer, 0, mDisplay.width() * mDisplay.height() * sizeof(uint16_t));
+  mRenderBuffer = buffer;
+  mRenderAborted = false;
+  bool decoded = decodeFrame(frame);
+  mRenderBuffer = NULL;
+  return decoded && !mRenderAborted;
 }
 
 void MediaPlayer::task()
 {
-  uint8_t *jpegBuffer = NULL;
-  size_t jpegBufferLength = 0;
-  size_t jpegLength = 0;
+  // the two slices would arrive interleaved, which bands can't take
+  mParallelDecode = mPrefs.getParallelDecode() && !mDisplay.drawsInBands();
+  mScaleMode = mPrefs.getScaleMode();
+  if (mParallelDecode && !mParallelDecoder)
+  {
+    mParallelDecoder = new ParallelJpegDecoder(mJpeg, _doDraw, this);
+  }
 
   while (mRunTask)
   {
-    bool needsRedraw = false;
-    for (auto it = mTimedOsds.begin(); it != mTimedOsds.end();)
+    bool needsRedraw = mOsdChanged;
+    mOsdChanged = false;
+    uint32_t now = millis();
+    for (TimedOsd &osd : mTimedOsds)
     {
-      if (millis() >= it->endTime)
+      if (osd.active && now >= osd.endTime)
       {
-        it = mTimedOsds.erase(it);
+        osd.active = false;
         needsRedraw = true;
       }
-      else
-      {
-        ++it;
-      }
     }
 
     if (mState == MediaPlayerState::STATIC)
@@ -160,38 +508,72 @@ void MediaPlayer::task()
       continue;
     }
 
-    bool gotFrame = false;
+    FrameSlot *frame = NULL;
     if (mState == MediaPlayerState::PLAYING)
     {
       onLoop();
       if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
       {
-        gotFrame = getFrame(&jpegBuffer, jpegBufferLength, jpegLength);
+        mFrameDueUs = 0;
+        frame = getFrame();
+        xSemaphoreGive(mMutex);
+      }
+      // waited for here so that controls aren't held up by the lock
+      if (frame && mFrameDueUs > 0)
+      {
+        sleepUntilUs(mFrameDueUs);
+      }
+    }
+    else if (mState == MediaPlayerState::PAUSED)
+    {
+      if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+      {
+        frame = getPausedFrame();
         xSemaphoreGive(mMutex);
       }
     }
 
     // if we don't have a new frame, and we don't need to redraw for OSD, then we can just wait
-    if (!gotFrame && !needsRedraw)
+    if (!frame && !needsRedraw)
     {
-      vTaskDelay(10 / portTICK_PERIOD_MS);
+      waitForFrame();
       continue;
     }
 
-    if (gotFrame)
+    // static scenes and title cards repeat the same compressed frame
+    bool duplicate = frame && mSkipDuplicateFrames && mCurrentFrame &&
+                     frame->length == mCurrentFrame->length &&
+                     memcmp(frame->data, mCurrentFrame->data, frame->length) == 0;
+
+    if (frame)
     {
-      if (mCurrentFrame == NULL || jpegLength > mCurrentFrameSize)
-      {
-        if (mCurrentFrame)
-        {
-          free(mCurrentFrame);
-        }
-        mCurrentFrame = (uint8_t *)malloc(jpegLength);
-      }
-      if (mCurrentFrame)
+      // hand the previous frame back to its source
+      FramePool::release(mCurrentFrame);
+      mCurrentFrame = frame;
+    }
+
+    // an OSD change over a frame that's still on screen is composited over
+    // it, there's no need to decode the frame again
+    bool osdOnly = (!frame || duplicate) && mCurrentFrame &&
+                   mDisplay.hasShownSprite();
+
+    // the OSD is set before decoding so that banded drawing, which sends
+    // the frame as it's decoded, can include it
+    if (mBattery.isCharging())
+    {
+      mDisplay.drawOSD("Charging", TOP_RIGHT, OSDLevel::DEBUG);
+    }
+    else if (mBattery.isLowBattery())
+    {
+      mDisplay.drawOSD("Low Batt.", TOP_RIGHT, OSDLevel::STANDARD);
+    }
+
+    for (int i = 0; i < OSD_POSITION_COUNT; i++)
+    {
+      if (mTimedOsds[i].active)
       {
-        mCurrentFrameSize = jpegLength;
-        memcpy(mCurrentFrame, jpegBuffer, jpegLength);
+        mDisplay.drawOSD(mTimedOsds[i].text, (OSDPosition)i,
+                         mTimedOsds[i].level);
       }
     }
 
@@ -199,12 +581,9 @@ void MediaPlayer::task()
     if (mCurrentFrame)
     {
       mWaitForFirstFrame = false;
-      if (mJpeg.openRAM(mCurrentFrame, mCurrentFrameSize, _doDraw))
+      if (!osdOnly)
       {
-        mJpeg.setUserPointer(this);
-        mJpeg.setPixelType(RGB565_BIG_ENDIAN);
-        mJpeg.decode(0, 0, 0);
-        mJpeg.close();
+        decodeCurrentFrame();
       }
     }
     else
@@ -218,29 +597,17 @@ void MediaPlayer::task()
 
     onFrameDisplayed();
 
-    if (mBattery.isCharging())
-    {
-      mDisplay.drawOSD("Charging", TOP_RIGHT, OSDLevel::DEBUG);
-    }
-    else if (mBattery.isLowBattery())
-    {
-      mDisplay.drawOSD("Low Batt.", TOP_RIGHT, OSDLevel::STANDARD);
-    }
-
-    for (const auto &osd : mTimedOsds)
+    if (osdOnly)
     {
-      mDisplay.drawOSD(osd.text.c_str(), osd.position, osd.level);
+      mDisplay.refreshOSD();
+      continue;
     }
-
-    mDisplay.flushSprite();
+    // decode the next frame while this one is sent to the panel
+    mDisplay.presentSprite();
   }
 
-  if (mCurrentFrame)
-  {
-    free(mCurrentFrame);
-    mCurrentFrame = NULL;
-    mCurrentFrameSize = 0;
-  }
+  FramePool::release(mCurrentFrame);
+  mCurrentFrame = NULL;
 
   mTaskHandle = NULL;
   vTaskDelete(NULL);
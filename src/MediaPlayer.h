@@ -2,10 +2,16 @@
 
 #include "JPEGDEC.h"
 #include <Arduino.h>
-#include <list>
 #include <string>
 
+#include "BufferedFile.h"
+#include "FramePool.h"
 #include "OSD.h"
+#include "OSDOverlay.h"
+#include "ParallelJpegDecoder.h"
+#include "Prefs.h"
+#include "TinyFrameDecoder.h"
+#include "Viewport.h"
 
 class Display;
 class Prefs;
@@ -13,10 +19,10 @@ class Battery;
 
 struct TimedOsd
 {
-  std::string text;
-  OSDPosition position;
+  bool active;
   OSDLevel level;
   uint32_t endTime;
+  char text[OSDOverlay::MAX_TEXT_LENGTH];
 };
 
 enum class MediaPlayerState
@@ -36,30 +42,95 @@ protected:
   Prefs &mPrefs;
   Battery &mBattery;
   JPEGDEC mJpeg;
+  // created the first time parallel decoding is used
+  ParallelJpegDecoder *mParallelDecoder = NULL;
+  bool mParallelDecode = false;
+  // holds the last Tinytron codec frame for the delta frames after it
+  TinyFrameDecoder mTinyFrameDecoder;
+  // set when the source jumps, delta frames then wait for a key frame
+  volatile bool mResetTinyFrames = false;
+  // how images that don't match the screen are cropped or placed
+  ViewportAnchor mViewportAnchor = ViewportAnchor::CENTER;
+  // added to the decoder's block positions to place them on screen
+  int mDrawOffsetX = 0;
+  int mDrawOffsetY = 0;
+  // Corner of the crop area, JPEGDEC reports cropped blocks relative to it.
+  // It's in decoded pixels, after JPEGDEC's own scaling.
+  int mCropOriginX = 0;
+  int mCropOriginY = 0;
+
+  ScaleMode mScaleMode = ScaleMode::ORIGINAL;
+  // JPEG_SCALE_* option for the image being decoded, and the power of two
+  // it divides the size by
+  int mDecodeOptions = 0;
+  int mDecodeShift = 0;
+  // Step through the decoded image per output pixel, in 16.16 fixed point,
+  // for the scaling JPEGDEC can't do itself. Zero when there's none.
+  uint32_t mResampleStep = 0;
+  // sized by chooseScale for the widest block the image can have
+  uint16_t *mResampleBuffer = NULL;
+  size_t mResampleCapacity = 0;
+
+  // set while renderFrame is decoding into a buffer
+  uint16_t *mRenderBuffer = NULL;
+  // set when shouldAbortRender stopped the decode part way
+  bool mRenderAborted = false;
+
+  // JPEG_FILE frames are fed to the decoder through this small buffer
+  BufferedFile mStreamFile;
 
   MediaPlayerState mState = MediaPlayerState::STOPPED;
 
   TaskHandle_t mTaskHandle = NULL;
   volatile bool mRunTask = false;
 
-  std::list<TimedOsd> mTimedOsds;
+  // one timed OSD per position, a newer one replaces the old
+  TimedOsd mTimedOsds[OSD_POSITION_COUNT] = {};
+  // set when an OSD is added so the task shows it without waiting for a frame
+  volatile bool mOsdChanged = false;
 
-  uint8_t *mCurrentFrame = NULL;
-  size_t mCurrentFrameSize = 0;
+  // the frame on screen, leased from the source until the next one arrives
+  FrameSlot *mCurrentFrame = NULL;
 
   SemaphoreHandle_t mMutex = NULL;
+  // esp_timer time the frame from getFrame is due on screen, 0 for now
+  int64_t mFrameDueUs = 0;
 
   bool mWaitForFirstFrame = false;
+  // a frame identical to the one on screen isn't decoded or sent again
+  bool mSkipDuplicateFrames = false;
 
   static void _task(void *param);
   void task();
   void startTask();
-
-  virtual bool getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength) = 0;
+  virtual void decodeCurrentFrame();
+  // Returns false if the frame couldn't be decoded, or only in part.
+  bool decodeFrame(FrameSlot *frame);
+  bool decodeOpenedJpeg();
+  bool decodeTinyFrame(FrameSlot *frame);
+  bool useThumbnail(int &width, int &height);
+  void drawBlock(int x, int y, int width, int height, uint16_t *pixels);
+  // Decode a frame into a screen sized buffer instead of onto the screen.
+  // Returns false if it failed to decode or was abandoned part way, which
+  // mRenderAborted tells apart.
+  bool renderFrame(FrameSlot *frame, uint16_t *buffer);
+  void setViewport(int imageWidth, int imageHeight, bool canCrop);
+  bool chooseScale(int &width, int &height);
+  int drawResampled(JPEGDRAW *pDraw);
+
+  // Lease the next frame from the source, or NULL if there isn't a new one.
+  // It's shown once mFrameDueUs has passed.
+  virtual FrameSlot *getFrame() = 0;
+  // Wait a little when getFrame has nothing, without the lock held.
+  virtual void waitForFrame() { vTaskDelay(10 / portTICK_PERIOD_MS); }
+  // A frame to show while paused, e.g. a single frame step, or NULL.
+  virtual FrameSlot *getPausedFrame() { return NULL; }
   virtual void onFrameDisplayed() {};
   virtual void onStateChanged(MediaPlayerState oldState, MediaPlayerState newState) {};
   virtual void onLoop() {};
   virtual void onStatic() {};
+  // checked as a JPEG is rendered, true gives up on it
+  virtual bool shouldAbortRender() { return false; }
 
   friend int _doDraw(JPEGDRAW *pDraw);
 
@@ -76,8 +147,9 @@ public:
   virtual void set(int index) {}
 
   void setWaitForFirstFrame(bool wait) { mWaitForFirstFrame = wait; }
+  void setViewportAnchor(ViewportAnchor anchor) { mViewportAnchor = anchor; }
 
-  void drawOSDTimed(const std::string &text, OSDPosition position,
+  void drawOSDTimed(const char *text, OSDPosition position,
                     OSDLevel level, uint32_t durationMs = 2000);
 
   MediaPlayerState getState() { return mState; }
@@ -13,5 +13,6 @@ enum OSDPosition
   TOP_RIGHT,
   BOTTOM_LEFT,
   BOTTOM_RIGHT,
-  CENTER
+  CENTER,
+  OSD_POSITION_COUNT
 };
\ No newline at end of file
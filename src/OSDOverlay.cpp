@@ -0,0 +1,294 @@
+#include "OSDOverlay.h"
+#include <algorithm>
+
+// bitmaps grow in steps of this many pixels of width
+#define BITMAP_GROWTH_STEP 32
+
+OSDOverlay::~OSDOverlay()
+{
+  for (Item &item : mItems)
+  {
+    free(item.bitmap);
+  }
+  free(mAtlas);
+  free(mSaveBuffer);
+}
+
+bool OSDOverlay::begin(TFT_eSPI *tft)
+{
+  TFT_eSprite strip(tft);
+  strip.setTextFont(2);
+  strip.setTextSize(1);
+  char text[2] = {0, 0};
+  int offset = 0;
+  for (int i = 0; i < GLYPH_COUNT; i++)
+  {
+    text[0] = FIRST_GLYPH + i;
+    int width = strip.textWidth(text);
+    mGlyphs[i] = {(uint16_t)offset, (uint8_t)width};
+    offset += width;
+  }
+  mGlyphHeight = strip.fontHeight();
+  if (strip.createSprite(offset, mGlyphHeight) == nullptr)
+  {
+    return false;
+  }
+  strip.fillSprite(TFT_BLACK);
+  strip.setTextColor(TFT_ORANGE, TFT_BLACK);
+  for (int i = 0; i < GLYPH_COUNT; i++)
+  {
+    strip.drawChar(FIRST_GLYPH + i, mGlyphs[i].offset, 0);
+  }
+  size_t size = offset * mGlyphHeight * sizeof(uint16_t);
+  mAtlas = (uint16_t *)malloc(size);
+  if (mAtlas)
+  {
+    memcpy(mAtlas, strip.getPointer(), size);
+    mAtlasWidth = offset;
+  }
+  strip.deleteSprite();
+  return mAtlas != NULL;
+}
+
+void OSDOverlay::set(OSDPosition position, const char *text)
+{
+  Item &item = mItems[position];
+  if (strncmp(item.text, text, MAX_TEXT_LENGTH - 1) != 0)
+  {
+    strncpy(item.text, text, MAX_TEXT_LENGTH - 1);
+    item.text[MAX_TEXT_LENGTH - 1] = '\0';
+    item.dirty = true;
+  }
+  item.pending = true;
+}
+
+// Build the text's bitmap from the glyph strip, cut off at maxWidth
+bool OSDOverlay::renderItem(Item &item, int maxWidth)
+{
+  int width = 0;
+  for (const char *c = item.text; *c; c++)
+  {
+    int glyph = *c >= FIRST_GLYPH && *c <= LAST_GLYPH ? *c - FIRST_GLYPH
+                                                       : '?' - FIRST_GLYPH;
+    width += mGlyphs[glyph].width;
+  }
+  width = std::min(width, maxWidth);
+  if (width > item.bitmapCapacity)
+  {
+    int capacity = (width + BITMAP_GROWTH_STEP - 1) / BITMAP_GROWTH_STEP *
+                   BITMAP_GROWTH_STEP;
+    uint16_t *bitmap = (uint16_t *)realloc(
+        item.bitmap, capacity * mGlyphHeight * sizeof(uint16_t));
+    if (!bitmap)
+    {
+      Serial.println("Failed to allocate OSD bitmap");
+      return false;
+    }
+    item.bitmap = bitmap;
+    item.bitmapCapacity = capacity;
+  }
+  int x = 0;
+  for (const char *c = item.text; *c && x < width; c++)
+  {
+    int glyph = *c >= FIRST_GLYPH && *c <= LAST_GLYPH ? *c - FIRST_GLYPH
+                                                       : '?' - FIRST_GLYPH;
+    const Glyph &g = mGlyphs[glyph];
+    int w = std::min((int)g.width, width - x);
+    for (int y = 0; y < mGlyphHeight; y++)
+    {
+      memcpy(item.bitmap + y * width + x, mAtlas + y * mAtlasWidth + g.offset,
+             w * sizeof(uint16_t));
+    }
+    x += w;
+  }
+  item.width = width;
+  item.dirty = false;
+  return true;
+}
+
+void OSDOverlay::getPosition(OSDPosition position, int textWidth,
+                             int textHeight, int width, int height, int &x,
+                             int &y)
+{
+  switch (position)
+  {
+  case TOP_LEFT:
+    x = 20;
+    y = 20;
+    break;
+  case TOP_RIGHT:
+    x = width - textWidth - 20;
+    y = 20;
+    break;
+  case BOTTOM_LEFT:
+    x = 20;
+    y = height - textHeight - 20;
+    break;
+  case BOTTOM_RIGHT:
+    x = width - textWidth - 20;
+    y = height - textHeight - 20;
+    break;
+  case CENTER:
+  default:
+    x = (width - textWidth) / 2;
+    y = (height - textHeight) / 2;
+    break;
+  }
+}
+
+// The item's rectangle clipped to the screen, which may leave it empty
+OSDRect OSDOverlay::getRect(const Item &item, OSDPosition position, int width,
+                            int height)
+{
+  int x, y;
+  getPosition(position, item.width, mGlyphHeight, width, height, x, y);
+  int x0 = std::max(x, 0);
+  int y0 = std::max(y, 0);
+  int x1 = std::min(x + item.width, width);
+  int y1 = std::min(y + mGlyphHeight, height);
+  return {(int16_t)x0, (int16_t)y0, (int16_t)std::max(x1 - x0, 0),
+          (int16_t)std::max(y1 - y0, 0)};
+}
+
+void OSDOverlay::compose(TFT_eSprite *sprite)
+{
+  int width = sprite->width();
+  int height = sprite->height();
+  size_t savePixels = 0;
+  mRectCount = 0;
+  for (int i = 0; i < OSD_POSITION_COUNT; i++)
+  {
+    Item &item = mItems[i];
+    if (!item.pending)
+    {
+      continue;
+    }
+    item.pending = false;
+    if (item.dirty && !renderItem(item, width))
+    {
+      continue;
+    }
+    OSDRect r = getRect(item, (OSDPosition)i, width, height);
+    if (r.w > 0 && r.h > 0)
+    {
+      mRectPositions[mRectCount] = (OSDPosition)i;
+      mRects[mRectCount++] = r;
+      savePixels += r.w * r.h;
+    }
+  }
+  if (savePixels > mSaveCapacity)
+  {
+    uint16_t *buffer =
+        (uint16_t *)realloc(mSaveBuffer, savePixels * sizeof(uint16_t));
+    if (!buffer)
+    {
+      Serial.println("Failed to allocate OSD buffer");
+      mRectCount = 0;
+      return;
+    }
+    mSaveBuffer = buffer;
+    mSaveCapacity = savePixels;
+  }
+
+  uint16_t *pixels = (uint16_t *)sprite->getPointer();
+  uint16_t *save = mSaveBuffer;
+  for (int i = 0; i < mRectCount; i++)
+  {
+    const OSDRect &r = mRects[i];
+    const Item &item = mItems[mRectPositions[i]];
+    // the bitmap may have been clipped on the left or top
+    int x, y;
+    getPosition(mRectPositions[i], item.width, mGlyphHeight, width, height, x,
+                y);
+    for (int row = r.y; row < r.y + r.h; row++)
+    {
+      uint16_t *dst = pixels + row * width + r.x;
+      memcpy(save, dst, r.w * sizeof(uint16_t));
+      save += r.w;
+      memcpy(dst, item.bitmap + (row - y) * item.width + (r.x - x),
+             r.w * sizeof(uint16_t));
+    }
+  }
+}
+
+// Undo compose, in reverse order in case the rectangles overlap
+void OSDOverlay::restore(TFT_eSprite *sprite)
+{
+  int width = sprite->width();
+  uint16_t *pixels = (uint16_t *)sprite->getPointer();
+  uint16_t *save = mSaveBuffer;
+  for (int i = 0; i < mRectCount; i++)
+  {
+    save += mRects[i].w * mRects[i].h;
+  }
+  for (int i = mRectCount - 1; i >= 0; i--)
+  {
+    const OSDRect &r = mRects[i];
+    save -= r.w * r.h;
+    uint16_t *row = save;
+    for (int y = r.y; y < r.y + r.h; y++)
+    {
+      memcpy(pixels + y * width + r.x, row, r.w * sizeof(uint16_t));
+      row += r.w;
+    }
+  }
+}
+
+void OSDOverlay::drawDirect(TFT_eSPI *tft, OSDPosition position)
+{
+  Item &item = mItems[position];
+  if ((item.dirty && !renderItem(item, tft->width())) || item.width == 0)
+  {
+    return;
+  }
+  int x, y;
+  getPosition(position, item.width, mGlyphHeight, tft->width(), tft->height(),
+              x, y);
+  // pushImage clips to the screen
+  tft->pushImage(x, y, item.width, mGlyphHeight, item.bitmap);
+}
+
+void OSDOverlay::beginBands(int width)
+{
+  for (Item &item : mItems)
+  {
+    item.inBands = item.pending && (!item.dirty || renderItem(item, width));
+    item.pending = false;
+  }
+}
+
+void OSDOverlay::composeBand(uint16_t *band, int width, int height, int bandY,
+                             int rows)
+{
+  for (int i = 0; i < OSD_POSITION_COUNT; i++)
+  {
+    const Item &item = mItems[i];
+    if (!item.inBands)
+    {
+      continue;
+    }
+    int x, y;
+    getPosition((OSDPosition)i, item.width, mGlyphHeight, width, height, x, y);
+    int x0 = std::max(x, 0);
+    int x1 = std::min(x + item.width, width);
+    int y0 = std::max(y, bandY);
+    int y1 = std::min(y + mGlyphHeight, bandY + rows);
+    for (int row = y0; row < y1 && x0 < x1; row++)
+    {
+      memcpy(band + (row - bandY) * width + x0,
+             item.bitmap + (row - y) * item.width + (x0 - x),
+             (x1 - x0) * sizeof(uint16_t));
+    }
+  }
+}
+
+void OSDOverlay::drawPending(TFT_eSPI *tft)
+{
+  for (int i = 0; i < OSD_POSITION_COUNT; i++)
+  {
+    if (mItems[i].pending)
+    {
+      drawDirect(tft, (OSDPosition)i);
+    }
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include "OSD.h"
+
+struct OSDRect
+{
+  int16_t x, y, w, h;
+};
+
+// Draws OSD text over frames without going through the TFT_eSPI text code.
+// The font is rasterized once into a strip of RGB565 glyphs, each string is
+// built from it into a bitmap that is kept until the text changes, and the
+// bitmaps are copied over the frame. Buffers only ever grow, so showing the
+// same OSD frame after frame doesn't touch the heap.
+class OSDOverlay
+{
+public:
+  static const int MAX_TEXT_LENGTH = 40;
+
+private:
+  static const char FIRST_GLYPH = ' ';
+  static const char LAST_GLYPH = '~';
+  static const int GLYPH_COUNT = LAST_GLYPH - FIRST_GLYPH + 1;
+
+  struct Glyph
+  {
+    uint16_t offset;
+    uint8_t width;
+  };
+
+  struct Item
+  {
+    // drawn over the next frame
+    bool pending;
+    // the bitmap no longer matches the text
+    bool dirty;
+    // drawn into the bands of the frame being rendered
+    bool inBands;
+    char text[MAX_TEXT_LENGTH];
+    uint16_t *bitmap;
+    int bitmapCapacity;
+    int width;
+  };
+
+  Glyph mGlyphs[GLYPH_COUNT];
+  // every glyph side by side, in the sprite's pixel format
+  uint16_t *mAtlas = NULL;
+  int mAtlasWidth = 0;
+  int mGlyphHeight = 0;
+
+  Item mItems[OSD_POSITION_COUNT] = {};
+
+  // where the last composited OSD was drawn, and the pixels it covers
+  OSDRect mRects[OSD_POSITION_COUNT];
+  OSDPosition mRectPositions[OSD_POSITION_COUNT];
+  int mRectCount = 0;
+  uint16_t *mSaveBuffer = NULL;
+  size_t mSaveCapacity = 0;
+
+  bool renderItem(Item &item, int maxWidth);
+  OSDRect getRect(const Item &item, OSDPosition position, int width,
+                  int height);
+
+public:
+  ~OSDOverlay();
+  // Rasterize font 2 in the OSD colours. Returns false if there isn't enough
+  // memory, the caller then has to draw text itself.
+  bool begin(TFT_eSPI *tft);
+  bool isReady() { return mAtlas != NULL; }
+  // Show the text over the next frame, replacing any at the same position.
+  void set(OSDPosition position, const char *text);
+  // Draw the pending text over the sprite, saving the pixels underneath.
+  void compose(TFT_eSprite *sprite);
+  // Put back the pixels saved by compose.
+  void restore(TFT_eSprite *sprite);
+  // Draw the text at one position straight to the screen, for when there's
+  // no sprite.
+  void drawDirect(TFT_eSPI *tft, OSDPosition position);
+  // Banded rendering: the text pending when a frame starts is drawn into each
+  // band as it's sent. Text set while the frame is rendered is drawn straight
+  // to the screen once it's finished, and into the bands of the next frame.
+  void beginBands(int width);
+  void composeBand(uint16_t *band, int width, int height, int bandY,
+                   int rows);
+  void drawPending(TFT_eSPI *tft);
+  int getRectCount() { return mRectCount; }
+  const OSDRect &getRect(int index) { return mRects[index]; }
+  static void getPosition(OSDPosition position, int textWidth, int textHeight,
+                          int width, int height, int &x, int &y);
+};
@@ -0,0 +1,301 @@
+#include "ParallelJpegDecoder.h"
+#include <algorithm>
+
+static const uint8_t END_MARKER[2] = {0xFF, 0xD9};
+
+static bool isRestartMarker(uint8_t marker)
+{
+  return marker >= 0xD0 && marker <= 0xD7;
+}
+
+ParallelJpegDecoder::ParallelJpegDecoder(JPEGDEC &topJpeg,
+                                         JPEG_DRAW_CALLBACK *draw, void *user)
+    : mTopJpeg(topJpeg), mDraw(draw), mUser(user)
+{
+  mSlices[0].decoder = this;
+  mSlices[0].jpeg = &mTopJpeg;
+  mSlices[1].decoder = this;
+  mSlices[1].jpeg = &mBottomJpeg;
+  mBottomDone = xSemaphoreCreateBinary();
+  // the caller decodes the top slice on core 0
+  xTaskCreatePinnedToCore(_task, "JpegSlice", 8192, this, 1, &mTaskHandle, 1);
+}
+
+ParallelJpegDecoder::~ParallelJpegDecoder()
+{
+  vTaskDelete(mTaskHandle);
+  vSemaphoreDelete(mBottomDone);
+}
+
+void ParallelJpegDecoder::_task(void *param)
+{
+  ParallelJpegDecoder *decoder = (ParallelJpegDecoder *)param;
+  decoder->task();
+}
+
+void ParallelJpegDecoder::task()
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    decodeSlice(mSlices[1]);
+    xSemaphoreGive(mBottomDone);
+  }
+}
+
+// Copy the segments needed for decoding (tables, frame header, restart
+// interval and scan header) into the slice headers, skipping APPn and COM
+// segments. Only single scan, Huffman coded baseline images are accepted.
+bool ParallelJpegDecoder::buildSliceHeaders(size_t &entropyStart,
+                                            int &mcuWidth, int &mcuHeight,
+                                            int &restartInterval)
+{
+  if (mLength < 4 || mData[0] != 0xFF || mData[1] != 0xD8)
+  {
+    return false;
+  }
+  size_t headerLength = 2;
+  size_t heightOffset = 0;
+  int componentCount = 0;
+  int maxH = 1;
+  int maxV = 1;
+  restartInterval = 0;
+  memcpy(mSlices[0].header, mData, 2);
+  size_t pos = 2;
+  while (pos + 4 <= mLength)
+  {
+    if (mData[pos] != 0xFF)
+    {
+      return false;
+    }
+    uint8_t marker = mData[pos + 1];
+    if (marker == 0xFF)
+    {
+      // fill byte
+      pos++;
+      continue;
+    }
+    size_t segmentLength = (mData[pos + 2] << 8) | mData[pos + 3];
+    const uint8_t *segment = mData + pos + 4;
+    if (segmentLength < 2 || pos + 2 + segmentLength > mLength)
+    {
+      return false;
+    }
+    bool keep = !(marker >= 0xE0 && marker <= 0xEF) && marker != 0xFE;
+    if (marker == 0xC0 || marker == 0xC1)
+    {
+      if (segmentLength < 8)
+      {
+        return false;
+      }
+      heightOffset = headerLength + 5;
+      mHeight = (segment[1] << 8) | segment[2];
+      mWidth = (segment[3] << 8) | segment[4];
+      componentCount = segment[5];
+      if (segmentLength < 8 + 3 * (size_t)componentCount)
+      {
+        return false;
+      }
+      for (int i = 0; i < componentCount; i++)
+      {
+        uint8_t sampling = segment[7 + i * 3];
+        maxH = std::max(maxH, sampling >> 4);
+        maxV = std::max(maxV, sampling & 0x0F);
+      }
+    }
+    else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 &&
+             marker != 0xC8 && marker != 0xCC)
+    {
+      // progressive, lossless or arithmetic coded
+      return false;
+    }
+    else if (marker == 0xDD && segmentLength >= 4)
+    {
+      restartInterval = (segment[0] << 8) | segment[1];
+    }
+    if (keep)
+    {
+      if (headerLength + 2 + segmentLength > MAX_HEADER_SIZE)
+      {
+        return false;
+      }
+      memcpy(mSlices[0].header + headerLength, mData + pos, 2 + segmentLength);
+      headerLength += 2 + segmentLength;
+    }
+    pos += 2 + segmentLength;
+    if (marker == 0xDA)
+    {
+      // the scan must hold every component for the image to be sliceable
+      if (heightOffset == 0 || segment[0] != componentCount)
+      {
+        return false;
+      }
+      entropyStart = pos;
+      // a single component scan is not interleaved, its MCU is one block
+      mcuWidth = componentCount == 1 ? 8 : maxH * 8;
+      mcuHeight = componentCount == 1 ? 8 : maxV * 8;
+      mSlices[0].headerLength = headerLength;
+      memcpy(mSlices[1].header, mSlices[0].header, headerLength);
+      mSlices[1].headerLength = headerLength;
+      mHeightOffset = heightOffset;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ParallelJpegDecoder::open(uint8_t *data, size_t length)
+{
+  mData = data;
+  mLength = length;
+  mWidth = 0;
+  mHeight = 0;
+  size_t entropyStart = 0;
+  int mcuWidth = 0;
+  int mcuHeight = 0;
+  int restartInterval = 0;
+  if (!buildSliceHeaders(entropyStart, mcuWidth, mcuHeight, restartInterval))
+  {
+    return false;
+  }
+  int mcuRows = (mHeight + mcuHeight - 1) / mcuHeight;
+  int mcusPerRow = (mWidth + mcuWidth - 1) / mcuWidth;
+  if (mcuRows < 2)
+  {
+    return false;
+  }
+  // the top slice is never the smaller one
+  int splitRow = (mcuRows + 1) / 2;
+  Slice &top = mSlices[0];
+  Slice &bottom = mSlices[1];
+  top.y = 0;
+  top.height = splitRow * mcuHeight;
+  bottom.y = top.height;
+  bottom.height = mHeight - top.height;
+  for (Slice &slice : mSlices)
+  {
+    slice.header[mHeightOffset] = slice.height >> 8;
+    slice.header[mHeightOffset + 1] = slice.height & 0xFF;
+  }
+
+  // without a restart marker on the boundary the bottom decoder would have
+  // to entropy decode the top half as well, which gains nothing
+  if (restartInterval == 0 || (splitRow * mcusPerRow) % restartInterval != 0)
+  {
+    return false;
+  }
+  // find the restart marker that starts the bottom slice
+  size_t markersBefore = splitRow * mcusPerRow / restartInterval;
+  size_t markerCount = 0;
+  const uint8_t *p = mData + entropyStart;
+  const uint8_t *end = mData + mLength - 1;
+  while (p < end && (p = (const uint8_t *)memchr(p, 0xFF, end - p)) != NULL)
+  {
+    if (isRestartMarker(p[1]) && ++markerCount == markersBefore)
+    {
+      top.body = mData + entropyStart;
+      top.bodyLength = p - top.body;
+      top.restartShift = 0;
+      top.appendEndMarker = true;
+      bottom.body = p + 2;
+      bottom.bodyLength = mData + mLength - bottom.body;
+      bottom.restartShift = markersBefore % 8;
+      bottom.appendEndMarker = false;
+      return true;
+    }
+    // skip the byte after 0xFF, it's stuffing or a marker code
+    p += 2;
+  }
+  return false;
+}
+
+bool ParallelJpegDecoder::decode()
+{
+  xTaskNotifyGive(mTaskHandle);
+  decodeSlice(mSlices[0]);
+  xSemaphoreTake(mBottomDone, portMAX_DELAY);
+  return mSlices[0].decoded && mSlices[1].decoded;
+}
+
+void ParallelJpegDecoder::decodeSlice(Slice &slice)
+{
+  JPEGDEC *jpeg = slice.jpeg;
+  slice.decoded = false;
+  int size = slice.headerLength + slice.bodyLength +
+             (slice.appendEndMarker ? sizeof(END_MARKER) : 0);
+  if (!jpeg->open(&slice, size, closeSlice, readSlice, seekSlice, drawSlice))
+  {
+    return;
+  }
+  jpeg->setUserPointer(&slice);
+  jpeg->setPixelType(RGB565_BIG_ENDIAN);
+  slice.decoded = jpeg->decode(0, 0, 0) != 0;
+  jpeg->close();
+}
+
+int32_t ParallelJpegDecoder::readSlice(JPEGFILE *file, uint8_t *buffer,
+                                       int32_t length)
+{
+  Slice *slice = (Slice *)file->fHandle;
+  int32_t pos = file->iPos;
+  int32_t copied = 0;
+  while (copied < length && pos < file->iSize)
+  {
+    int32_t count;
+    if (pos < (int32_t)slice->headerLength)
+    {
+      count = std::min(length - copied, (int32_t)slice->headerLength - pos);
+      memcpy(buffer + copied, slice->header + pos, count);
+    }
+    else if (pos < (int32_t)(slice->headerLength + slice->bodyLength))
+    {
+      int32_t offset = pos - slice->headerLength;
+      count = std::min(length - copied, (int32_t)slice->bodyLength - offset);
+      uint8_t *out = buffer + copied;
+      memcpy(out, slice->body + offset, count);
+      if (slice->restartShift)
+      {
+        // the decoder expects the first restart marker it sees to be RST0
+        uint8_t previous = offset > 0 ? slice->body[offset - 1] : 0;
+        for (int32_t i = 0; i < count; i++)
+        {
+          if (previous == 0xFF && isRestartMarker(out[i]))
+          {
+            out[i] = 0xD0 | ((out[i] - slice->restartShift) & 7);
+          }
+          previous = out[i];
+        }
+      }
+    }
+    else
+    {
+      int32_t offset = pos - slice->headerLength - slice->bodyLength;
+      count = std::min(length - copied, (int32_t)sizeof(END_MARKER) - offset);
+      memcpy(buffer + copied, END_MARKER + offset, count);
+    }
+    copied += count;
+    pos += count;
+  }
+  file->iPos = pos;
+  return copied;
+}
+
+int32_t ParallelJpegDecoder::seekSlice(JPEGFILE *file, int32_t position)
+{
+  file->iPos = constrain(position, 0, file->iSize);
+  return file->iPos;
+}
+
+void ParallelJpegDecoder::closeSlice(void *handle)
+{
+  // nothing to release, the slice streams from memory
+}
+
+int ParallelJpegDecoder::drawSlice(JPEGDRAW *draw)
+{
+  Slice *slice = (Slice *)draw->pUser;
+  // slices start at row 0 of their own image
+  draw->y += slice->y;
+  draw->pUser = slice->decoder->mUser;
+  return slice->decoder->mDraw(draw);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "JPEGDEC.h"
+#include <Arduino.h>
+
+// Decodes a baseline JPEG as two horizontal slices, the top one on the
+// calling task and the bottom one on a worker pinned to the other core. Both
+// slices are handed to the same draw callback and cover disjoint rows.
+//
+// Each decoder is fed only its own half of the entropy coded data, so the
+// image needs a restart marker on the slice boundary to be split.
+class ParallelJpegDecoder
+{
+private:
+  static const size_t MAX_HEADER_SIZE = 1024;
+
+  struct Slice
+  {
+    ParallelJpegDecoder *decoder;
+    JPEGDEC *jpeg;
+    int y;
+    int height;
+    // the slice is decoded from a stream made of a copy of the header, with
+    // the frame height patched, followed by part of the original entropy
+    // coded data
+    uint8_t header[MAX_HEADER_SIZE];
+    size_t headerLength;
+    const uint8_t *body;
+    size_t bodyLength;
+    // restart markers in the body are renumbered down by this much
+    int restartShift;
+    // an EOI marker is appended when the body is cut short
+    bool appendEndMarker;
+    // set once the slice has been decoded without an error
+    bool decoded;
+  };
+
+  JPEGDEC &mTopJpeg;
+  JPEGDEC mBottomJpeg;
+  JPEG_DRAW_CALLBACK *mDraw;
+  void *mUser;
+  Slice mSlices[2];
+
+  uint8_t *mData = NULL;
+  size_t mLength = 0;
+  int mWidth = 0;
+  int mHeight = 0;
+  // position of the frame height in the slice headers
+  size_t mHeightOffset = 0;
+
+  TaskHandle_t mTaskHandle = NULL;
+  SemaphoreHandle_t mBottomDone = NULL;
+
+  static void _task(void *param);
+  void task();
+  void decodeSlice(Slice &slice);
+  bool buildSliceHeaders(size_t &entropyStart, int &mcuWidth, int &mcuHeight,
+                         int &restartInterval);
+
+  static int32_t readSlice(JPEGFILE *file, uint8_t *buffer, int32_t length);
+  static int32_t seekSlice(JPEGFILE *file, int32_t position);
+  static void closeSlice(void *handle);
+  static int drawSlice(JPEGDRAW *draw);
+
+public:
+  // The top slice is decoded with the given decoder, which the caller may
+  // keep using for images that can't be split.
+  ParallelJpegDecoder(JPEGDEC &topJpeg, JPEG_DRAW_CALLBACK *draw, void *user);
+  ~ParallelJpegDecoder();
+  // Work out how to split the image. Returns false if it can't be split, in
+  // which case it should be decoded the usual way.
+  bool open(uint8_t *data, size_t length);
+  int getWidth() { return mWidth; }
+  int getHeight() { return mHeight; }
+  // Decode both slices, returns once the whole image has been drawn. Returns
+  // false if either slice failed to decode.
+  bool decode();
+};
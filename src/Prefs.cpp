@@ -7,6 +7,24 @@ const char *Prefs::PREF_BRIGHTNESS = "brightness";
 const char *Prefs::PREF_OSD_LEVEL = "osd_level";
 const char *Prefs::PREF_TIMER_MINUTES = "timer_minutes";
 const char *Prefs::PREF_SLIDESHOW_INTERVAL_SECONDS = "slideshow_sec";
+const char *Prefs::PREF_FRAME_DROP_POLICY = "drop_policy";
+const char *Prefs::PREF_MAX_DRIFT_MS = "max_drift_ms";
+const char *Prefs::PREF_PARALLEL_DECODE = "par_decode";
+const char *Prefs::PREF_SCALE_MODE = "scale_mode";
+const char *Prefs::PREF_LOOP_CACHE_MB = "loop_cache_mb";
+const char *Prefs::PREF_WEB_REMOTE = "web_remote";
+const char *Prefs::PREF_RESUME_PATH = "resume_path";
+const char *Prefs::PREF_RESUME_POSITION = "resume_pos";
+
+// the numeric part of a resume point, stored as one blob so that it's a
+// single NVS write
+struct __attribute__((packed)) ResumePosition
+{
+  uint64_t fileSize;
+  uint64_t offset;
+  uint32_t frame;
+  uint32_t size;
+};
 
 Prefs::Prefs() {}
 
@@ -112,6 +130,95 @@ void Prefs::onSlideshowIntervalChanged(std::function<void(int)> callback)
   slideshow_interval_changed_callback = callback;
 }
 
+FrameDropPolicy Prefs::getFrameDropPolicy()
+{
+  return (FrameDropPolicy)readIntPreference(PREF_FRAME_DROP_POLICY, 0); // Default to catch up
+}
+
+void Prefs::setFrameDropPolicy(int policy)
+{
+  writeIntPreference(PREF_FRAME_DROP_POLICY, constrain(policy, 0, 2));
+}
+
+int Prefs::getMaxDriftMs()
+{
+  return readIntPreference(PREF_MAX_DRIFT_MS, 200); // Default to 200ms
+}
+
+void Prefs::setMaxDriftMs(int ms)
+{
+  writeIntPreference(PREF_MAX_DRIFT_MS, constrain(ms, 0, 5000));
+}
+
+bool Prefs::getParallelDecode()
+{
+  return readIntPreference(PREF_PARALLEL_DECODE, 0) != 0; // Default to one core
+}
+
+void Prefs::setParallelDecode(bool enabled)
+{
+  writeIntPreference(PREF_PARALLEL_DECODE, enabled ? 1 : 0);
+}
+
+ScaleMode Prefs::getScaleMode()
+{
+  return (ScaleMode)readIntPreference(PREF_SCALE_MODE, 2); // Default to fill
+}
+
+void Prefs::setScaleMode(int mode)
+{
+  writeIntPreference(PREF_SCALE_MODE, constrain(mode, 0, 2));
+}
+
+bool Prefs::getWebRemote()
+{
+  return readIntPreference(PREF_WEB_REMOTE, 0) != 0; // Default to off to save battery
+}
+
+void Prefs::setWebRemote(bool enabled)
+{
+  writeIntPreference(PREF_WEB_REMOTE, enabled ? 1 : 0);
+}
+
+int Prefs::getLoopCacheMB()
+{
+  return readIntPreference(PREF_LOOP_CACHE_MB, 4); // Default to 4MB
+}
+
+void Prefs::setLoopCacheMB(int megabytes)
+{
+  writeIntPreference(PREF_LOOP_CACHE_MB, constrain(megabytes, 0, 6));
+}
+
+bool Prefs::getResumePoint(ResumePoint &point)
+{
+  ResumePosition position;
+  if (preferences.getBytesLength(PREF_RESUME_POSITION) != sizeof(position) ||
+      preferences.getBytes(PREF_RESUME_POSITION, &position,
+                           sizeof(position)) != sizeof(position))
+  {
+    return false;
+  }
+  point.path = readStringPreference(PREF_RESUME_PATH);
+  point.fileSize = position.fileSize;
+  point.offset = position.offset;
+  point.frame = position.frame;
+  point.size = position.size;
+  return !point.path.isEmpty();
+}
+
+void Prefs::setResumePoint(const ResumePoint &point)
+{
+  // the path only changes with the file, don't wear the flash rewriting it
+  if (readStringPreference(PREF_RESUME_PATH) != point.path)
+  {
+    writeStringPreference(PREF_RESUME_PATH, point.path);
+  }
+  ResumePosition position = {point.fileSize, point.offset, point.frame,
+                             point.size};
+  preferences.putBytes(PREF_RESUME_POSITION, &position, sizeof(position));
+}
+
 String Prefs::readStringPreference(const char *key, const String &defaultValue)
 {
   return preferences.getString(key, defaultValue);
@@ -5,6 +5,41 @@
 #include "OSD.h"
 #include <functional>
 
+// What video playback does when decoding can't keep up with the frame rate
+enum class FrameDropPolicy
+{
+  // drop frames to stay in sync with the timeline
+  CATCH_UP = 0,
+  // show every frame, the timeline is shifted instead
+  NEVER = 1,
+  // only drop frames once playback is more than getMaxDriftMs() late
+  LIMIT_DRIFT = 2,
+};
+
+// How images that don't match the screen size are shown
+enum class ScaleMode
+{
+  // at their own size, cropped to the screen
+  ORIGINAL = 0,
+  // shrunk to fit inside the screen, with bars around them
+  FIT = 1,
+  // shrunk until they just cover the screen, the rest is cropped
+  FILL = 2,
+};
+
+// Where video playback got to, so that it can carry on after a power cycle
+struct ResumePoint
+{
+  String path;
+  // size of the file, to tell if it has been replaced since
+  uint64_t fileSize;
+  uint32_t frame;
+  // where the frame's chunk is in the file, so that it can be shown before
+  // the file's index has been read
+  uint64_t offset;
+  uint32_t size;
+};
+
 class Prefs
 {
 public:
@@ -29,6 +64,31 @@ public:
   int getSlideshowInterval();
   void setSlideshowInterval(int seconds);
 
+  FrameDropPolicy getFrameDropPolicy();
+  void setFrameDropPolicy(int policy);
+
+  int getMaxDriftMs();
+  void setMaxDriftMs(int ms);
+
+  bool getParallelDecode();
+  void setParallelDecode(bool enabled);
+
+  ScaleMode getScaleMode();
+  void setScaleMode(int mode);
+
+  // join the saved WiFi network and serve the web interface while playing
+  // from the SD card
+  bool getWebRemote();
+  void setWebRemote(bool enabled);
+
+  // PSRAM set aside for the decoded frames of a short looping clip, 0 for
+  // none
+  int getLoopCacheMB();
+  void setLoopCacheMB(int megabytes);
+
+  bool getResumePoint(ResumePoint &point);
+  void setResumePoint(const ResumePoint &point);
+
   void onBrightnessChanged(std::function<void(int)> callback);
   void onTimerMinutesChanged(std::function<void(int)> callback);
   void onSlideshowIntervalChanged(std::function<void(int)> callback);
@@ -46,6 +106,14 @@ private:
   static const char *PREF_OSD_LEVEL;
   static const char *PREF_TIMER_MINUTES;
   static const char *PREF_SLIDESHOW_INTERVAL_SECONDS;
+  static const char *PREF_FRAME_DROP_POLICY;
+  static const char *PREF_MAX_DRIFT_MS;
+  static const char *PREF_PARALLEL_DECODE;
+  static const char *PREF_SCALE_MODE;
+  static const char *PREF_LOOP_CACHE_MB;
+  static const char *PREF_WEB_REMOTE;
+  static const char *PREF_RESUME_PATH;
+  static const char *PREF_RESUME_POSITION;
 
   String readStringPreference(const char *key, const String &defaultValue = "");
   void writeStringPreference(const char *key, const String &value);
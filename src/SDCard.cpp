@@ -27,8 +27,8 @@ SDCard::SDCard(gpio_num_t clk, gpio_num_t cmd, gpio_num_t d0, gpio_num_t d1, gpi
   // formatted in case when mounting fails.
   esp_vfs_fat_sdmmc_mount_config_t mount_config = {
       .format_if_mount_failed = false,
-      .max_files = 5,
-      .allocation_unit_size = 16 * 1024};
+      .max_files = 8,
+      .allocation_unit_size = ALLOCATION_UNIT_SIZE};
 
   Serial.println("Initializing SD card");
 
@@ -80,8 +80,8 @@ SDCard::SDCard(gpio_num_t miso, gpio_num_t mosi, gpio_num_t clk, gpio_num_t cs)
   // formatted in case when mounting fails.
   esp_vfs_fat_sdmmc_mount_config_t mount_config = {
       .format_if_mount_failed = false,
-      .max_files = 5,
-      .allocation_unit_size = 16 * 1024};
+      .max_files = 8,
+      .allocation_unit_size = ALLOCATION_UNIT_SIZE};
 
   Serial.println("Initializing SD card");
 
@@ -145,35 +145,3 @@ bool SDCard::isMounted()
   }
   return false;
 }
-
-std::vector<std::string> SDCard::listFiles(const char *folder, const char *extension)
-{
-  std::vector<std::string> files;
-  char full_path[100];
-  sprintf(full_path, "/sdcard%s", folder);
-  Serial.printf("Listing directory: %s\n", full_path);
-
-  // open the directory
-  DIR *dir = opendir(full_path);
-  if (!dir)
-  {
-    Serial.println("Failed to open directory");
-    return files;
-  }
-  // list all the files in the directory that end with the extension
-  struct dirent *ent;
-  while ((ent = readdir(dir)) != NULL)
-  {
-    std::string filename = ent->d_name;
-    bool isFile = ent->d_type == DT_REG;
-    bool isVisible = filename[0] != '.';
-    bool isMatchingExtension = extension == NULL || filename.find(extension) == filename.length() - strlen(extension);
-    if (isFile && isVisible && isMatchingExtension)
-    {
-      files.push_back("/sdcard/" + filename);
-    }
-  }
-  // sort the files alphabetically
-  std::sort(files.begin(), files.end());
-  return files;
-}
\ No newline at end of file
@@ -19,9 +19,12 @@ private:
   bool sd_card_init_success = false;
 
 public:
+  // FAT allocation unit used when mounting, readers size their buffers to it
+  static const size_t ALLOCATION_UNIT_SIZE = 16 * 1024;
+  static const size_t SECTOR_SIZE = 512;
+
   SDCard(gpio_num_t miso, gpio_num_t mosi, gpio_num_t clk, gpio_num_t cs);
   SDCard(gpio_num_t clk, gpio_num_t cmd, gpio_num_t d0, gpio_num_t d1, gpio_num_t d2, gpio_num_t d3);
   ~SDCard();
   bool isMounted();
-  std::vector<std::string> listFiles(const char *folder, const char *extension = NULL);
 };
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "TinyFrameDecoder.h"
+
+// the display takes big endian pixels
+static inline uint16_t toDisplay(uint16_t color)
+{
+  return (color >> 8) | (color << 8);
+}
+
+TinyFrameDecoder::~TinyFrameDecoder()
+{
+  free(mPixels);
+}
+
+bool TinyFrameDecoder::decode(const uint8_t *data, size_t length)
+{
+  if (!isTinyFrame(data, length))
+  {
+    return false;
+  }
+  TinyFrameHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (header.width == 0 || header.height == 0)
+  {
+    return false;
+  }
+  bool delta = header.flags & TINY_FRAME_FLAG_DELTA;
+  if (delta)
+  {
+    if (!mHasPicture || header.width != mWidth || header.height != mHeight)
+    {
+      return false;
+    }
+    // the same frame again, redrawn for the OSD, is what's held already
+    if (header.sequence == mSequence)
+    {
+      return true;
+    }
+    if (header.sequence != (uint16_t)(mSequence + 1))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    size_t pixels = (size_t)header.width * header.height;
+    if (pixels > mCapacity)
+    {
+      free(mPixels);
+      mPixels = (uint16_t *)reallocFrameMemory(NULL,
+                                               pixels * sizeof(uint16_t));
+      mCapacity = mPixels ? pixels : 0;
+      if (!mPixels)
+      {
+        Serial.printf("Failed to allocate a %ux%u frame\n", header.width,
+                      header.height);
+        mHasPicture = false;
+        return false;
+      }
+    }
+    mWidth = header.width;
+    mHeight = header.height;
+  }
+  // a frame that's cut short leaves a mix of two pictures behind, so delta
+  // frames wait for the next key frame
+  mHasPicture = decodePixels(data + sizeof(header), data + length, delta);
+  mSequence = header.sequence;
+  return mHasPicture;
+}
+
+bool TinyFrameDecoder::decodePixels(const uint8_t *ops, const uint8_t *end,
+                                    bool delta)
+{
+  uint16_t index[64] = {};
+  uint16_t color = 0;
+  uint16_t *out = mPixels;
+  uint16_t *outEnd = mPixels + mWidth * mHeight;
+  while (out < outEnd)
+  {
+    if (ops >= end)
+    {
+      return false;
+    }
+    uint8_t op = *ops++;
+    if (op < TINY_FRAME_OP_RUN)
+    {
+      color = index[op];
+      *out++ = toDisplay(color);
+    }
+    else if (op < TINY_FRAME_OP_DIFF)
+    {
+      size_t count = op - TINY_FRAME_OP_RUN + 1;
+      if (op == TINY_FRAME_OP_RUN_LONG)
+      {
+        if (end - ops < 2)
+        {
+          return false;
+        }
+        count = (ops[0] | (ops[1] << 8)) + 1;
+        ops += 2;
+      }
+      if (count > (size_t)(outEnd - out))
+      {
+        return false;
+      }
+      uint16_t pixel = toDisplay(color);
+      while (count--)
+      {
+        *out++ = pixel;
+      }
+    }
+    else if (op < TINY_FRAME_OP_SKIP)
+    {
+      int red = ((color >> 11) + ((op >> 4) & 3) - 2) & 0x1F;
+      int green = (((color >> 5) & 0x3F) + ((op >> 2) & 3) - 2) & 0x3F;
+      int blue = ((color & 0x1F) + (op & 3) - 2) & 0x1F;
+      color = (red << 11) | (green << 5) | blue;
+      index[tinyFrameHash(color)] = color;
+      *out++ = toDisplay(color);
+    }
+    else if (op <= TINY_FRAME_OP_SKIP_LONG)
+    {
+      if (!delta)
+      {
+        return false;
+      }
+      size_t count = op - TINY_FRAME_OP_SKIP + 1;
+      if (op == TINY_FRAME_OP_SKIP_LONG)
+      {
+        if (end - ops < 2)
+        {
+          return false;
+        }
+        count = (ops[0] | (ops[1] << 8)) + 1;
+        ops += 2;
+      }
+      if (count > (size_t)(outEnd - out))
+      {
+        return false;
+      }
+      out += count;
+      color = toDisplay(out[-1]);
+    }
+    else if (op == TINY_FRAME_OP_RGB)
+    {
+      if (end - ops < 2)
+      {
+        return false;
+      }
+      color = (ops[0] << 8) | ops[1];
+      ops += 2;
+      index[tinyFrameHash(color)] = color;
+      *out++ = toDisplay(color);
+    }
+    else
+    {
+      // reserved
+      return false;
+    }
+  }
+  return true;
+}
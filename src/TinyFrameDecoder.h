@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "FramePool.h"
+#include "TinyFrameFormat.h"
+
+// Decodes Tinytron codec frames, see TinyFrameFormat.h, into a frame sized
+// buffer that is kept as the reference for the delta frames that follow.
+class TinyFrameDecoder
+{
+private:
+  // big endian pixels of the last decoded frame, in PSRAM when available
+  uint16_t *mPixels = NULL;
+  size_t mCapacity = 0;
+  int mWidth = 0;
+  int mHeight = 0;
+  // false until a key frame has been decoded
+  bool mHasPicture = false;
+  uint16_t mSequence = 0;
+
+  bool decodePixels(const uint8_t *ops, const uint8_t *end, bool delta);
+
+public:
+  ~TinyFrameDecoder();
+  // The format sources should tag a frame they've read with.
+  static FrameFormat detectFormat(const uint8_t *data, size_t length)
+  {
+    return isTinyFrame(data, length) ? FrameFormat::TINY_FRAME
+                                     : FrameFormat::JPEG;
+  }
+  // True for a frame that only holds the changes to the one before it.
+  static bool isDelta(const uint8_t *data, size_t length)
+  {
+    return isTinyFrame(data, length) &&
+           (((const TinyFrameHeader *)data)->flags & TINY_FRAME_FLAG_DELTA);
+  }
+  // Decode a frame over the previous one. Returns false if it was corrupt,
+  // or is a delta frame that doesn't follow the frame that's held, in which
+  // case the previous picture is left as it was where possible.
+  bool decode(const uint8_t *data, size_t length);
+  // Forget the held frame, so delta frames wait for a key frame.
+  void reset() { mHasPicture = false; }
+  bool hasPicture() { return mHasPicture; }
+  uint16_t *getPixels() { return mPixels; }
+  int getWidth() { return mWidth; }
+  int getHeight() { return mHeight; }
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Tinytron frame codec, a QOI style lossless RGB565 format for flat colour
+// content that decodes with a simple byte loop instead of a DCT. Frames can
+// be stored in AVI or .tvf files or streamed in place of JPEGs, the magic at
+// the start tells them apart. It is shared with the encoders in tools/ and
+// the web page, so it must not depend on anything but the C library.
+//
+// A frame is a TinyFrameHeader followed by ops that produce the pixels in
+// row order. The decoder tracks the previous pixel, which starts out black,
+// and a table of 64 recently seen colours indexed by tinyFrameHash.
+//
+//   00iiiiii          INDEX  the colour in slot i of the table
+//   01nnnnnn          RUN    the previous pixel n + 1 more times, n < 63
+//   01111111 lo hi    RUN    the previous pixel (hi:lo) + 1 times
+//   10rrggbb          DIFF   the previous pixel with each of red, green and
+//                            blue changed by -2..1, stored biased by 2 and
+//                            wrapping around
+//   110nnnnn          SKIP   keep n + 1 pixels of the previous frame, n < 31,
+//                            only in delta frames
+//   11011111 lo hi    SKIP   keep (hi:lo) + 1 pixels of the previous frame
+//   11111111 hi lo    RGB    a literal RGB565 colour
+//
+// DIFF and RGB store their colour in the table, after a SKIP the previous
+// pixel is the last one kept. Other op values are reserved. The header is
+// little endian, RGB literals are big endian like the display's pixels.
+//
+// A delta frame only holds the pixels that changed since the frame before
+// it. It can only be shown when the decoder holds the frame whose sequence
+// number is one less, otherwise it's skipped until the next key frame.
+
+#define TINY_FRAME_MAGIC_0 'T'
+#define TINY_FRAME_MAGIC_1 'F'
+#define TINY_FRAME_VERSION 1
+
+// the frame only holds the changes to the previous one
+#define TINY_FRAME_FLAG_DELTA 0x01
+
+#define TINY_FRAME_OP_INDEX 0x00
+#define TINY_FRAME_OP_RUN 0x40
+#define TINY_FRAME_OP_RUN_LONG 0x7F
+#define TINY_FRAME_OP_DIFF 0x80
+#define TINY_FRAME_OP_SKIP 0xC0
+#define TINY_FRAME_OP_SKIP_LONG 0xDF
+#define TINY_FRAME_OP_RGB 0xFF
+
+// longest run or skip a single byte op holds, and a long one
+#define TINY_FRAME_MAX_SHORT_RUN 63
+#define TINY_FRAME_MAX_SHORT_SKIP 31
+#define TINY_FRAME_MAX_LONG_COUNT 65536
+
+typedef struct __attribute__((packed))
+{
+  char magic[2];
+  uint8_t version;
+  uint8_t flags;
+  uint16_t width;
+  uint16_t height;
+  // counts up by one per frame, wrapping around
+  uint16_t sequence;
+  uint16_t reserved;
+} TinyFrameHeader;
+
+static inline bool isTinyFrame(const uint8_t *data, size_t length)
+{
+  return length >= sizeof(TinyFrameHeader) && data[0] == TINY_FRAME_MAGIC_0 &&
+         data[1] == TINY_FRAME_MAGIC_1 && data[2] == TINY_FRAME_VERSION;
+}
+
+static inline uint8_t tinyFrameHash(uint16_t color)
+{
+  return ((color >> 11) * 3 + ((color >> 5) & 0x3F) * 5 + (color & 0x1F) * 7) &
+         0x3F;
+}
@@ -1,23 +1,26 @@
 #include "AVIParser.h"
+#include "../FramePool.h"
+#include "../TinyFrameDecoder.h"
 #include <Arduino.h>
-#include <stdio.h>
+#include <algorithm>
 #include <stdlib.h>
 #include <string.h>
 
+// OpenDML index types
+#define AVI_INDEX_OF_INDEXES 0x00
+#define AVI_INDEX_OF_CHUNKS 0x01
+// number of index entries read from the card at a time
+#define INDEX_READ_BATCH 64
+
 typedef struct
 {
   char chunkId[4];
   unsigned int chunkSize;
 } ChunkHeader;
 
-void readChunk(FILE *file, ChunkHeader *header)
+bool readChunk(BufferedFile &file, ChunkHeader *header)
 {
-  fread(&header->chunkId, 4, 1, file);
-  fread(&header->chunkSize, 4, 1, file);
-  // Serial.printf("ChunkId %c%c%c%c, size %u\n",
-  //        header->chunkId[0], header->chunkId[1],
-  //        header->chunkId[2], header->chunkId[3],
-  //        header->chunkSize);
+  return file.read(header, sizeof(ChunkHeader)) == sizeof(ChunkHeader);
 }
 
 AVIParser::AVIParser(std::string fname, AVIChunkType requiredChunkType)
@@ -25,9 +28,9 @@ AVIParser::AVIParser(std::string fname, AVIChunkType requiredChunkType)
 
 AVIParser::~AVIParser()
 {
-  if (mFile)
+  if (mFrameIndex)
   {
-    fclose(mFile);
+    free(mFrameIndex);
   }
 }
 
@@ -68,61 +71,112 @@ typedef struct
 
 bool AVIParser::open()
 {
-  mFile = fopen(mFileName.c_str(), "rb");
-  if (!mFile)
+  if (!mFile.open(mFileName.c_str()))
   {
     Serial.printf("Failed to open file.\n");
     return false;
   }
+  if (!parseHeaders())
+  {
+    mFile.close();
+    return false;
+  }
+
+  // Build the frame table, preferring the OpenDML index, then idx1 and
+  // finally a scan of the movi lists for files without any index.
+  bool indexed = mSuperIndexPosition != 0 && loadSuperIndex();
+  if (!indexed)
+  {
+    // idx1 only covers the first RIFF segment, frames in any AVIX segments
+    // after it have to be found by scanning
+    size_t firstUnindexed = mIdx1Position != 0 && loadIdx1() ? 1 : 0;
+    for (size_t i = firstUnindexed; i < mMoviLists.size(); i++)
+    {
+      scanMoviList(mMoviLists[i]);
+    }
+    indexed = mFrameCount > 0;
+  }
+  if (!indexed)
+  {
+    Serial.printf("Failed to index the movi list.\n");
+    mFile.close();
+    return false;
+  }
+  Serial.printf("Indexed %u frames\n", mFrameCount);
+  mCurrentFrame = 0;
+  return true;
+}
+
+bool AVIParser::readInfo(VideoInfo *info)
+{
+  if (!mFile.open(mFileName.c_str()))
+  {
+    return false;
+  }
+  bool valid = parseHeaders();
+  mFile.close();
+  if (!valid)
+  {
+    return false;
+  }
+  info->width = mWidth;
+  info->height = mHeight;
+  info->rate = mRate;
+  info->scale = mScale;
+  info->frameCount = mStreamLength;
+  return true;
+}
+
+// Walk the top level chunks, reading the stream headers and noting where the
+// movi list and indexes are. Only chunk headers are read, everything else is
+// skipped over.
+bool AVIParser::parseHeaders()
+{
   // check the file is valid
   ChunkHeader header;
   // Read RIFF header
-  readChunk(mFile, &header);
-  if (strncmp(header.chunkId, "RIFF", 4) != 0)
+  if (!readChunk(mFile, &header) || strncmp(header.chunkId, "RIFF", 4) != 0)
   {
     Serial.println("Not a valid AVI file.");
-    fclose(mFile);
-    mFile = NULL;
     return false;
   }
   // next four bytes are the RIFF type which should be 'AVI '
   char riffType[4];
-  fread(&riffType, 4, 1, mFile);
-  if (strncmp(riffType, "AVI ", 4) != 0)
+  if (mFile.read(&riffType, 4) != 4 || strncmp(riffType, "AVI ", 4) != 0)
   {
     Serial.println("Not a valid AVI file.");
-    fclose(mFile);
-    mFile = NULL;
     return false;
   }
+  mMoviLists.clear();
 
   // now read each chunk and find the movi list
-  while (!feof(mFile) && !ferror(mFile))
+  while (!mFile.eof())
   {
-    readChunk(mFile, &header);
-    if (feof(mFile) || ferror(mFile))
+    if (!readChunk(mFile, &header))
     {
       break;
     }
     // is it a LIST chunk?
     if (strncmp(header.chunkId, "LIST", 4) == 0)
     {
-      long listContentPosition = ftell(mFile);
       char listType[4];
-      fread(&listType, 4, 1, mFile);
+      if (mFile.read(&listType, 4) != 4)
+      {
+        break;
+      }
 
       if (strncmp(listType, "hdrl", 4) == 0)
       {
-        // We are inside the 'hdrl' LIST chunk. Its content starts at
-        // ftell(mFile) and ends at listContentPosition + header.chunkSize.
+        // We are inside the 'hdrl' LIST chunk. Its content starts at the
+        // current position and ends header.chunkSize - 4 bytes later.
         long hdrlContentRemaining =
             header.chunkSize - 4; // -4 for 'hdrl' type already read
 
-        while (hdrlContentRemaining > 0 && !feof(mFile) && !ferror(mFile))
+        while (hdrlContentRemaining > 0 && !mFile.eof())
         {
           ChunkHeader subHeader;
           long bytesReadForSubHeader =
-              fread(&subHeader, 1, sizeof(ChunkHeader), mFile);
+              mFile.read(&subHeader, sizeof(ChunkHeader));
           if (bytesReadForSubHeader != sizeof(ChunkHeader))
           {
             // Error or EOF
@@ -140,14 +194,22 @@ bool AVIParser::open()
           // Process the sub-chunk
           if (strncmp(subHeader.chunkId, "avih", 4) == 0)
           {
-            // We don't need to read avih content.
-            fseek(mFile, subChunkDataSize, SEEK_CUR);
+            MainAVIHeader avih;
+            uint64_t avihEnd = mFile.tell() + subChunkTotalSize;
+            if (subChunkDataSize >= (long)sizeof(MainAVIHeader) &&
+                mFile.read(&avih, sizeof(MainAVIHeader)) ==
+                    sizeof(MainAVIHeader))
+            {
+              mWidth = avih.dwWidth;
+              mHeight = avih.dwHeight;
+            }
+            mFile.seek(avihEnd);
             hdrlContentRemaining -= subChunkTotalSize;
           }
           else if (strncmp(subHeader.chunkId, "LIST", 4) == 0)
           {
             char subListType[4];
-            long bytesReadForSubListType = fread(&subListType, 1, 4, mFile);
+            long bytesReadForSubListType = mFile.read(&subListType, 4);
             if (bytesReadForSubListType != 4)
             {
               // Error or EOF
@@ -156,15 +218,32 @@ bool AVIParser::open()
             subChunkDataSize -=
                 bytesReadForSubListType; // Account for 'strl' type read
 
-            if (strncmp(subListType, "strl", 4) == 0)
+            if (strncmp(subListType, "odml", 4) == 0)
+            {
+              // the OpenDML header has the frame count of the whole file,
+              // the stream header may only count the first segment
+              ChunkHeader dmlhHeader;
+              uint32_t totalFrames;
+              uint64_t odmlEnd = mFile.tell() + subChunkDataSize;
+              if (subChunkDataSize >= (long)sizeof(ChunkHeader) + 4 &&
+                  readChunk(mFile, &dmlhHeader) &&
+                  strncmp(dmlhHeader.chunkId, "dmlh", 4) == 0 &&
+                  mFile.read(&totalFrames, 4) == 4)
+              {
+                mTotalFrames = totalFrames;
+              }
+              mFile.seek(odmlEnd);
+              hdrlContentRemaining -= subChunkTotalSize;
+            }
+            else if (strncmp(subListType, "strl", 4) == 0)
             {
               long strlContentRemaining = subChunkDataSize;
-              while (strlContentRemaining > 0 && !feof(mFile) &&
-                     !ferror(mFile))
+              bool isRequiredStream = false;
+              while (strlContentRemaining > 0 && !mFile.eof())
               {
                 ChunkHeader strhHeader;
                 long bytesReadForStrhHeader =
-                    fread(&strhHeader, 1, sizeof(ChunkHeader), mFile);
+                    mFile.read(&strhHeader, sizeof(ChunkHeader));
                 if (bytesReadForStrhHeader != sizeof(ChunkHeader))
                 {
                   // Error or EOF
@@ -183,7 +262,7 @@ bool AVIParser::open()
                 {
                   AVIStreamHeader strh;
                   long bytesReadForStrh =
-                      fread(&strh, 1, sizeof(AVIStreamHeader), mFile);
+                      mFile.read(&strh, sizeof(AVIStreamHeader));
                   if (bytesReadForStrh != sizeof(AVIStreamHeader))
                   {
                     // Error or EOF
@@ -192,8 +271,14 @@ bool AVIParser::open()
                   strhDataSize -=
                       bytesReadForStrh; // Account for strh struct read
 
+                  isRequiredStream =
+                      (mRequiredChunkType == AVIChunkType::VIDEO &&
+                       strncmp(strh.fccType, "vids", 4) == 0) ||
+                      (mRequiredChunkType == AVIChunkType::AUDIO &&
+                       strncmp(strh.fccType, "auds", 4) == 0);
                   if (strncmp(strh.fccType, "vids", 4) == 0)
                   {
+                    mStreamLength = strh.dwLength;
                     if (strh.dwScale == 0)
                     {
                       Serial.println(
@@ -203,17 +288,28 @@ bool AVIParser::open()
                     else
                     {
                       mFrameRate = (float)strh.dwRate / strh.dwScale;
+                      mRate = strh.dwRate;
+                      mScale = strh.dwScale;
                       Serial.printf("Frame rate: %f\n", mFrameRate);
                     }
                   }
-                  fseek(mFile, strhDataSize,
-                        SEEK_CUR); // Skip remaining strh data
+                  mFile.skip(strhDataSize); // Skip remaining strh data
+                  strlContentRemaining -= strhTotalSize;
+                }
+                else if (strncmp(strhHeader.chunkId, "indx", 4) == 0 &&
+                         isRequiredStream)
+                {
+                  // OpenDML super index for our stream, loaded once we know
+                  // where everything is
+                  mSuperIndexPosition = mFile.tell();
+                  mSuperIndexLength = strhDataSize;
+                  mFile.skip(strhTotalSize);
                   strlContentRemaining -= strhTotalSize;
                 }
                 else
                 {
                   // Not 'strh', skip its content
-                  fseek(mFile, strhDataSize, SEEK_CUR);
+                  mFile.skip(strhDataSize);
                   strlContentRemaining -= strhTotalSize;
                 }
               }
@@ -223,14 +319,14 @@ bool AVIParser::open()
             else
             {
               // Not 'strl', skip the rest of this LIST chunk's content
-              fseek(mFile, subChunkDataSize, SEEK_CUR);
+              mFile.skip(subChunkDataSize);
               hdrlContentRemaining -= subChunkTotalSize;
             }
           }
           else
           {
             // Not 'avih' or 'LIST', skip its content
-            fseek(mFile, subChunkDataSize, SEEK_CUR);
+            mFile.skip(subChunkDataSize);
             hdrlContentRemaining -= subChunkTotalSize;
           }
         }
@@ -238,32 +334,58 @@ bool AVIParser::open()
       else if (strncmp(listType, "movi", 4) == 0)
       {
         // This is the movie list. We've found what we're looking for.
-        Serial.printf("Found movi list.\n");
-        mMoviListPosition =
-            ftell(mFile); // The current position is the start of the movi data
-        mMoviListLength = header.chunkSize - 4;
-        Serial.printf("List Chunk Length: %ld\n", mMoviListLength);
-        // We can stop parsing the file now.
-        break;
+        // The current position is the start of the movi data.
+        MoviList list = {mFile.tell(), (uint64_t)header.chunkSize - 4};
+        Serial.printf("Found movi list of %llu bytes at %llu\n", list.length,
+                      list.position);
+        if (mMoviLists.empty())
+        {
+          mMoviListPosition = list.position;
+        }
+        mMoviLists.push_back(list);
+        // Skip over the frames, the idx1 index follows the movi list.
+        mFile.skip(list.length);
+        if (header.chunkSize % 2 != 0)
+        {
+          mFile.skip(1);
+        }
       }
       else
       {
         // This is some other kind of LIST chunk that we don't care about. Skip
         // it.
-        fseek(mFile, header.chunkSize - 4, SEEK_CUR);
+        mFile.skip(header.chunkSize - 4);
         if (header.chunkSize % 2 != 0)
         {
-          fseek(mFile, 1, SEEK_CUR);
+          mFile.skip(1);
         }
       }
     }
+    else if (strncmp(header.chunkId, "RIFF", 4) == 0)
+    {
+      // an OpenDML continuation segment, step into it to find its movi list
+      char segmentType[4];
+      if (mFile.read(&segmentType, 4) != 4)
+      {
+        break;
+      }
+      if (strncmp(segmentType, "AVIX", 4) != 0)
+      {
+        mFile.skip(header.chunkSize - 4 + header.chunkSize % 2);
+      }
+    }
     else
     {
+      if (strncmp(header.chunkId, "idx1", 4) == 0)
+      {
+        mIdx1Position = mFile.tell();
+        mIdx1Length = header.chunkSize;
+      }
       // This is not a LIST chunk. Skip it.
-      fseek(mFile, header.chunkSize, SEEK_CUR);
+      mFile.skip(header.chunkSize);
       if (header.chunkSize % 2 != 0)
       {
-        fseek(mFile, 1, SEEK_CUR);
+        mFile.skip(1);
       }
     }
   }
@@ -271,191 +393,308 @@ bool AVIParser::open()
   if (mMoviListPosition == 0)
   {
     Serial.printf("Failed to find the movi list.\n");
-    fclose(mFile);
-    mFile = NULL;
     return false;
   }
+  if (mTotalFrames > mStreamLength)
+  {
+    mStreamLength = mTotalFrames;
+  }
+  return true;
+}
+
+bool AVIParser::isRequiredChunk(const char *chunkId)
+{
+  bool isAudioChunk = (chunkId[2] == 'w' && chunkId[3] == 'b');
+  bool isVideoChunk =
+      (chunkId[2] == 'd' && (chunkId[3] == 'c' || chunkId[3] == 'b'));
+  return mRequiredChunkType == AVIChunkType::VIDEO && isVideoChunk ||
+         mRequiredChunkType == AVIChunkType::AUDIO && isAudioChunk;
+}
 
-  // Before we return, we must position the file pointer at the start of the
-  // movi data.
-  fseek(mFile, mMoviListPosition, SEEK_SET);
+bool AVIParser::addIndexEntry(uint64_t offset, uint32_t size)
+{
+  // empty chunks carry no picture, skip them like playback always has
+  if (size == 0)
+  {
+    return true;
+  }
+  if (mFrameCount == mFrameIndexCapacity)
+  {
+    size_t newCapacity =
+        mFrameIndexCapacity == 0 ? 1024 : mFrameIndexCapacity * 2;
+    AVIFrameIndexEntry *newIndex = (AVIFrameIndexEntry *)reallocFrameMemory(
+        mFrameIndex, newCapacity * sizeof(AVIFrameIndexEntry));
+    if (!newIndex)
+    {
+      Serial.printf("Failed to grow frame index to %u entries\n", newCapacity);
+      return false;
+    }
+    mFrameIndex = newIndex;
+    mFrameIndexCapacity = newCapacity;
+  }
+  AVIFrameIndexEntry &entry = mFrameIndex[mFrameCount++];
+  entry.offset = offset;
+  entry.size = size;
   return true;
 }
 
-size_t AVIParser::getNextChunk(uint8_t **buffer, size_t &bufferLength)
+// http://www.the-labs.com/Video/odmlff2-avidef.pdf
+typedef struct __attribute__((packed))
 {
-  // check if the file is open
-  if (!mFile)
+  uint16_t wLongsPerEntry;
+  uint8_t bIndexSubType;
+  uint8_t bIndexType;
+  uint32_t nEntriesInUse;
+  char dwChunkId[4];
+  uint32_t dwReserved[3];
+} AVISuperIndexHeader;
+
+typedef struct __attribute__((packed))
+{
+  uint64_t qwOffset;
+  uint32_t dwSize;
+  uint32_t dwDuration;
+} AVISuperIndexEntry;
+
+typedef struct __attribute__((packed))
+{
+  uint16_t wLongsPerEntry;
+  uint8_t bIndexSubType;
+  uint8_t bIndexType;
+  uint32_t nEntriesInUse;
+  char dwChunkId[4];
+  uint64_t qwBaseOffset;
+  uint32_t dwReserved;
+} AVIStandardIndexHeader;
+
+typedef struct
+{
+  uint32_t dwOffset;
+  uint32_t dwSize;
+} AVIStandardIndexEntry;
+
+typedef struct
+{
+  char ckid[4];
+  uint32_t dwFlags;
+  uint32_t dwChunkOffset;
+  uint32_t dwChunkLength;
+} AVIIdx1Entry;
+
+bool AVIParser::loadSuperIndex()
+{
+  AVISuperIndexHeader header;
+  mFile.seek(mSuperIndexPosition);
+  if (mFile.read(&header, sizeof(header)) != sizeof(header) ||
+      header.bIndexType != AVI_INDEX_OF_INDEXES ||
+      header.wLongsPerEntry != 4)
   {
-    Serial.println("No file open.");
-    return 0;
+    Serial.println("Unsupported OpenDML super index");
+    return false;
   }
-  // did we find the movi list?
-  if (mMoviListPosition == 0)
+  if (mSuperIndexLength < sizeof(header))
   {
-    Serial.println("No movi list found.");
-    return 0;
+    return false;
   }
-  // get the next chunk of data from the list
-  ChunkHeader header;
-  while (mMoviListLength > 0)
+  size_t maxEntries =
+      (mSuperIndexLength - sizeof(header)) / sizeof(AVISuperIndexEntry);
+  size_t entryCount = std::min((size_t)header.nEntriesInUse, maxEntries);
+  // the standard indexes live elsewhere in the file so read the whole super
+  // index before following it
+  AVISuperIndexEntry *entries =
+      (AVISuperIndexEntry *)malloc(entryCount * sizeof(AVISuperIndexEntry));
+  if (!entries)
+  {
+    return false;
+  }
+  bool success =
+      mFile.read(entries, entryCount * sizeof(AVISuperIndexEntry)) ==
+      entryCount * sizeof(AVISuperIndexEntry);
+  for (size_t i = 0; success && i < entryCount; i++)
+  {
+    success = loadStandardIndex(entries[i].qwOffset);
+  }
+  free(entries);
+  if (!success || mFrameCount == 0)
   {
-    readChunk(mFile, &header);
-    mMoviListLength -= 8;
+    Serial.println("Failed to load OpenDML index");
+    mFrameCount = 0;
+    return false;
+  }
+  Serial.printf("Loaded OpenDML index from %u segments\n", entryCount);
+  return true;
+}
 
-    static uint32_t dbgChunkPrints = 0;
-    if (dbgChunkPrints < 12)
+bool AVIParser::loadStandardIndex(uint64_t position)
+{
+  ChunkHeader chunk;
+  AVIStandardIndexHeader header;
+  mFile.seek(position);
+  if (!readChunk(mFile, &chunk) || chunk.chunkId[0] != 'i' ||
+      chunk.chunkId[1] != 'x' ||
+      mFile.read(&header, sizeof(header)) != sizeof(header) ||
+      header.bIndexType != AVI_INDEX_OF_CHUNKS || header.wLongsPerEntry != 2)
+  {
+    return false;
+  }
+  AVIStandardIndexEntry entries[INDEX_READ_BATCH];
+  size_t remaining = header.nEntriesInUse;
+  while (remaining > 0)
+  {
+    size_t batch = std::min(remaining, (size_t)INDEX_READ_BATCH);
+    size_t batchBytes = batch * sizeof(AVIStandardIndexEntry);
+    if (mFile.read(entries, batchBytes) != batchBytes)
     {
-      Serial.printf("movi chunk %c%c%c%c size=%u\n", header.chunkId[0],
-                    header.chunkId[1], header.chunkId[2], header.chunkId[3],
-                    header.chunkSize);
-      dbgChunkPrints++;
+      return false;
     }
-
-    if (strncmp(header.chunkId, "LIST", 4) == 0)
+    for (size_t i = 0; i < batch; i++)
     {
-      char listType[4];
-      if (fread(&listType, 4, 1, mFile) != 1)
+      // bit 31 of the size marks delta frames, it isn't part of the size
+      if (!addIndexEntry(header.qwBaseOffset + entries[i].dwOffset,
+                         entries[i].dwSize & 0x7FFFFFFF))
       {
-        return 0;
+        return false;
       }
-      mMoviListLength -= 4;
-      long listRemaining = (long)header.chunkSize - 4;
+    }
+    remaining -= batch;
+  }
+  return true;
+}
 
-      if (strncmp(listType, "rec ", 4) == 0)
+bool AVIParser::loadIdx1()
+{
+  size_t entryCount = mIdx1Length / sizeof(AVIIdx1Entry);
+  if (entryCount == 0)
+  {
+    return false;
+  }
+  AVIIdx1Entry entries[INDEX_READ_BATCH];
+  // offsets are either relative to the 'movi' fourcc or absolute, the first
+  // entry tells us which
+  uint64_t base = 0;
+  bool first = true;
+  mFile.seek(mIdx1Position);
+  while (entryCount > 0)
+  {
+    size_t batch = std::min(entryCount, (size_t)INDEX_READ_BATCH);
+    size_t batchBytes = batch * sizeof(AVIIdx1Entry);
+    if (mFile.read(entries, batchBytes) != batchBytes)
+    {
+      // a cut short index would cut the clip short too, scan instead
+      Serial.println("idx1 is truncated");
+      mFrameCount = 0;
+      return false;
+    }
+    for (size_t i = 0; i < batch; i++)
+    {
+      if (first)
       {
-        while (listRemaining > 0 && mMoviListLength > 0)
+        first = false;
+        if (entries[i].dwChunkOffset < mMoviListPosition - 4)
         {
-          ChunkHeader subHeader;
-          readChunk(mFile, &subHeader);
-          listRemaining -= 8;
-          mMoviListLength -= 8;
-
-          bool isVideoChunk = strncmp(subHeader.chunkId, "00dc", 4) == 0;
-          bool isAudioChunk =
-              (subHeader.chunkId[2] == 'w' && subHeader.chunkId[3] == 'b');
-          isVideoChunk =
-              (subHeader.chunkId[2] == 'd' &&
-               (subHeader.chunkId[3] == 'c' || subHeader.chunkId[3] == 'b'));
-          if (mRequiredChunkType == AVIChunkType::VIDEO && isVideoChunk ||
-              mRequiredChunkType == AVIChunkType::AUDIO && isAudioChunk)
-          {
-            if (subHeader.chunkSize == 0)
-            {
-              continue;
-            }
-            if (subHeader.chunkSize > bufferLength)
-            {
-              uint8_t *newBuf =
-                  (uint8_t *)realloc(*buffer, subHeader.chunkSize);
-              if (!newBuf)
-              {
-                Serial.printf("realloc failed for chunk size=%u\n",
-                              subHeader.chunkSize);
-                return 0;
-              }
-              *buffer = newBuf;
-              bufferLength = subHeader.chunkSize;
-            }
-            if (fread(*buffer, subHeader.chunkSize, 1, mFile) != 1)
-            {
-              Serial.printf("fread failed for chunk size=%u\n",
-                            subHeader.chunkSize);
-              Serial.printf("fread failed for chunk size=%u\n",
-                            subHeader.chunkSize);
-              return 0;
-            }
-            listRemaining -= subHeader.chunkSize;
-            mMoviListLength -= subHeader.chunkSize;
-            if (subHeader.chunkSize % 2 != 0)
-            {
-              fseek(mFile, 1, SEEK_CUR);
-              listRemaining--;
-              mMoviListLength--;
-            }
-            return subHeader.chunkSize;
-          }
-          else
-          {
-            fseek(mFile, subHeader.chunkSize, SEEK_CUR);
-            listRemaining -= subHeader.chunkSize;
-            mMoviListLength -= subHeader.chunkSize;
-          }
-          if (subHeader.chunkSize % 2 != 0)
-          {
-            fseek(mFile, 1, SEEK_CUR);
-            listRemaining--;
-            mMoviListLength--;
-          }
+          base = mMoviListPosition - 4;
         }
       }
-      else
-      {
-        fseek(mFile, listRemaining, SEEK_CUR);
-        mMoviListLength -= listRemaining;
-      }
-
-      if (header.chunkSize % 2 != 0)
+      if (isRequiredChunk(entries[i].ckid) &&
+          !addIndexEntry(base + entries[i].dwChunkOffset + 8,
+                         entries[i].dwChunkLength))
       {
-        fseek(mFile, 1, SEEK_CUR);
-        mMoviListLength--;
+        mFrameCount = 0;
+        return false;
       }
-      continue;
     }
+    entryCount -= batch;
+  }
+  if (mFrameCount == 0)
+  {
+    Serial.println("idx1 has no usable entries");
+    return false;
+  }
+  Serial.println("Loaded idx1 index");
+  return true;
+}
 
-    bool isAudioChunk = (header.chunkId[2] == 'w' && header.chunkId[3] == 'b');
-    bool isVideoChunk =
-        (header.chunkId[2] == 'd' &&
-         (header.chunkId[3] == 'c' || header.chunkId[3] == 'b'));
-    if (mRequiredChunkType == AVIChunkType::VIDEO && isVideoChunk ||
-        mRequiredChunkType == AVIChunkType::AUDIO && isAudioChunk)
+bool AVIParser::scanMoviList(const MoviList &list)
+{
+  Serial.printf("No index for the movi list at %llu, scanning it\n",
+                list.position);
+  uint64_t position = list.position;
+  uint64_t moviEnd = list.position + list.length;
+  ChunkHeader header;
+  while (position + 8 <= moviEnd)
+  {
+    mFile.seek(position);
+    if (!readChunk(mFile, &header))
     {
-      // we've got the required chunk - copy it into the provided buffer
-      // reallocate the buffer if necessary
-      if (header.chunkSize == 0)
-      {
-        continue;
-      }
-      if (header.chunkSize > bufferLength)
-      {
-        uint8_t *newBuf = (uint8_t *)realloc(*buffer, header.chunkSize);
-        if (!newBuf)
-        {
-          Serial.printf("realloc failed for chunk size=%u\n", header.chunkSize);
-          return 0;
-        }
-        *buffer = newBuf;
-        bufferLength = header.chunkSize;
-      }
-      // copy the chunk data
-      if (fread(*buffer, header.chunkSize, 1, mFile) != 1)
+      break;
+    }
+    if (strncmp(header.chunkId, "LIST", 4) == 0)
+    {
+      char listType[4];
+      if (mFile.read(&listType, 4) != 4)
       {
-        Serial.printf("fread failed for chunk size=%u\n", header.chunkSize);
-        return 0;
+        break;
       }
-      mMoviListLength -= header.chunkSize;
-      // handle any padding bytes
-      if (header.chunkSize % 2 != 0)
+      if (strncmp(listType, "rec ", 4) == 0)
       {
-        fseek(mFile, 1, SEEK_CUR);
-        mMoviListLength--;
+        // step into the list, its chunks are laid out contiguously
+        position += 12;
+        continue;
       }
-      return header.chunkSize;
-    }
-    else
-    {
-      // the data is not what was required - skip over the chunk
-      fseek(mFile, header.chunkSize, SEEK_CUR);
-      mMoviListLength -= header.chunkSize;
     }
-    // handle any padding bytes
-    if (header.chunkSize % 2 != 0)
+    else if (isRequiredChunk(header.chunkId))
     {
-      fseek(mFile, 1, SEEK_CUR);
-      mMoviListLength--;
+      if (!addIndexEntry(position + 8, header.chunkSize))
+      {
+        return false;
+      }
     }
+    position += 8 + header.chunkSize + (header.chunkSize % 2);
   }
-  // no more chunks
-  Serial.println("No more data");
-  return 0;
-}
\ No newline at end of file
+  return mFrameCount > 0;
+}
+
+size_t AVIParser::getNextChunk(FrameSlot *slot)
+{
+  // check if the file is open
+  if (!mFile.isOpen())
+  {
+    Serial.println("No file open.");
+    return 0;
+  }
+  if (mCurrentFrame >= mFrameCount)
+  {
+    // no more chunks
+    Serial.println("No more data");
+    return 0;
+  }
+  size_t frameLength = readFrame(mCurrentFrame, slot);
+  if (frameLength > 0)
+  {
+    mCurrentFrame++;
+  }
+  return frameLength;
+}
+
+size_t AVIParser::readFrame(size_t frameIndex, FrameSlot *slot)
+{
+  if (!mFile.isOpen() || frameIndex >= mFrameCount)
+  {
+    return 0;
+  }
+  size_t frameSize = getFrameSize(frameIndex);
+  if (!FramePool::reserve(slot, frameSize))
+  {
+    return 0;
+  }
+  mFile.seek(mFrameIndex[frameIndex].offset);
+  if (mFile.read(slot->data, frameSize) != frameSize)
+  {
+    Serial.printf("read failed for chunk size=%u\n", frameSize);
+    return 0;
+  }
+  slot->length = frameSize;
+  slot->frameIndex = frameIndex;
+  slot->format = TinyFrameDecoder::detectFormat(slot->data, frameSize);
+  return frameSize;
+}
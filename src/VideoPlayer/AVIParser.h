@@ -1,7 +1,11 @@
 #pragma once
 
-#include <stdio.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
+
+#include "../BufferedFile.h"
+#include "VideoFile.h"
 
 enum class AVIChunkType
 {
@@ -9,20 +13,69 @@ enum class AVIChunkType
   AUDIO
 };
 
-class AVIParser
+// One entry per chunk of the required type, in presentation order. The offset
+// points at the chunk payload (just past its 8 byte header) and is 64 bit so
+// that OpenDML indexes can be stored as is.
+typedef struct __attribute__((packed))
+{
+  uint64_t offset;
+  uint32_t size;
+} AVIFrameIndexEntry;
+
+class AVIParser : public VideoFile
 {
 private:
   std::string mFileName;
   AVIChunkType mRequiredChunkType;
-  FILE *mFile = NULL;
-  long mMoviListPosition = 0;
-  long mMoviListLength;
+  BufferedFile mFile;
+  // the movi list of each RIFF segment. OpenDML files over 1GB carry on in
+  // 'RIFF AVIX' segments after the first 'RIFF AVI '.
+  struct MoviList
+  {
+    uint64_t position;
+    uint64_t length;
+  };
+  std::vector<MoviList> mMoviLists;
+  uint64_t mMoviListPosition = 0;
+  uint64_t mIdx1Position = 0;
+  uint64_t mIdx1Length = 0;
+  uint64_t mSuperIndexPosition = 0;
+  uint64_t mSuperIndexLength = 0;
   float mFrameRate = 0;
+  uint32_t mWidth = 0;
+  uint32_t mHeight = 0;
+  // frames in the video stream according to its header
+  uint32_t mStreamLength = 0;
+  // frames in the whole file according to the OpenDML header, if it has one
+  uint32_t mTotalFrames = 0;
+
+  // frame table, allocated in PSRAM when available
+  AVIFrameIndexEntry *mFrameIndex = NULL;
+  size_t mFrameIndexCapacity = 0;
+
+  bool parseHeaders();
+  bool isRequiredChunk(const char *chunkId);
+  bool addIndexEntry(uint64_t offset, uint32_t size);
+  bool loadSuperIndex();
+  bool loadStandardIndex(uint64_t position);
+  bool loadIdx1();
+  bool scanMoviList(const MoviList &list);
 
 public:
   AVIParser(std::string fname, AVIChunkType requiredChunkType);
   ~AVIParser();
-  bool open();
-  size_t getNextChunk(uint8_t **buffer, size_t &bufferLength);
+  // see VideoFile for documentation
+  bool open() override;
+  bool readInfo(VideoInfo *info) override;
+  size_t getNextChunk(FrameSlot *slot);
+  size_t readFrame(size_t frameIndex, FrameSlot *slot) override;
+  uint64_t getFrameOffset(size_t frameIndex) override
+  {
+    return mFrameIndex[frameIndex].offset;
+  }
+  uint32_t getFrameSize(size_t frameIndex) override
+  {
+    return mFrameIndex[frameIndex].size;
+  }
   float getFrameRate() { return mFrameRate; };
-};
\ No newline at end of file
+};
@@ -0,0 +1,206 @@
+#include "FrameReadAhead.h"
+#include "VideoFile.h"
+#include "../TinyFrameDecoder.h"
+#include <algorithm>
+
+// slots beyond the ring that the player may hold on to, one on screen and
+// one being decoded
+#define PLAYER_SLOTS 2
+
+FrameReadAhead::FrameReadAhead(int maxFrames, size_t maxBytes)
+    : mMaxBytes(maxBytes)
+{
+  mPool = new FramePool(maxFrames + PLAYER_SLOTS, 0);
+  mReadySlots = xQueueCreate(maxFrames + PLAYER_SLOTS, sizeof(FrameSlot *));
+  mReadMutex = xSemaphoreCreateMutex();
+  // the decoder runs on core 0, keep the card reads on the other core
+  xTaskCreatePinnedToCore(_task, "ReadAhead", 4096, this, 1, &mTaskHandle, 1);
+}
+
+FrameReadAhead::~FrameReadAhead()
+{
+  stop();
+  vTaskDelete(mTaskHandle);
+  delete mPool;
+  vQueueDelete(mReadySlots);
+  vSemaphoreDelete(mReadMutex);
+}
+
+void FrameReadAhead::_task(void *param)
+{
+  FrameReadAhead *readAhead = (FrameReadAhead *)param;
+  readAhead->task();
+}
+
+void FrameReadAhead::task()
+{
+  while (true)
+  {
+    if (!mRunning)
+    {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    if (mBufferedBytes >= mMaxBytes)
+    {
+      // over the byte budget, wait for the decoder to catch up
+      vTaskDelay(pdMS_TO_TICKS(5));
+      continue;
+    }
+    FrameSlot *slot = mPool->acquire(pdMS_TO_TICKS(20));
+    if (!slot)
+    {
+      // ring is full
+      continue;
+    }
+    xSemaphoreTake(mReadMutex, portMAX_DELAY);
+    if (!mRunning)
+    {
+      FramePool::release(slot);
+      xSemaphoreGive(mReadMutex);
+      continue;
+    }
+    if (mNextFrame != SIZE_MAX && isBefore(mNextFrame, mMinFrame))
+    {
+      // playback has fallen behind, don't bother reading what it will drop
+      mNextFrame = mMinFrame;
+    }
+    if (mNextFrame != SIZE_MAX && mParser->readFrame(mNextFrame, slot) > 0)
+    {
+      // going backwards, the frame after the first one is the end
+      mNextFrame = mStep < 0 && mNextFrame < (size_t)-mStep
+                       ? SIZE_MAX
+                       : mNextFrame + mStep;
+      mBufferedBytes += slot->length;
+    }
+    else
+    {
+      FramePool::release(slot);
+      slot = NULL;
+      mRunning = false;
+    }
+    xQueueSend(mReadySlots, &slot, 0);
+    xSemaphoreGive(mReadMutex);
+  }
+}
+
+void FrameReadAhead::flush()
+{
+  FrameSlot *slot;
+  while (xQueueReceive(mReadySlots, &slot, 0) == pdTRUE)
+  {
+    FramePool::release(slot);
+  }
+  mBufferedBytes = 0;
+}
+
+void FrameReadAhead::start(VideoFile *parser, int step)
+{
+  stop();
+  xSemaphoreTake(mReadMutex, portMAX_DELAY);
+  mParser = parser;
+  mNextFrame = parser->getCurrentFrame();
+  mStep = step;
+  mMinFrame = noLimit(step);
+  mLastFrame = SIZE_MAX;
+  mSkippingToKey = false;
+  mRunning = true;
+  xSemaphoreGive(mReadMutex);
+  xTaskNotifyGive(mTaskHandle);
+}
+
+void FrameReadAhead::stop()
+{
+  mRunning = false;
+  // wait for any read in flight to finish
+  xSemaphoreTake(mReadMutex, portMAX_DELAY);
+  flush();
+  mParser = NULL;
+  xSemaphoreGive(mReadMutex);
+}
+
+void FrameReadAhead::waitForFrame(uint32_t waitMs)
+{
+  FrameSlot *slot;
+  if (!mRunning)
+  {
+    // nothing more is coming
+    vTaskDelay(pdMS_TO_TICKS(10));
+    return;
+  }
+  xQueuePeek(mReadySlots, &slot, pdMS_TO_TICKS(waitMs));
+}
+
+ReadAheadResult FrameReadAhead::getFrame(FrameSlot **frame, size_t minFrame,
+                                         uint32_t waitMs)
+{
+  mMinFrame = minFrame;
+  FrameSlot *slot;
+  while (true)
+  {
+    if (xQueueReceive(mReadySlots, &slot, 0) != pdTRUE)
+    {
+      if (!mRunning)
+      {
+        return ReadAheadResult::EMPTY;
+      }
+      mUnderruns++;
+      if (xQueueReceive(mReadySlots, &slot, pdMS_TO_TICKS(waitMs)) != pdTRUE)
+      {
+        return ReadAheadResult::EMPTY;
+      }
+    }
+    if (!slot)
+    {
+      return ReadAheadResult::END_OF_STREAM;
+    }
+    mBufferedBytes -= slot->length;
+    // a delta frame only follows the frame straight before it, anything else
+    // means the reader skipped some
+    bool follows = mLastFrame != SIZE_MAX && mStep == 1 &&
+                   slot->frameIndex == mLastFrame + 1;
+    if (mLastFrame != SIZE_MAX && !follows)
+    {
+      mSkippingToKey = true;
+    }
+    if (!follows)
+    {
+      mLastKeyFrame = SIZE_MAX;
+    }
+    mLastFrame = slot->frameIndex;
+    bool delta = TinyFrameDecoder::isDelta(slot->data, slot->length);
+    if (delta)
+    {
+      // the interval is at least as long as the run of delta frames so far
+      int run = mLastKeyFrame != SIZE_MAX
+                    ? (int)(slot->frameIndex - mLastKeyFrame) + 1
+                    : 2;
+      mKeyFrameInterval = std::max(mKeyFrameInterval, run);
+      if (mSkippingToKey)
+      {
+        FramePool::release(slot);
+        continue;
+      }
+    }
+    else
+    {
+      if (mLastKeyFrame != SIZE_MAX)
+      {
+        mKeyFrameInterval = std::max(
+            mKeyFrameInterval, (int)(slot->frameIndex - mLastKeyFrame));
+      }
+      mLastKeyFrame = slot->frameIndex;
+      mSkippingToKey = false;
+    }
+    if (!isBefore(slot->frameIndex, minFrame))
+    {
+      break;
+    }
+    // too late to show this one, and the delta frames after it are no use
+    // without it
+    mSkippingToKey = slot->format == FrameFormat::TINY_FRAME;
+    FramePool::release(slot);
+  }
+  *frame = slot;
+  return ReadAheadResult::FRAME;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "../FramePool.h"
+
+class VideoFile;
+
+enum class ReadAheadResult
+{
+  FRAME,
+  END_OF_STREAM,
+  EMPTY
+};
+
+// Reads compressed frames ahead of playback on its own task and keeps them in
+// a bounded ring (at most maxFrames frames or maxBytes bytes) so that SD
+// latency spikes are absorbed before they reach the decoder. Frames are read
+// straight into pool slots which are leased to the player as they are.
+class FrameReadAhead
+{
+private:
+  size_t mMaxBytes;
+  FramePool *mPool;
+  // filled slots in frame order, a NULL entry marks the end of the stream
+  QueueHandle_t mReadySlots = NULL;
+  SemaphoreHandle_t mReadMutex = NULL;
+  TaskHandle_t mTaskHandle = NULL;
+
+  VideoFile *mParser = NULL;
+  size_t mNextFrame = 0;
+  // frames to move on by after each read, negative when playing backwards
+  int mStep = 1;
+  volatile bool mRunning = false;
+  std::atomic<size_t> mBufferedBytes{0};
+  std::atomic<uint32_t> mUnderruns{0};
+  std::atomic<size_t> mMinFrame{0};
+  // last frame taken off the ring, SIZE_MAX until the first one
+  size_t mLastFrame = SIZE_MAX;
+  // a frame was missed so delta frames are dropped up to the next key frame
+  bool mSkippingToKey = false;
+  // last key frame of the frames taken off the ring in a row, SIZE_MAX if
+  // there isn't one
+  size_t mLastKeyFrame = SIZE_MAX;
+  int mKeyFrameInterval = 1;
+
+  static void _task(void *param);
+  void task();
+  void flush();
+  // true if the frame comes before the limit in the direction of playback
+  bool isBefore(size_t frameIndex, size_t limit)
+  {
+    return mStep > 0 ? frameIndex < limit : frameIndex > limit;
+  }
+
+public:
+  FrameReadAhead(int maxFrames, size_t maxBytes);
+  ~FrameReadAhead();
+  // frame limit that drops nothing, for the given step
+  static size_t noLimit(int step) { return step > 0 ? 0 : SIZE_MAX; }
+  // Start reading from the parser's current frame, moving step frames at a
+  // time. Reading backwards ends after the first frame of the file. The ring
+  // is flushed first.
+  void start(VideoFile *parser, int step = 1);
+  // Stop reading and flush the ring. Once this returns the parser is no longer
+  // touched and can be deleted.
+  void stop();
+  // Take the next frame that isn't before minFrame in the direction of
+  // reading, frames before it are dropped and the reader skips ahead. Once a
+  // Tinytron frame is missed the delta frames after it are dropped too, up to
+  // the next key frame, as they can't be shown without it. The
+  // caller leases the returned slot and must release it back to its pool.
+  // Waits up to waitMs if the ring has run dry.
+  ReadAheadResult getFrame(FrameSlot **frame, size_t minFrame,
+                           uint32_t waitMs);
+  // Wait up to waitMs for a frame to be read, without taking it.
+  void waitForFrame(uint32_t waitMs);
+  // Longest stretch from a key frame to the next seen so far in frames read
+  // in a row, 1 while every frame has been a key frame.
+  int getKeyFrameInterval() { return mKeyFrameInterval; }
+  // Start measuring the key frame interval again, for a new clip.
+  void resetKeyFrameInterval() { mKeyFrameInterval = 1; }
+  int getBufferedFrames() { return uxQueueMessagesWaiting(mReadySlots); }
+  size_t getBufferedBytes() { return mBufferedBytes; }
+  uint32_t getUnderrunCount() { return mUnderruns; }
+};
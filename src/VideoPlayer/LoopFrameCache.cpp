@@ -0,0 +1,131 @@
+#include "LoopFrameCache.h"
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+LoopFrameCache::LoopFrameCache()
+{
+#ifdef BOARD_HAS_PSRAM
+  mEnabled = true;
+#else
+  // even a short clip is many screens of pixels
+  mEnabled = false;
+#endif
+}
+
+LoopFrameCache::~LoopFrameCache()
+{
+  freeFrom(0);
+}
+
+void LoopFrameCache::freeFrom(size_t frameIndex)
+{
+  for (size_t i = frameIndex; i < mFrames.size(); i++)
+  {
+    heap_caps_free(mFrames[i].data);
+  }
+  if (frameIndex < mFrames.size())
+  {
+    mFrames.resize(frameIndex);
+  }
+}
+
+bool LoopFrameCache::setFormat(int width, int height, uint32_t variant)
+{
+  if (width == mWidth && height == mHeight && variant == mVariant)
+  {
+    return false;
+  }
+  bool hadFrames = mStoredCount > 0;
+  mWidth = width;
+  mHeight = height;
+  mVariant = variant;
+  clear();
+  return hadFrames;
+}
+
+bool LoopFrameCache::begin(uint32_t clip, size_t frameCount,
+                           size_t budgetBytes)
+{
+  if (budgetBytes == 0)
+  {
+    // turned off
+    clear();
+    freeFrom(0);
+    return false;
+  }
+  if (!mEnabled || frameCount == 0 || getFrameSize() == 0 ||
+      frameCount > budgetBytes / getFrameSize())
+  {
+    // the clip that's held is kept for when it's switched back to
+    return false;
+  }
+  clear();
+  freeFrom(frameCount);
+  mFrames.resize(frameCount, FrameSlot{});
+  mStored.assign(frameCount, false);
+  mClip = clip;
+  mFrameCount = frameCount;
+  return true;
+}
+
+FrameSlot *LoopFrameCache::find(size_t frameIndex)
+{
+  if (mClip == NO_CLIP || frameIndex >= mFrameCount || !mStored[frameIndex])
+  {
+    return NULL;
+  }
+  mHits++;
+  return &mFrames[frameIndex];
+}
+
+FrameSlot *LoopFrameCache::reserve(size_t frameIndex)
+{
+  if (mClip == NO_CLIP || frameIndex >= mFrameCount || mStored[frameIndex])
+  {
+    return NULL;
+  }
+  FrameSlot &slot = mFrames[frameIndex];
+  size_t size = getFrameSize();
+  if (slot.data && slot.capacity != size)
+  {
+    // made for a different screen size
+    heap_caps_free(slot.data);
+    slot.data = NULL;
+  }
+  if (!slot.data)
+  {
+    slot.data = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (!slot.data)
+    {
+      // a clip that can't be held whole isn't worth holding at all
+      Serial.println("Failed to allocate loop cache frame");
+      clear();
+      freeFrom(0);
+      return NULL;
+    }
+    slot.capacity = size;
+  }
+  mMisses++;
+  slot.length = size;
+  slot.frameIndex = frameIndex;
+  slot.pool = NULL;
+  slot.format = FrameFormat::RGB565;
+  slot.width = mWidth;
+  slot.height = mHeight;
+  return &slot;
+}
+
+void LoopFrameCache::commit(FrameSlot *slot)
+{
+  mStored[slot->frameIndex] = true;
+  mStoredCount++;
+}
+
+void LoopFrameCache::clear()
+{
+  // the buffers stay valid, anything still showing one can carry on
+  mStored.assign(mStored.size(), false);
+  mClip = NO_CLIP;
+  mFrameCount = 0;
+  mStoredCount = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+
+#include "../FramePool.h"
+
+// Screen sized RGB565 renderings of every frame of one short clip, kept in
+// PSRAM so that when the clip plays again it's drawn from memory with nothing
+// read from the card or decoded. Frames are stored as they're first shown,
+// and the clip can be played from the cache once all of them are there.
+// Buffers are only freed by begin and reserve, so neither may be called while
+// a stored frame is still on screen.
+class LoopFrameCache
+{
+public:
+  // no clip is being cached
+  static const uint32_t NO_CLIP = UINT32_MAX;
+
+private:
+  int mWidth = 0;
+  int mHeight = 0;
+  uint32_t mVariant = 0;
+  uint32_t mClip = NO_CLIP;
+  size_t mFrameCount = 0;
+  size_t mStoredCount = 0;
+  // one per frame of the clip. The buffers are kept for the next clip,
+  // beyond its length they're freed.
+  std::vector<FrameSlot> mFrames;
+  std::vector<bool> mStored;
+  bool mEnabled;
+  uint32_t mHits = 0;
+  uint32_t mMisses = 0;
+
+  void freeFrom(size_t frameIndex);
+
+public:
+  LoopFrameCache();
+  ~LoopFrameCache();
+  // false when there's no PSRAM to keep the frames in
+  bool isEnabled() { return mEnabled; }
+  // The size and settings renderings are made with, a change drops them.
+  // Returns true if anything was dropped. Buffers of the old size are
+  // replaced as they're reserved.
+  bool setFormat(int width, int height, uint32_t variant);
+  size_t getFrameSize() { return mWidth * mHeight * sizeof(uint16_t); }
+  // Start caching a clip if all of its frames fit in budgetBytes, dropping
+  // the frames of the previous clip. A budget of zero frees everything.
+  bool begin(uint32_t clip, size_t frameCount, size_t budgetBytes);
+  bool isCaching(uint32_t clip) { return clip != NO_CLIP && mClip == clip; }
+  // true once every frame of the clip is stored
+  bool isComplete(uint32_t clip)
+  {
+    return isCaching(clip) && mStoredCount == mFrameCount;
+  }
+  // The stored frame, or NULL. The slot has no pool so releasing it does
+  // nothing.
+  FrameSlot *find(size_t frameIndex);
+  // A buffer to render a frame of the clip into, or NULL if it's stored
+  // already or there's no memory. It only becomes visible to find once
+  // commit is called.
+  FrameSlot *reserve(size_t frameIndex);
+  void commit(FrameSlot *slot);
+  void clear();
+  // frames shown from the cache, and frames of cached clips that had to be
+  // read and decoded
+  uint32_t getHitCount() { return mHits; }
+  uint32_t getMissCount() { return mMisses; }
+};
@@ -1,26 +1,408 @@
 #include "SDCardVideoSource.h"
+#include "../BufferedFile.h"
+#include "../MediaCatalog.h"
 #include "../SDCard.h"
-#include "AVIParser.h"
+#include "../TinyFrameDecoder.h"
+#include "VideoFile.h"
+#include "FrameReadAhead.h"
+#include "LoopFrameCache.h"
 #include <Arduino.h>
+#include <algorithm>
+#include <esp_timer.h>
 
-SDCardVideoSource::SDCardVideoSource(SDCard *sdCard, const char *aviPath)
-    : mSDCard(sdCard), mAviPath(aviPath) {}
+// how far ahead of playback the reader task is allowed to get
+#ifdef BOARD_HAS_PSRAM
+#define READ_AHEAD_FRAMES 16
+#define READ_AHEAD_BYTES (1024 * 1024)
+#else
+#define READ_AHEAD_FRAMES 3
+#define READ_AHEAD_BYTES (64 * 1024)
+#endif
+// how long the player waits for the reader when the ring runs dry
+#define READ_AHEAD_WAIT_MS 100
+// how long a frame step while paused waits for its frame
+#define STEP_WAIT_MS 500
+// trick play speeds, as a percentage of normal
+#define MIN_SPEED_PERCENT 25
+#define MAX_SPEED_PERCENT 800
+// channels kept open either side of the current one, the next and then the
+// previous
+#ifdef BOARD_HAS_PSRAM
+#define PRELOADED_CHANNELS 2
+#else
+// another file's index and read buffer would come out of internal RAM, the
+// preload task is only kept to index resumed files
+#define PRELOADED_CHANNELS 0
+#endif
+
+SDCardVideoSource::SDCardVideoSource(SDCard *sdCard, MediaCatalog *catalog,
+                                     const char *aviPath, Prefs *prefs)
+    : mSDCard(sdCard), mCatalog(catalog), mPrefs(prefs), mAviPath(aviPath) {}
 
 void SDCardVideoSource::start()
 {
-  // nothing to do!
+  if (!mReadAhead)
+  {
+    mReadAhead = new FrameReadAhead(READ_AHEAD_FRAMES, READ_AHEAD_BYTES);
+  }
+  if (!mPreloaded)
+  {
+    mPreloadedCount = PRELOADED_CHANNELS;
+    mPreloaded = new PreloadedChannel[mPreloadedCount];
+    for (int i = 0; i < mPreloadedCount; i++)
+    {
+      mPreloaded[i] = {-1, NULL, NULL, false};
+    }
+    // a first frame for each preloaded channel, plus the one waiting to be
+    // shown and the one on screen
+    mFirstFramePool = new FramePool(PRELOADED_CHANNELS + 2, 0);
+    mPreloadMutex = xSemaphoreCreateMutex();
+    // opening a file reads its whole index, keep that off the decoder's core
+    xTaskCreatePinnedToCore(_preloadTask, "Preload", 6144, this, 1,
+                            &mPreloadTaskHandle, 1);
+  }
+  if (!mLoopCache)
+  {
+    mLoopCache = new LoopFrameCache();
+  }
+}
+
+int SDCardVideoSource::getNeighbour(int channel, int index)
+{
+  int count = mAviFiles.size();
+  return index == 0 ? (channel + 1) % count : (channel + count - 1) % count;
+}
+
+// Called with the preload mutex held
+bool SDCardVideoSource::isWanted(int channel)
+{
+  for (int i = 0; i < mPreloadedCount; i++)
+  {
+    if (channel != mChannelNumber && getNeighbour(mChannelNumber, i) == channel)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SDCardVideoSource::_preloadTask(void *param)
+{
+  SDCardVideoSource *source = (SDCardVideoSource *)param;
+  source->preloadTask();
+}
+
+void SDCardVideoSource::preloadTask()
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    openResumedChannel();
+    while (preloadOne())
+    {
+    }
+  }
+}
+
+// Open one missing neighbour, or read the first frame of one that was handed
+// back without it. Returns false when there's nothing left to do.
+bool SDCardVideoSource::preloadOne()
+{
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+  // close channels that are no longer next to the current one
+  for (int i = 0; i < mPreloadedCount; i++)
+  {
+    PreloadedChannel &entry = mPreloaded[i];
+    if (entry.channel != -1 && !entry.loading && !isWanted(entry.channel))
+    {
+      delete entry.parser;
+      FramePool::release(entry.firstFrame);
+      entry = {-1, NULL, NULL, false};
+    }
+  }
+  PreloadedChannel *target = NULL;
+  int channel = -1;
+  for (int i = 0; i < mPreloadedCount && !target; i++)
+  {
+    int neighbour = getNeighbour(mChannelNumber, i);
+    if (neighbour == mChannelNumber)
+    {
+      continue;
+    }
+    PreloadedChannel *found = NULL;
+    PreloadedChannel *unused = NULL;
+    for (int j = 0; j < mPreloadedCount; j++)
+    {
+      PreloadedChannel &entry = mPreloaded[j];
+      if (entry.channel == neighbour)
+      {
+        found = &entry;
+      }
+      else if (entry.channel == -1 && !entry.loading && !unused)
+      {
+        unused = &entry;
+      }
+    }
+    if (!found || (found->parser && !found->firstFrame && !found->loading))
+    {
+      target = found ? found : unused;
+      channel = neighbour;
+    }
+  }
+  if (!target)
+  {
+    xSemaphoreGive(mPreloadMutex);
+    return false;
+  }
+  target->channel = channel;
+  target->loading = true;
+  VideoFile *parser = target->parser;
+  const char *path = mCatalog->getPath(mAviFiles[channel]);
+  xSemaphoreGive(mPreloadMutex);
+
+  if (!parser)
+  {
+    Serial.printf("Preloading video file %s\n", path);
+    parser = VideoFile::create(path);
+    if (parser && !parser->open())
+    {
+      delete parser;
+      parser = NULL;
+    }
+  }
+  FrameSlot *firstFrame = NULL;
+  if (parser)
+  {
+    // the player gives first frames back once the next frame is on screen
+    firstFrame = mFirstFramePool->acquire(pdMS_TO_TICKS(100));
+    if (firstFrame && parser->readFrame(0, firstFrame) == 0)
+    {
+      FramePool::release(firstFrame);
+      firstFrame = NULL;
+    }
+  }
+
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+  target->loading = false;
+  bool keep = target->channel == channel;
+  if (keep)
+  {
+    // a channel that failed to open keeps its entry so it isn't retried
+    target->parser = parser;
+    target->firstFrame = firstFrame;
+  }
+  else
+  {
+    // switched away while it was loading
+    delete parser;
+    FramePool::release(firstFrame);
+    *target = {-1, NULL, NULL, false};
+  }
+  xSemaphoreGive(mPreloadMutex);
+  // without a free slot the frame is read when the next channel change
+  // wakes us up
+  return !keep || !parser || firstFrame;
+}
+
+// Index the file of a resumed channel, which the player picks up with
+// takeResumedChannel
+void SDCardVideoSource::openResumedChannel()
+{
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+  int channel = mResumeOpened ? -1 : mResumeChannel;
+  const char *path =
+      channel != -1 ? mCatalog->getPath(mAviFiles[channel]) : NULL;
+  xSemaphoreGive(mPreloadMutex);
+  if (channel == -1)
+  {
+    return;
+  }
+  Serial.printf("Indexing resumed video file %s\n", path);
+  VideoFile *parser = VideoFile::create(path);
+  if (parser && !parser->open())
+  {
+    delete parser;
+    parser = NULL;
+  }
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+  if (mResumeChannel == channel && !mResumeOpened)
+  {
+    mResumeParser = parser;
+    mResumeOpened = true;
+    parser = NULL;
+  }
+  xSemaphoreGive(mPreloadMutex);
+  // the resume was cancelled while we were reading
+  delete parser;
+}
+
+// Carry on with the resumed channel once its file has been indexed. Returns
+// false while that's still going on.
+bool SDCardVideoSource::takeResumedChannel()
+{
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+  bool opened = mResumeOpened;
+  VideoFile *parser = mResumeParser;
+  if (opened)
+  {
+    mResumeChannel = -1;
+    mResumeOpened = false;
+    mResumeParser = NULL;
+  }
+  xSemaphoreGive(mPreloadMutex);
+  if (!opened)
+  {
+    return false;
+  }
+  if (!parser)
+  {
+    Serial.println("Failed to open the resumed video file");
+    nextChannel();
+    mChannelChanged = true;
+    return true;
+  }
+  mCurrentChannelVideoParser = parser;
+  // the read-ahead carries on after the saved frame
+  size_t frameCount = parser->getFrameCount();
+  parser->seekToFrame(mResumeFrame < frameCount ? mResumeFrame + 1
+                                                : frameCount);
+  mReadAhead->start(parser, mReadStep);
+  return true;
+}
+
+void SDCardVideoSource::cancelResume()
+{
+  if (!mPreloadMutex)
+  {
+    return;
+  }
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+  VideoFile *parser = mResumeParser;
+  mResumeChannel = -1;
+  mResumeOpened = false;
+  mResumeParser = NULL;
+  xSemaphoreGive(mPreloadMutex);
+  delete parser;
+}
+
+// Read the saved frame straight from its chunk, without the file's index
+FrameSlot *SDCardVideoSource::readResumeFrame(const ResumePoint &point)
+{
+  if (point.size < 2 || point.offset + point.size > point.fileSize)
+  {
+    return NULL;
+  }
+  FrameSlot *frame = mFirstFramePool->acquire(pdMS_TO_TICKS(100));
+  if (!frame)
+  {
+    return NULL;
+  }
+  // the frame is read straight into the slot, the buffer is only used for
+  // small reads
+  BufferedFile file(512);
+  bool valid = file.open(point.path.c_str()) &&
+               FramePool::reserve(frame, point.size);
+  if (valid)
+  {
+    file.seek(point.offset);
+    valid = file.read(frame->data, point.size) == point.size;
+  }
+  file.close();
+  // an offset that's gone stale won't land on the start of a frame
+  if (valid)
+  {
+    frame->format = TinyFrameDecoder::detectFormat(frame->data, point.size);
+    valid = frame->format == FrameFormat::TINY_FRAME ||
+            (frame->data[0] == 0xFF && frame->data[1] == 0xD8);
+  }
+  if (!valid)
+  {
+    FramePool::release(frame);
+    return NULL;
+  }
+  frame->length = point.size;
+  frame->frameIndex = point.frame;
+  return frame;
+}
+
+bool SDCardVideoSource::resume(const ResumePoint &point)
+{
+  if (!mPreloaded || !mReadAhead || !mSDCard->isMounted())
+  {
+    return false;
+  }
+  int channel = -1;
+  for (int i = 0; i < (int)mAviFiles.size() && channel == -1; i++)
+  {
+    if (point.path == mCatalog->getPath(mAviFiles[i]))
+    {
+      channel = i;
+    }
+  }
+  // the catalog's header facts rule out a stale point before the card is
+  // read, some writers leave the frame count at zero
+  const VideoInfo *info =
+      channel != -1 ? mCatalog->getVideoInfo(mAviFiles[channel]) : NULL;
+  if (!info || (info->frameCount > 0 && point.frame >= info->frameCount) ||
+      mCatalog->getEntry(mAviFiles[channel]).size != point.fileSize)
+  {
+    Serial.printf("Can't resume %s, it has changed\n", point.path.c_str());
+    return false;
+  }
+  FrameSlot *frame = readResumeFrame(point);
+  if (!frame)
+  {
+    Serial.printf("Can't read frame %u of %s\n", point.frame,
+                  point.path.c_str());
+    return false;
+  }
+  Serial.printf("Resuming %s at frame %u\n", point.path.c_str(),
+                point.frame);
+  resetPlayback();
+  mReadAhead->stop();
+  FramePool::release(mPendingFrame);
+  mPendingFrame = frame;
+  mLastPresentedFrame = point.frame;
+  VideoFile *previousParser = mCurrentChannelVideoParser;
+  mCurrentChannelVideoParser = NULL;
+  cancelResume();
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+  mChannelNumber = channel;
+  mResumeChannel = channel;
+  mResumeFrame = point.frame;
+  xSemaphoreGive(mPreloadMutex);
+  delete previousParser;
+  // the index is read in the background, along with the neighbours
+  xTaskNotifyGive(mPreloadTaskHandle);
+  return true;
+}
+
+bool SDCardVideoSource::getResumePoint(ResumePoint &point)
+{
+  if (!mCurrentChannelVideoParser ||
+      mLastPresentedFrame >= mCurrentChannelVideoParser->getFrameCount())
+  {
+    return false;
+  }
+  uint32_t entry = mAviFiles[mChannelNumber];
+  point.path = mCatalog->getPath(entry);
+  point.fileSize = mCatalog->getEntry(entry).size;
+  point.frame = mLastPresentedFrame;
+  point.offset =
+      mCurrentChannelVideoParser->getFrameOffset(mLastPresentedFrame);
+  point.size = mCurrentChannelVideoParser->getFrameSize(mLastPresentedFrame);
+  return true;
 }
 
 bool SDCardVideoSource::fetchVideoData()
 {
-  // check the the sd card is mounted
-  if (!mSDCard->isMounted())
+  // the catalog checks that the card is mounted
+  if (!mCatalog->begin())
   {
-    Serial.println("SD card is not mounted");
     return false;
   }
   // get the list of AVI files
-  mAviFiles = mSDCard->listFiles(mAviPath, ".avi");
+  mAviFiles = mCatalog->find(MediaType::VIDEO, mAviPath);
   if (mAviFiles.size() == 0)
   {
     Serial.println("No AVI files found");
@@ -29,9 +411,151 @@ bool SDCardVideoSource::fetchVideoData()
   return true;
 }
 
-void SDCardVideoSource::setChannel(int channel)
+void SDCardVideoSource::resetClock()
+{
+  // the next frame we present becomes the start of the timeline
+  mClockRunning = false;
+  mGaplessStartUs = 0;
+  mDropPolicy = mPrefs->getFrameDropPolicy();
+  mMaxDriftUs = (int64_t)mPrefs->getMaxDriftMs() * 1000;
+}
+
+int64_t SDCardVideoSource::getFrameDueUs(size_t frameIndex)
+{
+  // negative speeds count down from the clock frame
+  return mClockStartUs +
+         (mCurrentChannelVideoParser->getFrameTimeUs(frameIndex) -
+          mCurrentChannelVideoParser->getFrameTimeUs(mClockFrame)) *
+             100 / mSpeedPercent;
+}
+
+// Read on from the given frame at the current step, throwing away anything
+// already read. A frame outside the file ends the stream.
+void SDCardVideoSource::restartReadAhead(int64_t frameIndex)
+{
+  mPlayingFromCache = false;
+  mReadAhead->stop();
+  FramePool::release(mPendingFrame);
+  mPendingFrame = NULL;
+  int64_t frameCount = mCurrentChannelVideoParser->getFrameCount();
+  if (frameIndex < 0 || frameIndex > frameCount)
+  {
+    frameIndex = frameCount;
+  }
+  mCurrentChannelVideoParser->seekToFrame(frameIndex);
+  mReadAhead->start(mCurrentChannelVideoParser, mReadStep);
+}
+
+void SDCardVideoSource::setSpeed(int percent)
+{
+  int magnitude = abs(percent);
+  if (magnitude < MIN_SPEED_PERCENT)
+  {
+    magnitude = MIN_SPEED_PERCENT;
+  }
+  if (magnitude > MAX_SPEED_PERCENT)
+  {
+    magnitude = MAX_SPEED_PERCENT;
+  }
+  percent = percent < 0 ? -magnitude : magnitude;
+  if (percent == mSpeedPercent)
+  {
+    return;
+  }
+  mSpeedPercent = percent;
+  // at fast speeds only the frames that will be shown are read and decoded
+  int step = magnitude > 100 ? magnitude / 100 : 1;
+  // Delta frames need the frame before them, so with those frames are only
+  // skipped a whole key frame interval at a time, and reverse play shows
+  // key frames only. Below the interval every frame is read, just sooner.
+  int keyInterval = mReadAhead ? mReadAhead->getKeyFrameInterval() : 1;
+  if (keyInterval > 1)
+  {
+    step = step < keyInterval ? 1 : step / keyInterval * keyInterval;
+    if (percent < 0)
+    {
+      step = std::max(step, keyInterval);
+    }
+  }
+  mReadStep = percent < 0 ? -step : step;
+  if (!mCurrentChannelVideoParser || !mReadAhead)
+  {
+    return;
+  }
+  // carry on from the frame on screen in the new direction, stepping over
+  // delta frames from the key frame they follow
+  int64_t frameIndex = (int64_t)mLastPresentedFrame + mReadStep;
+  if (keyInterval > 1 && step > 1)
+  {
+    int64_t keyFrame = mLastPresentedFrame / keyInterval * keyInterval;
+    frameIndex = mReadStep < 0 && keyFrame != (int64_t)mLastPresentedFrame
+                     ? keyFrame
+                     : keyFrame + mReadStep;
+  }
+  if (frameIndex < 0 && mLastPresentedFrame > 0)
+  {
+    frameIndex = 0;
+  }
+  restartReadAhead(frameIndex);
+  resetClock();
+}
+
+FrameSlot *SDCardVideoSource::getSteppedFrame()
+{
+  int direction = mPendingStep;
+  mPendingStep = 0;
+  if (direction == 0 || !mCurrentChannelVideoParser || !mReadAhead)
+  {
+    return NULL;
+  }
+  int64_t frameIndex = (int64_t)mLastPresentedFrame + direction;
+  if (frameIndex < 0 ||
+      frameIndex >= (int64_t)mCurrentChannelVideoParser->getFrameCount())
+  {
+    return NULL;
+  }
+  // the read-ahead carries on from the stepped frame, so that's where
+  // playback picks up again
+  restartReadAhead(frameIndex);
+  FrameSlot *frame = NULL;
+  if (mReadAhead->getFrame(&frame, FrameReadAhead::noLimit(mReadStep),
+                           STEP_WAIT_MS) != ReadAheadResult::FRAME)
+  {
+    return NULL;
+  }
+  mLastPresentedFrame = frame->frameIndex;
+  resetClock();
+  return frame;
+}
+
+void SDCardVideoSource::setState(MediaPlayerState state)
+{
+  VideoSource::setState(state);
+  resetClock();
+}
+
+// Called when switching channel
+void SDCardVideoSource::resetPlayback()
 {
   mFrameCount = 0;
+  // every channel starts at normal speed
+  mSpeedPercent = 100;
+  mReadStep = 1;
+  mPendingStep = 0;
+  mLastPresentedFrame = 0;
+  mPlayingFromCache = false;
+  if (mReadAhead)
+  {
+    mReadAhead->resetKeyFrameInterval();
+  }
+  mLoopCacheBudget = (size_t)mPrefs->getLoopCacheMB() * 1024 * 1024;
+  mUncachedClip = LoopFrameCache::NO_CLIP;
+  resetClock();
+}
+
+void SDCardVideoSource::setChannel(int channel)
+{
+  resetPlayback();
   if (!mSDCard->isMounted())
   {
     Serial.println("SD card is not mounted");
@@ -43,37 +567,106 @@ void SDCardVideoSource::setChannel(int channel)
     Serial.printf("Invalid channel %d\n", channel);
     return;
   }
-  // close any open AVI files
-  // if (mCurrentChannelAudioParser)
-  // {
-  //     delete mCurrentChannelAudioParser;
-  //     mCurrentChannelAudioParser = NULL;
-  // }
-  if (mCurrentChannelVideoParser)
-  {
-    delete mCurrentChannelVideoParser;
-    mCurrentChannelVideoParser = NULL;
-  }
-  // open the AVI file
-  std::string aviFilename = mAviFiles[channel];
-  Serial.printf("Opening AVI file %s\n", aviFilename.c_str());
-  // mCurrentChannelAudioParser = new AVIParser(aviFilename,
-  // AVIChunkType::AUDIO); if (!mCurrentChannelAudioParser->open())
-  // {
-  //     Serial.printf("Failed to open AVI file %s\n", aviFilename.c_str());
-  //     delete mCurrentChannelAudioParser;
-  //     mCurrentChannelAudioParser = NULL;
-  // }
-  mCurrentChannelVideoParser = new AVIParser(aviFilename, AVIChunkType::VIDEO);
-  if (!mCurrentChannelVideoParser->open())
-  {
-    Serial.printf("Failed to open AVI file %s\n", aviFilename.c_str());
-    delete mCurrentChannelVideoParser;
-    mCurrentChannelVideoParser = NULL;
-    // delete mCurrentChannelAudioParser;
-    // mCurrentChannelAudioParser = NULL;
+  // a clip that's whole in the loop cache plays again from there, its file
+  // isn't opened again or read
+  if (channel == mChannelNumber && mCurrentChannelVideoParser &&
+      isClipCached(channel))
+  {
+    startCachedPlayback();
+    return;
+  }
+  if (mReadAhead)
+  {
+    mReadAhead->stop();
   }
+  FramePool::release(mPendingFrame);
+  mPendingFrame = NULL;
+  cancelResume();
+  VideoFile *previousParser = mCurrentChannelVideoParser;
+  int previousChannel = mChannelNumber;
+  mCurrentChannelVideoParser = NULL;
+
+  std::string aviFilename = mCatalog->getPath(mAviFiles[channel]);
+  if (mPreloaded)
+  {
+    // a preloaded channel is a pointer swap away
+    xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
+    for (int i = 0; i < mPreloadedCount; i++)
+    {
+      PreloadedChannel &entry = mPreloaded[i];
+      if (entry.channel == channel && !entry.loading && entry.parser)
+      {
+        Serial.printf("Switching to preloaded video file %s\n",
+                      aviFilename.c_str());
+        mCurrentChannelVideoParser = entry.parser;
+        mPendingFrame = entry.firstFrame;
+        entry = {-1, NULL, NULL, false};
+      }
+    }
+    xSemaphoreGive(mPreloadMutex);
+  }
+  if (!mCurrentChannelVideoParser)
+  {
+    Serial.printf("Opening video file %s\n", aviFilename.c_str());
+    mCurrentChannelVideoParser = VideoFile::create(aviFilename.c_str());
+    if (mCurrentChannelVideoParser && !mCurrentChannelVideoParser->open())
+    {
+      Serial.printf("Failed to open video file %s\n", aviFilename.c_str());
+      delete mCurrentChannelVideoParser;
+      mCurrentChannelVideoParser = NULL;
+    }
+  }
+  // switching back to the clip the loop cache holds only opens the file for
+  // its frame count and timing
+  bool fromCache = mCurrentChannelVideoParser && isClipCached(channel);
+  if (mCurrentChannelVideoParser && mReadAhead && !fromCache)
+  {
+    // the read-ahead carries on after the first frame if we already have it
+    mCurrentChannelVideoParser->seekToFrame(
+        mPendingFrame ? mPendingFrame->frameIndex + 1 : 0);
+    mReadAhead->start(mCurrentChannelVideoParser, mReadStep);
+  }
+
+  if (!mPreloaded)
+  {
+    delete previousParser;
+    mChannelNumber = channel;
+    if (fromCache)
+    {
+      startCachedPlayback();
+    }
+    return;
+  }
+  xSemaphoreTake(mPreloadMutex, portMAX_DELAY);
   mChannelNumber = channel;
+  // the channel we're leaving is kept open if it's now a neighbour, so
+  // flipping back is instant too
+  PreloadedChannel *unused = NULL;
+  for (int i = 0; i < mPreloadedCount && previousParser; i++)
+  {
+    PreloadedChannel &entry = mPreloaded[i];
+    if (entry.channel == previousChannel)
+    {
+      unused = NULL;
+      break;
+    }
+    if (entry.channel == -1 && !entry.loading && !unused)
+    {
+      unused = &entry;
+    }
+  }
+  if (unused && previousChannel != channel && isWanted(previousChannel))
+  {
+    *unused = {previousChannel, previousParser, NULL, false};
+    previousParser = NULL;
+  }
+  xSemaphoreGive(mPreloadMutex);
+  delete previousParser;
+  xTaskNotifyGive(mPreloadTaskHandle);
+  if (fromCache)
+  {
+    startCachedPlayback();
+  }
 }
 
 void SDCardVideoSource::nextChannel()
@@ -87,46 +680,240 @@ void SDCardVideoSource::nextChannel()
   setChannel(channel);
 }
 
-bool SDCardVideoSource::getVideoFrame(uint8_t **buffer, size_t &bufferLength,
-                                      size_t &frameLength)
+FrameSlot *SDCardVideoSource::getVideoFrame()
 {
-  if (!mCurrentChannelVideoParser)
+  mPresentationTimeUs = 0;
+  if (!mReadAhead)
   {
-    return false;
+    return NULL;
   }
   if (mState == MediaPlayerState::STOPPED ||
       mState == MediaPlayerState::STATIC)
   {
     vTaskDelay(100 / portTICK_PERIOD_MS);
-    return false;
+    return NULL;
   }
   if (mState == MediaPlayerState::PAUSED)
   {
     vTaskDelay(100 / portTICK_PERIOD_MS);
-    return false;
+    return NULL;
   }
-  // how long should we wait before fetching the next frame?
-  float frameRate = mCurrentChannelVideoParser->getFrameRate();
-  if (frameRate > 0)
+  if (mResumeChannel != -1 && !takeResumedChannel())
   {
-    float frameTime = 1000.0f / frameRate;
-    long delay = frameTime - (millis() - mLastFrameTime);
-    if (delay > 0)
+    // show the saved frame while the rest of the file is indexed
+    FrameSlot *frame = mPendingFrame;
+    mPendingFrame = NULL;
+    if (frame)
     {
-      vTaskDelay(delay / portTICK_PERIOD_MS);
+      mLastPresentedFrame = frame->frameIndex;
+      mFrameCount++;
     }
+    return frame;
   }
-  mLastFrameTime = millis();
-  frameLength = mCurrentChannelVideoParser->getNextChunk((uint8_t **)buffer,
-                                                         bufferLength);
-  if (frameLength == 0)
+  if (!mCurrentChannelVideoParser)
   {
-    // end of video, move to next one
-    nextChannel();
-    return false;
+    return NULL;
+  }
+  // the first frame of a new channel was read when it was preloaded
+  FrameSlot *frame = mPendingFrame;
+  mPendingFrame = NULL;
+  int64_t now = esp_timer_get_time();
+  if (!frame)
+  {
+    // work out the oldest frame still worth showing, anything before it is
+    // dropped without being read or decoded
+    size_t minFrame = FrameReadAhead::noLimit(mReadStep);
+    if (mClockRunning && mDropPolicy != FrameDropPolicy::NEVER)
+    {
+      int64_t allowedLateUs =
+          mDropPolicy == FrameDropPolicy::LIMIT_DRIFT ? mMaxDriftUs : 0;
+      int64_t mediaTimeUs =
+          (now - allowedLateUs - mClockStartUs) * mSpeedPercent / 100 +
+          mCurrentChannelVideoParser->getFrameTimeUs(mClockFrame);
+      minFrame = mCurrentChannelVideoParser->getFrameAtTimeUs(mediaTimeUs);
+    }
+    ReadAheadResult result =
+        mPlayingFromCache
+            ? getCachedFrame(&frame, minFrame)
+            : mReadAhead->getFrame(&frame, minFrame, 0);
+    if (result == ReadAheadResult::END_OF_STREAM && mReadStep < 0)
+    {
+      // playing backwards stops on the first frame of the file
+      return NULL;
+    }
+    if (result == ReadAheadResult::END_OF_STREAM)
+    {
+      // end of video, the next one starts when this one's next frame would
+      // have been due
+      int64_t continueUs =
+          mClockRunning ? getFrameDueUs(mLastPresentedFrame + 1) : 0;
+      nextChannel();
+      mChannelChanged = true;
+      mGaplessStartUs = continueUs;
+      frame = mPendingFrame;
+      mPendingFrame = NULL;
+      if (!frame && mPlayingFromCache)
+      {
+        getCachedFrame(&frame, 0);
+      }
+    }
+    else if (result == ReadAheadResult::EMPTY)
+    {
+      return NULL;
+    }
+    if (!frame)
+    {
+      return NULL;
+    }
+  }
+  size_t frameIndex = frame->frameIndex;
+  if (!mClockRunning)
+  {
+    mClockRunning = true;
+    // a gapless start that's already passed would only make frames late
+    now = esp_timer_get_time();
+    mClockStartUs = mGaplessStartUs > now ? mGaplessStartUs : now;
+    mGaplessStartUs = 0;
+    mClockFrame = frameIndex;
+  }
+  else
+  {
+    // frames skipped beyond the read step were dropped to keep up
+    int64_t reads =
+        ((int64_t)frameIndex - (int64_t)mLastPresentedFrame) / mReadStep;
+    if (reads > 1)
+    {
+      mDroppedFrames += reads - 1;
+    }
+  }
+  mLastPresentedFrame = frameIndex;
+  int64_t dueUs = getFrameDueUs(frameIndex);
+  now = esp_timer_get_time();
+  if (dueUs > now)
+  {
+    // the player waits for it
+    mPresentationTimeUs = dueUs;
+  }
+  else if (mDropPolicy == FrameDropPolicy::NEVER)
+  {
+    // we're late but must show every frame, so shift the timeline rather
+    // than rushing the frames that follow
+    mClockStartUs += now - dueUs;
   }
   mFrameCount++;
-  return true;
+  return frame;
+}
+
+void SDCardVideoSource::waitForFrame()
+{
+  mReadAhead ? mReadAhead->waitForFrame(READ_AHEAD_WAIT_MS)
+             : VideoSource::waitForFrame();
+}
+
+bool SDCardVideoSource::isClipCached(int channel)
+{
+  return mLoopCacheBudget > 0 && mLoopCache &&
+         mLoopCache->isComplete(mAviFiles[channel]);
+}
+
+void SDCardVideoSource::startCachedPlayback()
+{
+  mReadAhead->stop();
+  FramePool::release(mPendingFrame);
+  mPendingFrame = NULL;
+  mPlayingFromCache = true;
+  mNextCachedFrame = 0;
+  Serial.printf("Playing %s from the loop cache (%u hits, %u misses)\n",
+                getChannelName().c_str(), mLoopCache->getHitCount(),
+                mLoopCache->getMissCount());
+}
+
+// Take the next frame from the loop cache, skipping any before minFrame as
+// the read-ahead would
+ReadAheadResult SDCardVideoSource::getCachedFrame(FrameSlot **frame,
+                                                  size_t minFrame)
+{
+  size_t frameIndex = std::max(mNextCachedFrame, minFrame);
+  if (frameIndex >= mCurrentChannelVideoParser->getFrameCount())
+  {
+    return ReadAheadResult::END_OF_STREAM;
+  }
+  *frame = mLoopCache->find(frameIndex);
+  if (!*frame)
+  {
+    // the cache was dropped under us, carry on from the card
+    restartReadAhead(frameIndex);
+    return ReadAheadResult::EMPTY;
+  }
+  mNextCachedFrame = frameIndex + 1;
+  return ReadAheadResult::FRAME;
+}
+
+void SDCardVideoSource::setRenderingFormat(int width, int height,
+                                           uint32_t variant)
+{
+  if (mLoopCache && mLoopCache->setFormat(width, height, variant) &&
+      mPlayingFromCache)
+  {
+    restartReadAhead(mNextCachedFrame);
+  }
+}
+
+// Frames of the clip that's playing are kept on its first pass, if the
+// whole clip fits in the budget
+FrameSlot *SDCardVideoSource::reserveRendering(const FrameSlot *frame)
+{
+  if (!mLoopCache || !mLoopCache->isEnabled() || mPlayingFromCache ||
+      !mCurrentChannelVideoParser || mResumeChannel != -1)
+  {
+    return NULL;
+  }
+  uint32_t clip = mAviFiles[mChannelNumber];
+  if (!mLoopCache->isCaching(clip))
+  {
+    if (clip == mUncachedClip)
+    {
+      return NULL;
+    }
+    if (!mLoopCache->begin(clip, mCurrentChannelVideoParser->getFrameCount(),
+                           mLoopCacheBudget))
+    {
+      mUncachedClip = clip;
+      return NULL;
+    }
+  }
+  return mLoopCache->reserve(frame->frameIndex);
+}
+
+void SDCardVideoSource::storeRendering(FrameSlot *rendered)
+{
+  mLoopCache->commit(rendered);
+  if (mLoopCache->isComplete(mAviFiles[mChannelNumber]))
+  {
+    Serial.printf("Loop cache holds all %u frames of %s\n",
+                  mCurrentChannelVideoParser->getFrameCount(),
+                  getChannelName().c_str());
+  }
+}
+
+uint32_t SDCardVideoSource::getLoopCacheHits()
+{
+  return mLoopCache ? mLoopCache->getHitCount() : 0;
+}
+
+uint32_t SDCardVideoSource::getLoopCacheMisses()
+{
+  return mLoopCache ? mLoopCache->getMissCount() : 0;
+}
+
+int SDCardVideoSource::getBufferedFrameCount()
+{
+  return mReadAhead ? mReadAhead->getBufferedFrames() : 0;
+}
+
+uint32_t SDCardVideoSource::getUnderrunCount()
+{
+  return mReadAhead ? mReadAhead->getUnderrunCount() : 0;
 }
 
 std::string SDCardVideoSource::getChannelName()
@@ -134,13 +921,9 @@ std::string SDCardVideoSource::getChannelName()
   if (mChannelNumber >= 0 && mChannelNumber < mAviFiles.size())
   {
     // we just want the filename, not the full path
-    std::string fullPath = mAviFiles[mChannelNumber];
-    size_t lastSlash = fullPath.find_last_of('/');
-    if (lastSlash != std::string::npos)
-    {
-      return fullPath.substr(lastSlash + 1);
-    }
-    return fullPath;
+    const char *fullPath = mCatalog->getPath(mAviFiles[mChannelNumber]);
+    const char *lastSlash = strrchr(fullPath, '/');
+    return lastSlash ? lastSlash + 1 : fullPath;
   }
   return "Unknown";
 }
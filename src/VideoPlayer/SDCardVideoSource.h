@@ -1,28 +1,117 @@
 
 #pragma once
 
+#include "../Prefs.h"
+#include "FrameReadAhead.h"
 #include "VideoSource.h"
 #include <string>
 #include <vector>
 
 class SDCard;
-class AVIParser;
+class MediaCatalog;
+class VideoFile;
+class LoopFrameCache;
 
 class SDCardVideoSource : public VideoSource
 {
 private:
-  std::vector<std::string> mAviFiles;
+  // a neighbouring channel opened ahead of time with its first frame read
+  struct PreloadedChannel
+  {
+    // -1 when the entry is free
+    int channel;
+    // NULL if the channel couldn't be opened
+    VideoFile *parser;
+    FrameSlot *firstFrame;
+    // the preload task is working on it, nothing else may touch it
+    bool loading;
+  };
+
+  // catalog entries of the videos
+  std::vector<uint32_t> mAviFiles;
   // AVIParser *mCurrentChannelAudioParser = NULL;
-  AVIParser *mCurrentChannelVideoParser = NULL;
+  VideoFile *mCurrentChannelVideoParser = NULL;
+  FrameReadAhead *mReadAhead = NULL;
   SDCard *mSDCard;
+  MediaCatalog *mCatalog;
+  Prefs *mPrefs;
   const char *mAviPath;
   int mFrameCount = 0;
   int mCurrentWsFrameLength = 0;
-  unsigned long mLastFrameTime = 0;
   volatile bool mWrapped = false;
 
+  // presentation clock, frame mClockFrame is due at mClockStartUs
+  bool mClockRunning = false;
+  int64_t mClockStartUs = 0;
+  size_t mClockFrame = 0;
+  size_t mLastPresentedFrame = 0;
+  FrameDropPolicy mDropPolicy = FrameDropPolicy::CATCH_UP;
+  int64_t mMaxDriftUs = 0;
+  uint32_t mDroppedFrames = 0;
+  // when the next file carries on from the end of the last one, the time its
+  // first frame is due
+  int64_t mGaplessStartUs = 0;
+  // when the frame getVideoFrame last returned is due, 0 if it's due now
+  int64_t mPresentationTimeUs = 0;
+
+  // trick play speed as a percentage, negative when playing backwards, and
+  // the frames moved on by each read. Fast speeds skip frames rather than
+  // decoding ones that would never be seen.
+  int mSpeedPercent = 100;
+  int mReadStep = 1;
+  // frame step asked for while paused, 0 if none
+  int mPendingStep = 0;
+
+  // channels either side of the current one are opened in the background so
+  // that switching to them, or running into the next at the end of a file,
+  // doesn't wait for the card
+  PreloadedChannel *mPreloaded = NULL;
+  int mPreloadedCount = 0;
+  FramePool *mFirstFramePool = NULL;
+  SemaphoreHandle_t mPreloadMutex = NULL;
+  TaskHandle_t mPreloadTaskHandle = NULL;
+  // the first frame of the channel just switched to, shown before anything
+  // from the read-ahead
+  FrameSlot *mPendingFrame = NULL;
+
+  // a channel resumed after a power cycle, -1 if none. Its saved frame is
+  // shown straight away while the preload task reads the file's index.
+  int mResumeChannel = -1;
+  size_t mResumeFrame = 0;
+  // set by the preload task, the parser is NULL if the file couldn't be opened
+  bool mResumeOpened = false;
+  VideoFile *mResumeParser = NULL;
+
+  // renderings of every frame of a short clip, so that when it plays again
+  // nothing is read or decoded. While it's played from there the read-ahead
+  // is stopped, mNextCachedFrame is the next frame to show.
+  LoopFrameCache *mLoopCache = NULL;
+  bool mPlayingFromCache = false;
+  size_t mNextCachedFrame = 0;
+  size_t mLoopCacheBudget = 0;
+  // a clip too long for the cache, so it isn't tried on every frame
+  uint32_t mUncachedClip = UINT32_MAX;
+
+  void resetClock();
+  void resetPlayback();
+  int64_t getFrameDueUs(size_t frameIndex);
+  void restartReadAhead(int64_t frameIndex);
+  int getNeighbour(int channel, int index);
+  bool isWanted(int channel);
+  static void _preloadTask(void *param);
+  void preloadTask();
+  bool preloadOne();
+  void openResumedChannel();
+  bool takeResumedChannel();
+  void cancelResume();
+  FrameSlot *readResumeFrame(const ResumePoint &point);
+  bool isClipCached(int channel);
+  void startCachedPlayback();
+  ReadAheadResult getCachedFrame(FrameSlot **frame, size_t minFrame);
+
 public:
-  SDCardVideoSource(SDCard *sdCard, const char *aviPath);
+  SDCardVideoSource(SDCard *sdCard, MediaCatalog *catalog, const char *aviPath,
+                    Prefs *prefs);
   void start();
   bool fetchVideoData();
   int getChannelCount() { return mAviFiles.size(); };
@@ -32,10 +121,27 @@ public:
   //     return mCurrentChannelAudioParser;
   // };
   // see superclass for documentation
-  bool getVideoFrame(uint8_t **buffer, size_t &bufferLength,
-                     size_t &frameLength);
+  FrameSlot *getVideoFrame();
+  int64_t getPresentationTimeUs() override { return mPresentationTimeUs; }
+  void waitForFrame() override;
   void setChannel(int channel);
   void nextChannel();
+  void setState(MediaPlayerState state) override;
+  int getBufferedFrameCount() override;
+  uint32_t getUnderrunCount() override;
+  uint32_t getDroppedFrameCount() override { return mDroppedFrames; }
+  bool canChangeSpeed() override { return true; }
+  void setSpeed(int percent) override;
+  int getSpeed() override { return mSpeedPercent; }
+  void requestStep(int direction) override { mPendingStep = direction; }
+  FrameSlot *getSteppedFrame() override;
+  bool getResumePoint(ResumePoint &point) override;
+  bool resume(const ResumePoint &point) override;
+  void setRenderingFormat(int width, int height, uint32_t variant) override;
+  FrameSlot *reserveRendering(const FrameSlot *frame) override;
+  void storeRendering(FrameSlot *rendered) override;
+  uint32_t getLoopCacheHits() override;
+  uint32_t getLoopCacheMisses() override;
   bool consumeWrapped()
   {
     bool wrapped = mWrapped;
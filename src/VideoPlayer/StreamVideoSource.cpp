@@ -1,8 +1,20 @@
 #include "StreamVideoSource.h"
+#include "../TinyFrameDecoder.h"
 #include <Arduino.h>
 #include <ESPAsyncWebServer.h>
 
 const int MIN_FRAME_INTERVAL_MS = 1000 / 30; // approx 30fps
+#ifdef BOARD_HAS_PSRAM
+const int STREAM_QUEUE_LENGTH = 4;
+const size_t STREAM_FRAME_CAPACITY = 32 * 1024;
+#else
+// internal RAM is shared with the display, WiFi and the web server, so
+// buffers are only allocated as frames arrive and grow to fit them
+const int STREAM_QUEUE_LENGTH = 2;
+const size_t STREAM_FRAME_CAPACITY = 0;
+#endif
+// queued frames plus one on screen and one arriving over the websocket
+const int STREAM_FRAME_SLOTS = STREAM_QUEUE_LENGTH + 2;
 
 StreamVideoSource::StreamVideoSource(AsyncWebServer *server) : mServer(server)
 {
@@ -19,49 +31,23 @@ void StreamVideoSource::start()
   // create a mutex to control access to the JPEG buffer
   mCurrentFrameMutex = xSemaphoreCreateMutex();
   streamingSemaphore = xSemaphoreCreateMutex();
-  jpegQueue = xQueueCreate(10, sizeof(JpegData_t));
+  jpegQueue = xQueueCreate(STREAM_QUEUE_LENGTH, sizeof(FrameSlot *));
+  mFramePool = new FramePool(STREAM_FRAME_SLOTS, STREAM_FRAME_CAPACITY);
 }
 
-bool StreamVideoSource::getVideoFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength)
+FrameSlot *StreamVideoSource::getVideoFrame()
 {
   if (mStreamState != StreamState::STREAMING)
   {
-    return false;
+    return NULL;
   }
 
-  bool copiedFrame = false;
+  FrameSlot *frame = NULL;
   // lock the image buffer
   xSemaphoreTake(mCurrentFrameMutex, portMAX_DELAY);
-  // if the frame is ready, copy it to the buffer
-  JpegData_t receivedJpeg;
-  if (xQueueReceive(jpegQueue, &receivedJpeg, portMAX_DELAY) == pdPASS)
+  // the slot was filled in place by the websocket handler, pass it straight on
+  if (xQueueReceive(jpegQueue, &frame, portMAX_DELAY) == pdPASS)
   {
-    copiedFrame = true;
-    // reallocate the image buffer if necessary
-    if (receivedJpeg.jpeg_len > bufferLength)
-    {
-      uint8_t *newBuffer = (uint8_t *)realloc(*buffer, receivedJpeg.jpeg_len);
-      if (newBuffer == NULL)
-      {
-        Serial.println("StreamVideoSource: realloc failed");
-        free(receivedJpeg.jpeg_data);
-        return false;
-      }
-      *buffer = newBuffer;
-      bufferLength = receivedJpeg.jpeg_len;
-    }
-    // copy the image buffer
-    if (*buffer != NULL) {
-        memcpy(*buffer, receivedJpeg.jpeg_data, receivedJpeg.jpeg_len);
-        frameLength = receivedJpeg.jpeg_len;
-    } else {
-        Serial.println("StreamVideoSource: buffer is NULL");
-        free(receivedJpeg.jpeg_data);
-        return false;
-    }
-    // free the memory that was allocated in the websocket handler
-    free(receivedJpeg.jpeg_data);
-
     // Send "ready"
     uint32_t now = millis();
     if (now - mLastReadyTime > MIN_FRAME_INTERVAL_MS)
@@ -79,8 +65,8 @@ bool StreamVideoSource::getVideoFrame(uint8_t **buffer, size_t &bufferLength, si
   }
   // unlock the image buffer
   xSemaphoreGive(mCurrentFrameMutex);
-  // return true if we copied a frame, false otherwise
-  return copiedFrame;
+  // return the frame if we got one, NULL otherwise
+  return frame;
 }
 
 void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)
@@ -92,7 +78,7 @@ void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *
   else if (type == WS_EVT_DISCONNECT)
   {
     mStreamState = StreamState::DISCONNECTED;
-    mJpegBuffer.clear(); // Clear buffer on disconnect
+    discardFrames(); // Clear buffers on disconnect
   }
   else if (type == WS_EVT_DATA)
   {
@@ -123,15 +109,7 @@ void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *
           vTaskDelay(pdMS_TO_TICKS(100));
 
           // Vider la queue de manière sécurisée
-          JpegData_t dummyData;
-          while (xQueueReceive(jpegQueue, &dummyData, 0) == pdTRUE)
-          {
-            if (dummyData.jpeg_data != NULL)
-            {
-              free(dummyData.jpeg_data);
-            }
-          }
-          mJpegBuffer.clear();
+          discardFrames();
         }
       }
       return;
@@ -142,66 +120,64 @@ void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *
     if (info->index == 0)
     {
       Serial.printf("New binary message, total len: %u\n", info->len);
+      // drop any message that never completed
+      FramePool::release(mAssemblySlot);
       mCurrentWsFrameLength = info->len;
-      mJpegBuffer.clear();
-      mJpegBuffer.reserve(info->len);
+      mAssemblySlot = mFramePool->acquire(0);
+      if (mAssemblySlot == NULL)
+      {
+        Serial.println("No free frame slot, dropping frame.");
+      }
+      else if (!FramePool::reserve(mAssemblySlot, info->len))
+      {
+        FramePool::release(mAssemblySlot);
+        mAssemblySlot = NULL;
+      }
+    }
+    if (mAssemblySlot == NULL)
+    {
+      return;
     }
 
-    // Append the current frame's data to our buffer
-    // 'data' is the buffer for this frame, 'len' is its size
-    mJpegBuffer.insert(mJpegBuffer.end(), data, data + len);
-    Serial.printf("Appended %d bytes, total buffer: %d\n", len, mJpegBuffer.size());
+    // Write the fragment straight into the slot
+    if (mAssemblySlot->length + len > mCurrentWsFrameLength)
+    {
+      Serial.println("Fragment overruns message, dropping frame.");
+      FramePool::release(mAssemblySlot);
+      mAssemblySlot = NULL;
+      return;
+    }
+    memcpy(mAssemblySlot->data + mAssemblySlot->length, data, len);
+    mAssemblySlot->length += len;
 
     // Check if this is the final frame
-    if (mJpegBuffer.size() >= mCurrentWsFrameLength)
+    if (mAssemblySlot->length >= mCurrentWsFrameLength)
     {
-      Serial.printf("Final frame received. Total size: %d bytes. Decoding...\n", mJpegBuffer.size());
-
-      if (uxQueueSpacesAvailable(jpegQueue) > 0)
-      {
-        // 1. Allocate new memory for the decoder task
-        // We use malloc here because it's thread-safe and not tied to the std::vector
-        uint8_t *jpeg_copy = (uint8_t *)malloc(mJpegBuffer.size());
-
-        if (jpeg_copy != NULL)
-        {
-          // 2. Copy the data from the vector into the new buffer
-          memcpy(jpeg_copy, mJpegBuffer.data(), mJpegBuffer.size());
-
-          // 3. Create the struct to send
-          JpegData_t newJpeg = {.jpeg_data = jpeg_copy, .jpeg_len = mJpegBuffer.size()};
-
-          // 4. Send the struct (containing the *new* pointer) to the queue
-          if (xQueueSend(jpegQueue, &newJpeg, 0) != pdPASS)
-          {
-            // This shouldn't happen if we just checked, but it's good practice
-            Serial.println("Failed to queue frame, freeing copy.");
-            free(jpeg_copy); // Clean up if send fails
-          }
-          else
-          {
-            // Serial.println("Frame queued successfully.");
-            // Ownership is now transferred to the decoder task
-          }
-        }
-        else
-        {
-          Serial.println("malloc failed! Dropping frame.");
-          // Not enough RAM to make a copy, drop the frame
-        }
-      }
-      else
+      mAssemblySlot->format = TinyFrameDecoder::detectFormat(
+          mAssemblySlot->data, mAssemblySlot->length);
+      // ownership of the slot passes to the decoder task
+      if (xQueueSend(jpegQueue, &mAssemblySlot, 0) != pdPASS)
       {
         Serial.println("Queue full, dropping frame.");
+        FramePool::release(mAssemblySlot);
       }
-
-      // IMPORTANT: Clear the buffer to be ready for the next image
-      std::vector<uint8_t>().swap(mJpegBuffer);
+      mAssemblySlot = NULL;
       mCurrentWsFrameLength = 0;
     }
   }
 }
 
+void StreamVideoSource::discardFrames()
+{
+  FramePool::release(mAssemblySlot);
+  mAssemblySlot = NULL;
+  FrameSlot *slot;
+  while (xQueueReceive(jpegQueue, &slot, 0) == pdTRUE)
+  {
+    FramePool::release(slot);
+  }
+}
+
 void StreamVideoSource::setChannel(int channel)
 {
 }
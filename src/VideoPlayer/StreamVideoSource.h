@@ -10,27 +10,21 @@ enum class StreamState
   STREAMING
 };
 
-// Struct to hold JPEG data passed via the FreeRTOS queue
-typedef struct
-{
-  uint8_t *jpeg_data;
-  size_t jpeg_len;
-} JpegData_t;
-
 class StreamVideoSource : public VideoSource
 {
 private:
   bool mFrameReady = false;
-  uint8_t *mCurrentFrameBuffer = NULL;
-  size_t mCurrentFrameLength = 0;
-  size_t mCurrentFrameBufferLength = 0;
+  FramePool *mFramePool = NULL;
   AsyncWebServer *mServer = NULL;
   AsyncWebSocket *mWebSocket = NULL;
   SemaphoreHandle_t mCurrentFrameMutex = NULL;
   StreamState mStreamState = StreamState::DISCONNECTED;
-  std::vector<uint8_t> mJpegBuffer;
+  // slot the websocket message currently arriving is written into
+  FrameSlot *mAssemblySlot = NULL;
   void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
+  void discardFrames();
   SemaphoreHandle_t streamingSemaphore = NULL;
+  // complete frames waiting for the decoder, as FrameSlot pointers
   QueueHandle_t jpegQueue = NULL;
   size_t mCurrentWsFrameLength = 0;
   uint32_t mLastReadyTime = 0;
@@ -39,7 +33,7 @@ public:
   StreamVideoSource(AsyncWebServer *server);
   void start();
   // see superclass for documentation
-  bool getVideoFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength);
+  FrameSlot *getVideoFrame();
   void setChannel(int channel);
   void nextChannel();
   int getChannelCount();
@@ -0,0 +1,133 @@
+#include "TinyVideoFile.h"
+#include "../FramePool.h"
+#include "../SDCard.h"
+#include "../TinyFrameDecoder.h"
+#include <Arduino.h>
+#include <string.h>
+
+// Only the header goes through the buffer, frames are whole sectors and are
+// read straight into their slots.
+TinyVideoFile::TinyVideoFile(std::string fname)
+    : mFileName(fname), mFile(SDCard::SECTOR_SIZE) {}
+
+TinyVideoFile::~TinyVideoFile()
+{
+  free(mFrameTable);
+}
+
+bool TinyVideoFile::readHeader()
+{
+  mFile.seek(0);
+  if (mFile.read(&mHeader, sizeof(mHeader)) != sizeof(mHeader) ||
+      memcmp(mHeader.magic, TINY_VIDEO_MAGIC, 4) != 0)
+  {
+    Serial.println("Not a Tinytron video file.");
+    return false;
+  }
+  if (mHeader.version != TINY_VIDEO_VERSION ||
+      mHeader.sectorSize != TINY_VIDEO_SECTOR_SIZE)
+  {
+    Serial.printf("Unsupported Tinytron video version %u\n", mHeader.version);
+    return false;
+  }
+  // the table has to sit after the header and fit inside the file
+  uint64_t tableEnd =
+      (uint64_t)mHeader.tableSector * TINY_VIDEO_SECTOR_SIZE +
+      (uint64_t)mHeader.frameCount * sizeof(TinyVideoFrameEntry);
+  if (mHeader.tableSector == 0 || tableEnd > mFile.size())
+  {
+    Serial.printf("Frame table for %u frames doesn't fit in the file\n",
+                  mHeader.frameCount);
+    return false;
+  }
+  mRate = mHeader.rate;
+  mScale = mHeader.scale;
+  return true;
+}
+
+bool TinyVideoFile::open()
+{
+  if (!mFile.open(mFileName.c_str()))
+  {
+    Serial.printf("Failed to open file.\n");
+    return false;
+  }
+  if (!readHeader())
+  {
+    mFile.close();
+    return false;
+  }
+  // the whole table is read in one go, it's the only index there is
+  size_t tableBytes = mHeader.frameCount * sizeof(TinyVideoFrameEntry);
+  mFrameTable = (TinyVideoFrameEntry *)reallocFrameMemory(NULL, tableBytes);
+  if (!mFrameTable)
+  {
+    Serial.printf("Failed to allocate a table for %u frames\n",
+                  mHeader.frameCount);
+    mFile.close();
+    return false;
+  }
+  mFile.seek((uint64_t)mHeader.tableSector * TINY_VIDEO_SECTOR_SIZE);
+  if (mFile.read(mFrameTable, tableBytes) != tableBytes)
+  {
+    Serial.println("Failed to read the frame table.");
+    mFile.close();
+    return false;
+  }
+  mFrameCount = mHeader.frameCount;
+  mCurrentFrame = 0;
+  Serial.printf("Indexed %u frames\n", mFrameCount);
+  return true;
+}
+
+bool TinyVideoFile::readInfo(VideoInfo *info)
+{
+  if (!mFile.open(mFileName.c_str()))
+  {
+    return false;
+  }
+  bool valid = readHeader();
+  mFile.close();
+  if (!valid)
+  {
+    return false;
+  }
+  info->width = mHeader.width;
+  info->height = mHeader.height;
+  info->rate = mHeader.rate;
+  info->scale = mHeader.scale;
+  info->frameCount = mHeader.frameCount;
+  return true;
+}
+
+size_t TinyVideoFile::readFrame(size_t frameIndex, FrameSlot *slot)
+{
+  if (!mFile.isOpen() || frameIndex >= mFrameCount)
+  {
+    return 0;
+  }
+  // the padding is read too so that the transfer is whole sectors
+  uint32_t frameSize = mFrameTable[frameIndex].size;
+  uint64_t paddedSize = ((uint64_t)frameSize + TINY_VIDEO_SECTOR_SIZE - 1) /
+                        TINY_VIDEO_SECTOR_SIZE * TINY_VIDEO_SECTOR_SIZE;
+  // a damaged table entry mustn't turn into a huge allocation
+  if (getFrameOffset(frameIndex) + paddedSize > mFile.size())
+  {
+    Serial.printf("Frame %u lies outside the file\n", frameIndex);
+    return 0;
+  }
+  if (!FramePool::reserve(slot, paddedSize))
+  {
+    return 0;
+  }
+  mFile.seek(getFrameOffset(frameIndex));
+  if (mFile.read(slot->data, paddedSize) != paddedSize)
+  {
+    Serial.printf("read failed for frame size=%u\n", frameSize);
+    return 0;
+  }
+  slot->length = frameSize;
+  slot->frameIndex = frameIndex;
+  slot->format = TinyFrameDecoder::detectFormat(slot->data, frameSize);
+  return frameSize;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#include "../BufferedFile.h"
+#include "TinyVideoFormat.h"
+#include "VideoFile.h"
+
+// Reads the Tinytron video container, see TinyVideoFormat.h. Opening reads
+// the header and the frame table, frames are then read with a single sector
+// aligned transfer straight into the frame slot.
+class TinyVideoFile : public VideoFile
+{
+private:
+  std::string mFileName;
+  BufferedFile mFile;
+  TinyVideoHeader mHeader;
+  // allocated in PSRAM when available
+  TinyVideoFrameEntry *mFrameTable = NULL;
+
+  bool readHeader();
+
+public:
+  TinyVideoFile(std::string fname);
+  ~TinyVideoFile();
+  // see VideoFile for documentation
+  bool open() override;
+  bool readInfo(VideoInfo *info) override;
+  size_t readFrame(size_t frameIndex, FrameSlot *slot) override;
+  uint64_t getFrameOffset(size_t frameIndex) override
+  {
+    return (uint64_t)mFrameTable[frameIndex].sector * TINY_VIDEO_SECTOR_SIZE;
+  }
+  uint32_t getFrameSize(size_t frameIndex) override
+  {
+    return mFrameTable[frameIndex].size;
+  }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Tinytron video file (.tvf), a container laid out for the way the player
+// reads frames. It is shared with the packer in tools/, so it must not
+// depend on anything but the C library. Everything is little endian.
+//
+//   sector 0        TinyVideoHeader, zero padded to a whole sector
+//   tableSector..   the frame table, a TinyVideoFrameEntry per frame, zero
+//                   padded to a whole sector
+//   after that      the frames, each one starting on a sector boundary and
+//                   zero padded to a whole number of sectors
+//
+// The frame table is read when the file is opened, after which fetching a
+// frame is one sector aligned read with nothing to parse.
+
+#define TINY_VIDEO_MAGIC "TNYV"
+#define TINY_VIDEO_VERSION 1
+#define TINY_VIDEO_SECTOR_SIZE 512
+
+typedef struct __attribute__((packed))
+{
+  char magic[4];
+  uint16_t version;
+  // always TINY_VIDEO_SECTOR_SIZE, recorded so a reader can check
+  uint16_t sectorSize;
+  uint32_t width;
+  uint32_t height;
+  // the frame rate is rate / scale, as in an AVI stream header
+  uint32_t rate;
+  uint32_t scale;
+  uint32_t frameCount;
+  // first sector of the frame table
+  uint32_t tableSector;
+} TinyVideoHeader;
+
+typedef struct __attribute__((packed))
+{
+  // first sector of the frame
+  uint32_t sector;
+  // length of the frame data, without the padding
+  uint32_t size;
+} TinyVideoFrameEntry;
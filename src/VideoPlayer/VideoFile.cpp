@@ -0,0 +1,24 @@
+#include "VideoFile.h"
+#include "AVIParser.h"
+#include "TinyVideoFile.h"
+#include <string.h>
+#include <strings.h>
+
+static bool hasExtension(const char *path, const char *extension)
+{
+  const char *dot = strrchr(path, '.');
+  return dot && strcasecmp(dot, extension) == 0;
+}
+
+VideoFile *VideoFile::create(const char *path)
+{
+  if (hasExtension(path, ".tvf"))
+  {
+    return new TinyVideoFile(path);
+  }
+  if (hasExtension(path, ".avi"))
+  {
+    return new AVIParser(path, AVIChunkType::VIDEO);
+  }
+  return NULL;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../FramePool.h"
+
+// What a video file's headers say about it, without indexing the file.
+struct VideoInfo
+{
+  uint32_t width;
+  uint32_t height;
+  uint32_t rate;
+  uint32_t scale;
+  uint32_t frameCount;
+};
+
+// A video file that frames can be read from in any order, whatever its
+// container. Once open() has indexed it, every frame is a single seek and
+// read away.
+class VideoFile
+{
+protected:
+  size_t mFrameCount = 0;
+  size_t mCurrentFrame = 0;
+  // the frame rate is mRate / mScale, as in an AVI stream header
+  uint32_t mRate = 0;
+  uint32_t mScale = 0;
+
+public:
+  virtual ~VideoFile() {}
+  // Open the file and index its frames.
+  virtual bool open() = 0;
+  // Read just the headers, which is quick whatever the file's length.
+  virtual bool readInfo(VideoInfo *info) = 0;
+  // Read the given frame into the slot with a single seek and read. Returns
+  // the frame length or 0 if the frame could not be read.
+  virtual size_t readFrame(size_t frameIndex, FrameSlot *slot) = 0;
+  // where the frame's data starts in the file
+  virtual uint64_t getFrameOffset(size_t frameIndex) = 0;
+  virtual uint32_t getFrameSize(size_t frameIndex) = 0;
+
+  bool seekToFrame(size_t frameIndex)
+  {
+    if (frameIndex > mFrameCount)
+    {
+      return false;
+    }
+    mCurrentFrame = frameIndex;
+    return true;
+  }
+  size_t getFrameCount() { return mFrameCount; }
+  size_t getCurrentFrame() { return mCurrentFrame; }
+  // Presentation time of a frame relative to the first, from rate/scale.
+  // Returns 0 for every frame if the file has no usable frame rate.
+  int64_t getFrameTimeUs(size_t frameIndex)
+  {
+    return mRate ? (int64_t)frameIndex * mScale * 1000000 / mRate : 0;
+  }
+  // The inverse of getFrameTimeUs, rounded down.
+  size_t getFrameAtTimeUs(int64_t timeUs)
+  {
+    return mScale && timeUs > 0 ? timeUs * mRate / ((int64_t)mScale * 1000000)
+                                : 0;
+  }
+
+  // The video in the file at path, of the kind its extension says. NULL if
+  // it isn't a video we can play. The file is not opened yet.
+  static VideoFile *create(const char *path);
+};
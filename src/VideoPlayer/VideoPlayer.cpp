@@ -4,13 +4,13 @@
 #include "VideoSource.h"
 #include "Battery.h"
 #include <Arduino.h>
-#include <list>
 
 VideoPlayer::VideoPlayer(VideoSource *videoSource, Display &display,
                          Prefs &prefs, Battery &battery)
     : MediaPlayer(display, prefs, battery),
       mVideoSource(videoSource)
 {
+  mSkipDuplicateFrames = true;
 }
 
 void VideoPlayer::start()
@@ -21,19 +21,53 @@ void VideoPlayer::start()
 
 void VideoPlayer::set(int channel)
 {
-  if (mTaskHandle != NULL)
+  // the task only touches the source while it holds the mutex, so the
+  // channel can be switched under it without stopping it
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
   {
-    mRunTask = false;
-    // wait for the task to stop
-    while (mTaskHandle != NULL)
-    {
-      vTaskDelay(10);
-    }
+    mVideoSource->setChannel(channel);
+    mResetTinyFrames = true;
+    mChannelGeneration++;
+    xSemaphoreGive(mMutex);
+  }
+  drawOSDTimed(mVideoSource->getChannelName().c_str(), TOP_LEFT, OSDLevel::STANDARD);
+  if (mTaskHandle == NULL)
+  {
+    startTask();
   }
-  // update the video source
-  mVideoSource->setChannel(channel);
-  drawOSDTimed(mVideoSource->getChannelName(), TOP_LEFT, OSDLevel::STANDARD);
-  startTask();
+}
+
+bool VideoPlayer::resume(const ResumePoint &point)
+{
+  bool resumed = false;
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    resumed = mVideoSource->resume(point);
+    mResetTinyFrames = true;
+    mChannelGeneration++;
+    xSemaphoreGive(mMutex);
+  }
+  if (!resumed)
+  {
+    return false;
+  }
+  drawOSDTimed(mVideoSource->getChannelName().c_str(), TOP_LEFT, OSDLevel::STANDARD);
+  if (mTaskHandle == NULL)
+  {
+    startTask();
+  }
+  return true;
+}
+
+bool VideoPlayer::getResumePoint(ResumePoint &point)
+{
+  bool valid = false;
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    valid = mVideoSource->getResumePoint(point);
+    xSemaphoreGive(mMutex);
+  }
+  return valid;
 }
 
 void VideoPlayer::next()
@@ -43,18 +77,56 @@ void VideoPlayer::next()
     play();
   }
 
-  if (mTaskHandle != NULL)
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
   {
-    mRunTask = false;
-    // wait for the task to stop
-    while (mTaskHandle != NULL)
-    {
-      vTaskDelay(10);
-    }
+    mVideoSource->nextChannel();
+    mResetTinyFrames = true;
+    mChannelGeneration++;
+    xSemaphoreGive(mMutex);
+  }
+  drawOSDTimed(mVideoSource->getChannelName().c_str(), TOP_LEFT, OSDLevel::STANDARD);
+  if (mTaskHandle == NULL)
+  {
+    startTask();
+  }
+}
+
+void VideoPlayer::setSpeed(int percent)
+{
+  if (!mVideoSource->canChangeSpeed())
+  {
+    return;
+  }
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    mVideoSource->setSpeed(percent);
+    xSemaphoreGive(mMutex);
+  }
+  char speedText[12];
+  snprintf(speedText, sizeof(speedText), "%gx", getSpeed() / 100.0f);
+  drawOSDTimed(speedText, CENTER, OSDLevel::STANDARD);
+}
+
+void VideoPlayer::stepFrame(int direction)
+{
+  if (!mVideoSource->canChangeSpeed())
+  {
+    return;
+  }
+  if (mState == MediaPlayerState::PLAYING)
+  {
+    pause();
+  }
+  if (mState != MediaPlayerState::PAUSED)
+  {
+    return;
+  }
+  // the task picks the frame up while it's paused
+  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    mVideoSource->requestStep(direction);
+    xSemaphoreGive(mMutex);
   }
-  mVideoSource->nextChannel();
-  drawOSDTimed(mVideoSource->getChannelName(), TOP_LEFT, OSDLevel::STANDARD);
-  startTask();
 }
 
 void VideoPlayer::playStatic()
@@ -86,15 +158,14 @@ void VideoPlayer::playStatic()
 
 void VideoPlayer::redrawFrame()
 {
+  // the frame is usually still in the sprite, with the OSD kept apart
+  if (mDisplay.redrawShownSprite())
+  {
+    return;
+  }
   if (mCurrentFrame)
   {
-    if (mJpeg.openRAM(mCurrentFrame, mCurrentFrameSize, _doDraw))
-    {
-      mJpeg.setUserPointer(this);
-      mJpeg.setPixelType(RGB565_BIG_ENDIAN);
-      mJpeg.decode(0, 0, 0);
-      mJpeg.close();
-    }
+    decodeCurrentFrame();
     mDisplay.flushSprite();
   }
   else
@@ -103,13 +174,88 @@ void VideoPlayer::redrawFrame()
   }
 }
 
-bool VideoPlayer::getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength)
+FrameSlot *VideoPlayer::getFrame()
 {
   if (!mVideoSource)
   {
-    return false;
+    return NULL;
   }
-  return mVideoSource->getVideoFrame(buffer, bufferLength, frameLength);
+  mVideoSource->setRenderingFormat(
+      mDisplay.width(), mDisplay.height(),
+      ((uint32_t)mScaleMode << 8) | (uint32_t)mViewportAnchor);
+  FrameSlot *frame = mVideoSource->getVideoFrame();
+  if (mVideoSource->takeChannelChange())
+  {
+    // the same as next(), the held picture belongs to the old file
+    mResetTinyFrames = true;
+    mChannelGeneration++;
+  }
+  if (frame)
+  {
+    mFrameGeneration = mChannelGeneration;
+    mFrameDueUs = mVideoSource->getPresentationTimeUs();
+  }
+  return frame;
+}
+
+void VideoPlayer::waitForFrame()
+{
+  if (mState == MediaPlayerState::PLAYING)
+  {
+    mVideoSource->waitForFrame();
+    return;
+  }
+  MediaPlayer::waitForFrame();
+}
+
+FrameSlot *VideoPlayer::getPausedFrame()
+{
+  if (!mVideoSource)
+  {
+    return NULL;
+  }
+  FrameSlot *frame = mVideoSource->getSteppedFrame();
+  if (frame)
+  {
+    mFrameGeneration = mChannelGeneration;
+  }
+  return frame;
+}
+
+void VideoPlayer::decodeCurrentFrame()
+{
+  // Renderings are whole screens, which banded displays never hold. Frames
+  // that are already RGB565 gain nothing from being kept, and include the
+  // kept renderings themselves.
+  FrameSlot *rendered = NULL;
+  if (mCurrentFrame->format != FrameFormat::RGB565 &&
+      !mDisplay.drawsInBands() &&
+      xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    if (mFrameGeneration == mChannelGeneration)
+    {
+      rendered = mVideoSource->reserveRendering(mCurrentFrame);
+    }
+    xSemaphoreGive(mMutex);
+  }
+  if (!rendered)
+  {
+    MediaPlayer::decodeCurrentFrame();
+    return;
+  }
+  // a frame that didn't decode cleanly isn't kept, it's tried again on the
+  // next pass
+  bool decoded = renderFrame(mCurrentFrame, (uint16_t *)rendered->data);
+  if (decoded && xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
+  {
+    // the channel may have changed while it was rendered
+    if (mFrameGeneration == mChannelGeneration)
+    {
+      mVideoSource->storeRendering(rendered);
+    }
+    xSemaphoreGive(mMutex);
+  }
+  decodeFrame(rendered);
 }
 
 void VideoPlayer::onStateChanged(MediaPlayerState oldState, MediaPlayerState newState)
@@ -154,25 +300,44 @@ void VideoPlayer::onStatic()
 
 void VideoPlayer::onFrameDisplayed()
 {
-  OSDLevel osdLevel = mPrefs.getOsdLevel();
-  if (osdLevel >= OSDLevel::DEBUG)
+  if (mPrefs.getOsdLevel() < OSDLevel::DEBUG)
   {
-    mFrameTimes.push_back(millis());
-    // keep the frame rate elapsed time to 5 seconds
-    while (mFrameTimes.size() > 0 &&
-           mFrameTimes.back() - mFrameTimes.front() > 5000)
-    {
-      mFrameTimes.pop_front();
-    }
+    return;
+  }
+  uint32_t now = millis();
+  mFpsFrameCount++;
+  if (now - mFpsWindowStart >= 1000)
+  {
+    mFps = mFpsFrameCount * 1000 / (now - mFpsWindowStart);
+    mFpsWindowStart = now;
+    mFpsFrameCount = 0;
+  }
+  DebugStats stats = {mFps,
+                      mVideoSource->getBufferedFrameCount(),
+                      mVideoSource->getUnderrunCount(),
+                      mVideoSource->getDroppedFrameCount(),
+                      mVideoSource->getLoopCacheHits(),
+                      mBattery.getBatteryLevel(),
+                      (int)(mBattery.getVoltage() * 100 + 0.5f)};
+  if (stats.fps != mShownStats.fps ||
+      stats.bufferedFrames != mShownStats.bufferedFrames ||
+      stats.underruns != mShownStats.underruns ||
+      stats.droppedFrames != mShownStats.droppedFrames ||
+      stats.loopCacheHits != mShownStats.loopCacheHits)
+  {
+    snprintf(mStatsText, sizeof(mStatsText), "%d FPS B%d U%u D%u C%u",
+             stats.fps, stats.bufferedFrames, stats.underruns,
+             stats.droppedFrames, stats.loopCacheHits);
   }
-  if (osdLevel >= OSDLevel::DEBUG)
+  if (stats.batteryLevel != mShownStats.batteryLevel ||
+      stats.centivolts != mShownStats.centivolts)
   {
-    char fpsText[8];
-    sprintf(fpsText, "%d FPS", mFrameTimes.size() / 5);
-    mDisplay.drawOSD(fpsText, BOTTOM_RIGHT, OSDLevel::DEBUG);
-    char batText[16];
-    sprintf(batText, "%d%% %.2f", mBattery.getBatteryLevel(),
-            mBattery.getVoltage());
-    mDisplay.drawOSD(batText, BOTTOM_LEFT, OSDLevel::DEBUG);
+    snprintf(mBatteryText, sizeof(mBatteryText), "%d%% %d.%02d",
+             stats.batteryLevel, stats.centivolts / 100,
+             stats.centivolts % 100);
   }
+  mShownStats = stats;
+  // unchanged text reuses the bitmap the OSD already has for it
+  mDisplay.drawOSD(mStatsText, BOTTOM_RIGHT, OSDLevel::DEBUG);
+  mDisplay.drawOSD(mBatteryText, BOTTOM_LEFT, OSDLevel::DEBUG);
 }
\ No newline at end of file
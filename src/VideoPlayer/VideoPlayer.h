@@ -1,26 +1,64 @@
 #pragma once
 #include "VideoSource.h"
 #include "MediaPlayer.h"
-#include <list>
 
 class VideoPlayer : public MediaPlayer
 {
 private:
   VideoSource *mVideoSource = NULL;
-  std::list<int> mFrameTimes;
+  // frames shown in the current one second window
+  uint32_t mFpsWindowStart = 0;
+  int mFpsFrameCount = 0;
+  int mFps = 0;
+
+  // what the debug OSD shows, its text is only rebuilt when these change
+  struct DebugStats
+  {
+    int fps;
+    int bufferedFrames;
+    uint32_t underruns;
+    uint32_t droppedFrames;
+    uint32_t loopCacheHits;
+    int batteryLevel;
+    int centivolts;
+  };
+  DebugStats mShownStats = {-1, -1, 0, 0, 0, -1, -1};
+  char mStatsText[OSDOverlay::MAX_TEXT_LENGTH] = "";
+  char mBatteryText[16] = "";
+
+  // bumped whenever the channel changes, so that a frame leased before the
+  // change isn't kept as a rendering of the new clip
+  uint32_t mChannelGeneration = 0;
+  uint32_t mFrameGeneration = 0;
 
 protected:
-  virtual bool getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength) override;
+  virtual FrameSlot *getFrame() override;
+  virtual FrameSlot *getPausedFrame() override;
+  virtual void waitForFrame() override;
   virtual void onFrameDisplayed() override;
   virtual void onStateChanged(MediaPlayerState oldState, MediaPlayerState newState) override;
   virtual void onStatic() override;
+  virtual void decodeCurrentFrame() override;
 
 public:
   VideoPlayer(VideoSource *videoSource, Display &display, Prefs &prefs,
               Battery &battery);
   virtual void set(int channelIndex) override;
+  // Carry on from a saved point, see VideoSource. Returns false if that
+  // can't be done and a channel should be set instead.
+  bool resume(const ResumePoint &point);
+  bool getResumePoint(ResumePoint &point);
   void playStatic();
   void redrawFrame();
+  // trick play, see VideoSource
+  bool canChangeSpeed() { return mVideoSource->canChangeSpeed(); }
+  void setSpeed(int percent);
+  int getSpeed() { return mVideoSource->getSpeed(); }
+  // pause if needed and show the next (1) or previous (-1) frame
+  void stepFrame(int direction);
+  // see VideoSource::getLoopCacheHits
+  uint32_t getLoopCacheHits() { return mVideoSource->getLoopCacheHits(); }
+  uint32_t getLoopCacheMisses() { return mVideoSource->getLoopCacheMisses(); }
 
   virtual void next() override;
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../MediaPlayer.h"
+#include "../Prefs.h"
 #include <Arduino.h>
 #include <string>
 
@@ -11,22 +12,29 @@ protected:
   int mAudioTimeMs = 0;
   int mLastAudioTimeUpdateMs = 0;
   int mChannelNumber = 0;
+  // set when the source moves to another channel by itself
+  bool mChannelChanged = false;
 
 public:
   virtual void start() = 0;
   // Retrieve a JPEG image for the frame at the given time.
-  // Returns true if a frame was retrieved, false if the current frame should be
-  // re-used e.g. the elapsed time is closest to the previous frame. The buffer
-  // is re-allocated if the frame is larger than the previous frame.
-  virtual bool getVideoFrame(uint8_t **buffer, size_t &bufferLength,
-                             size_t &frameLength) = 0;
+  // Returns NULL if the current frame should be re-used e.g. the elapsed time
+  // is closest to the previous frame. Otherwise the frame is leased to the
+  // caller, who must release it back to its pool once it is off screen.
+  virtual FrameSlot *getVideoFrame() = 0;
+  // When the frame getVideoFrame last returned is due on screen, in
+  // esp_timer microseconds, or 0 to show it straight away.
+  virtual int64_t getPresentationTimeUs() { return 0; }
+  // Wait a little for a frame when getVideoFrame has none. The player calls
+  // this and waits for frames to be due without holding its lock.
+  virtual void waitForFrame() { vTaskDelay(10 / portTICK_PERIOD_MS); }
   // update the audio time
   void updateAudioTime(int audioTimeMs)
   {
     mAudioTimeMs = audioTimeMs;
     mLastAudioTimeUpdateMs = millis();
   }
-  void setState(MediaPlayerState state)
+  virtual void setState(MediaPlayerState state)
   {
     mState = state;
     switch (state)
@@ -42,10 +50,48 @@ public:
       break;
     }
   }
+  // True if the source has moved to another channel by itself since the last
+  // call, e.g. at the end of a file, so the player can forget the old one.
+  bool takeChannelChange()
+  {
+    bool changed = mChannelChanged;
+    mChannelChanged = false;
+    return changed;
+  }
   virtual void setChannel(int channel) = 0;
   virtual void nextChannel() = 0;
   virtual int getChannelCount() = 0;
   virtual int getChannelNumber() { return mChannelNumber; }
   virtual std::string getChannelName() = 0;
   virtual bool fetchVideoData() = 0;
+  // read-ahead statistics, for sources that buffer frames ahead of playback
+  virtual int getBufferedFrameCount() { return 0; }
+  virtual uint32_t getUnderrunCount() { return 0; }
+  virtual uint32_t getDroppedFrameCount() { return 0; }
+  // trick play, for sources that can pick any frame out of a file. Speed is
+  // a percentage of normal, negative to play backwards.
+  virtual bool canChangeSpeed() { return false; }
+  virtual void setSpeed(int percent) {}
+  virtual int getSpeed() { return 100; }
+  // ask for the next (1) or previous (-1) frame to be shown while paused
+  virtual void requestStep(int direction) {}
+  // the frame asked for by requestStep, or NULL. Leased as by getVideoFrame.
+  virtual FrameSlot *getSteppedFrame() { return NULL; }
+  // where playback is, for sources that can carry on from there later
+  virtual bool getResumePoint(ResumePoint &point) { return false; }
+  // Carry on from a saved point instead of setting a channel. Returns false
+  // if it can't, e.g. the file has gone.
+  virtual bool resume(const ResumePoint &point) { return false; }
+  // Sources may keep screen sized renderings of the frames of a short clip
+  // and return them from getVideoFrame in place of the originals when it
+  // plays again. The variant tells renderings made with different settings
+  // apart.
+  virtual void setRenderingFormat(int width, int height, uint32_t variant) {}
+  // A buffer to render the frame into for keeping, or NULL if it isn't
+  // wanted. storeRendering is called once it's been filled in.
+  virtual FrameSlot *reserveRendering(const FrameSlot *frame) { return NULL; }
+  virtual void storeRendering(FrameSlot *rendered) {}
+  // frames shown from kept renderings, and frames decoded to make them
+  virtual uint32_t getLoopCacheHits() { return 0; }
+  virtual uint32_t getLoopCacheMisses() { return 0; }
 };
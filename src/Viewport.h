@@ -0,0 +1,67 @@
+#pragma once
+
+// Where an image is pinned when it doesn't match the screen size, on each
+// axis it's either cropped or surrounded by bars.
+enum class ViewportAnchor
+{
+  CENTER,
+  TOP_LEFT,
+  BOTTOM_RIGHT
+};
+
+// The part of an image that's visible and where it lands on the screen.
+struct Viewport
+{
+  int cropX;
+  int cropY;
+  int cropWidth;
+  int cropHeight;
+  int screenX;
+  int screenY;
+
+  static Viewport fit(int imageWidth, int imageHeight, int screenWidth,
+                      int screenHeight, ViewportAnchor anchor)
+  {
+    Viewport viewport;
+    fitAxis(imageWidth, screenWidth, anchor, viewport.cropX,
+            viewport.cropWidth, viewport.screenX);
+    fitAxis(imageHeight, screenHeight, anchor, viewport.cropY,
+            viewport.cropHeight, viewport.screenY);
+    return viewport;
+  }
+
+  bool isCropped(int imageWidth, int imageHeight)
+  {
+    return cropWidth < imageWidth || cropHeight < imageHeight;
+  }
+
+  bool coversScreen(int screenWidth, int screenHeight)
+  {
+    return screenX == 0 && screenY == 0 && cropWidth == screenWidth &&
+           cropHeight == screenHeight;
+  }
+
+private:
+  static void fitAxis(int imageSize, int screenSize, ViewportAnchor anchor,
+                      int &crop, int &cropSize, int &screen)
+  {
+    // the spare space goes before the image, after it or half on each side
+    int spare = imageSize > screenSize ? imageSize - screenSize
+                                       : screenSize - imageSize;
+    int before = anchor == ViewportAnchor::TOP_LEFT       ? 0
+                 : anchor == ViewportAnchor::BOTTOM_RIGHT ? spare
+                                                          : spare / 2;
+    if (imageSize > screenSize)
+    {
+      crop = before;
+      cropSize = screenSize;
+      screen = 0;
+    }
+    else
+    {
+      crop = 0;
+      cropSize = imageSize;
+      screen = before;
+    }
+  }
+};
@@ -1,4 +1,5 @@
 #include "WifiManager.h"
+#include "VideoPlayer/VideoPlayer.h"
 
 #ifndef STRINGIFY
 #define STRINGIFY(x) #x
@@ -27,6 +28,19 @@ void WifiManager::begin()
   }
 }
 
+bool WifiManager::beginRemote()
+{
+  if (!initWiFi())
+  {
+    WiFi.disconnect();
+    WiFi.mode(WIFI_OFF);
+    return false;
+  }
+  _sdPlayback = true;
+  setupServer();
+  return true;
+}
+
 bool WifiManager::initWiFi()
 {
   String ssid = prefs->getSsid();
@@ -92,7 +106,14 @@ void WifiManager::setupCommonRoutes()
     json["osdLevel"] = prefs->getOsdLevel();
     json["timerMinutes"] = prefs->getTimerMinutes();
     json["slideshowInterval"] = prefs->getSlideshowInterval();
+    json["frameDropPolicy"] = (int)prefs->getFrameDropPolicy();
+    json["maxDriftMs"] = prefs->getMaxDriftMs();
+    json["parallelDecode"] = prefs->getParallelDecode();
+    json["scaleMode"] = (int)prefs->getScaleMode();
+    json["loopCacheMB"] = prefs->getLoopCacheMB();
+    json["webRemote"] = prefs->getWebRemote();
     json["apMode"] = isAPMode();
+    json["sdPlayback"] = _sdPlayback;
     json["version"] = TOSTRING(APP_VERSION);
     json["build"] = APP_BUILD_NUMBER;
     String response;
@@ -118,6 +139,12 @@ void WifiManager::setupCommonRoutes()
     if (jsonObj["osdLevel"].is<int>()) prefs->setOsdLevel(jsonObj["osdLevel"].as<int>());
     if (jsonObj["timerMinutes"].is<int>()) prefs->setTimerMinutes(jsonObj["timerMinutes"].as<int>());
     if (jsonObj["slideshowInterval"].is<int>()) prefs->setSlideshowInterval(jsonObj["slideshowInterval"].as<int>());
+    if (jsonObj["frameDropPolicy"].is<int>()) prefs->setFrameDropPolicy(jsonObj["frameDropPolicy"].as<int>());
+    if (jsonObj["maxDriftMs"].is<int>()) prefs->setMaxDriftMs(jsonObj["maxDriftMs"].as<int>());
+    if (jsonObj["parallelDecode"].is<bool>()) prefs->setParallelDecode(jsonObj["parallelDecode"].as<bool>());
+    if (jsonObj["scaleMode"].is<int>()) prefs->setScaleMode(jsonObj["scaleMode"].as<int>());
+    if (jsonObj["loopCacheMB"].is<int>()) prefs->setLoopCacheMB(jsonObj["loopCacheMB"].as<int>());
+    if (jsonObj["webRemote"].is<bool>()) prefs->setWebRemote(jsonObj["webRemote"].as<bool>());
 
     request->send(200, "application/json", "{\"status\":\"ok\"}");
 
@@ -127,6 +154,31 @@ void WifiManager::setupCommonRoutes()
     } });
   server->addHandler(handler);
 
+  // trick play for the video player
+  server->on("/playback", HTTP_GET, [this](AsyncWebServerRequest *request)
+             {
+    JsonDocument json;
+    json["available"] = _videoPlayer && _videoPlayer->canChangeSpeed();
+    json["speed"] = _videoPlayer ? _videoPlayer->getSpeed() : 100;
+    json["loopCacheHits"] = _videoPlayer ? _videoPlayer->getLoopCacheHits() : 0;
+    json["loopCacheMisses"] = _videoPlayer ? _videoPlayer->getLoopCacheMisses() : 0;
+    String response;
+    serializeJson(json, response);
+    request->send(200, "application/json", response); });
+
+  AsyncCallbackJsonWebHandler *playbackHandler = new AsyncCallbackJsonWebHandler("/playback", [this](AsyncWebServerRequest *request, JsonVariant &json)
+                                                                                 {
+    if (!_videoPlayer || !_videoPlayer->canChangeSpeed()) {
+        request->send(409, "application/json", "{\"status\":\"unavailable\"}");
+        return;
+    }
+    JsonObject jsonObj = json.as<JsonObject>();
+    if (jsonObj["speed"].is<int>()) _videoPlayer->setSpeed(jsonObj["speed"].as<int>());
+    if (jsonObj["step"].is<int>()) _videoPlayer->stepFrame(jsonObj["step"].as<int>() < 0 ? -1 : 1);
+
+    request->send(200, "application/json", "{\"status\":\"ok\"}"); });
+  server->addHandler(playbackHandler);
+
   // OTA update endpoint
   server->on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {}, [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final)
              {
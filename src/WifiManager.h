@@ -12,6 +12,8 @@
 #include "AsyncJson.h"
 #include "OSD.h"
 
+class VideoPlayer;
+
 // Embedded files
 extern const uint8_t index_html_start[] asm("_binary_src_www_index_html_start");
 extern const uint8_t index_html_end[] asm("_binary_src_www_index_html_end");
@@ -65,11 +67,17 @@ class WifiManager
 public:
   WifiManager(AsyncWebServer *server, Prefs *prefs, Battery *battery);
   void begin();
+  // Join the saved network and serve the web interface alongside SD card
+  // playback, without falling back to an access point. Returns false if it
+  // couldn't connect.
+  bool beginRemote();
   bool isConnected();
   bool isAPMode();
   void handleClient();
   IPAddress getIpAddress();
   String getApSsid();
+  // the player that /playback controls, set once it exists
+  void setVideoPlayer(VideoPlayer *videoPlayer) { _videoPlayer = videoPlayer; }
 
 private:
   static const char *PARAM_INPUT_1;
@@ -78,6 +86,9 @@ private:
   String _apSsid;
   Prefs *prefs;
   Battery *_battery;
+  VideoPlayer *_videoPlayer = NULL;
+  // serving alongside SD card playback, there's nothing to stream to
+  bool _sdPlayback = false;
 
   AsyncWebServer *server;
   IPAddress localIP;
@@ -3,9 +3,10 @@
 #include "Display.h"
 #include "ImagePlayer/ImagePlayer.h"
 #include "ImagePlayer/SDCardImageSource.h"
+#include "MediaCatalog.h"
 #include "Prefs.h"
 #include "SDCard.h"
-#include "VideoPlayer/AVIParser.h"
+#include "VideoPlayer/VideoFile.h"
 #include "VideoPlayer/SDCardVideoSource.h"
 #include "VideoPlayer/StreamVideoSource.h"
 #include "VideoPlayer/VideoPlayer.h"
@@ -47,6 +48,48 @@ enum class PlaybackMode
 };
 PlaybackMode playbackMode = PlaybackMode::VIDEO_ONLY;
 
+// how often the video position is saved while playing. NVS flash wears
+// out, so this is kept infrequent and it's also saved when powering off.
+#define RESUME_CHECKPOINT_MS 60000
+unsigned long lastResumeCheckpoint = 0;
+ResumePoint savedResumePoint;
+
+void saveResumePoint()
+{
+  if (videoPlayer == nullptr || currentPlayer != videoPlayer)
+  {
+    return;
+  }
+  ResumePoint point;
+  if (!((VideoPlayer *)videoPlayer)->getResumePoint(point))
+  {
+    return;
+  }
+  if (point.path == savedResumePoint.path &&
+      point.frame == savedResumePoint.frame)
+  {
+    return;
+  }
+  prefs.setResumePoint(point);
+  savedResumePoint = point;
+}
+
+// speeds a triple click steps through while a video plays
+const int trickPlaySpeeds[] = {100, 200, 400, 800, -100};
+
+int nextTrickPlaySpeed(int speed)
+{
+  int count = sizeof(trickPlaySpeeds) / sizeof(trickPlaySpeeds[0]);
+  for (int i = 0; i < count; i++)
+  {
+    if (trickPlaySpeeds[i] == speed)
+    {
+      return trickPlaySpeeds[(i + 1) % count];
+    }
+  }
+  return trickPlaySpeeds[0];
+}
+
 void setShutdownTime(int minutes)
 {
   if (minutes > 0)
@@ -78,6 +121,8 @@ void setup()
   prefs.onTimerMinutesChanged([](int minutes)
                               { setShutdownTime(minutes); });
   setShutdownTime(prefs.getTimerMinutes());
+  button.onPowerOff([]()
+                    { saveResumePoint(); });
   display.setBrightness(prefs.getBrightness());
   display.drawOSD("Tinytron", CENTER, STANDARD);
   display.drawOSD(TOSTRING(APP_VERSION) " " TOSTRING(APP_BUILD_NUMBER),
@@ -126,7 +171,20 @@ void setup()
     display.drawOSD("SD Card found !", CENTER, STANDARD);
     display.flushSprite();
 
-    VideoSource *videoCandidate = new SDCardVideoSource(card, "/");
+    // playback can be controlled from the web interface if it's wanted
+    if (prefs.getWebRemote() && wifiManager.beginRemote())
+    {
+      Serial.printf("Web remote at %s\n",
+                    wifiManager.getIpAddress().toString().c_str());
+      display.drawOSD(wifiManager.getIpAddress().toString().c_str(), TOP_LEFT,
+                      STANDARD);
+      display.flushSprite();
+    }
+
+    // one pass over the card finds both the videos and the images
+    MediaCatalog *catalog = new MediaCatalog(card);
+    VideoSource *videoCandidate =
+        new SDCardVideoSource(card, catalog, "/", &prefs);
     if (videoCandidate->fetchVideoData())
     {
       videoSource = videoCandidate;
@@ -136,7 +194,7 @@ void setup()
       delete videoCandidate;
     }
 
-    ImageSource *imageCandidate = new SDCardImageSource(card, "/", false);
+    ImageSource *imageCandidate = new SDCardImageSource(card, catalog, "/", false);
     if (imageCandidate->fetchImageData())
     {
       imageSource = imageCandidate;
@@ -150,6 +208,7 @@ void setup()
   if (videoSource != nullptr)
   {
     videoPlayer = new VideoPlayer(videoSource, display, prefs, battery);
+    wifiManager.setVideoPlayer((VideoPlayer *)videoPlayer);
     if (wifiManagerActive && !wifiManager.isAPMode())
     {
       videoPlayer->setWaitForFirstFrame(true);
@@ -160,7 +219,17 @@ void setup()
       Serial.println("Failed to fetch video data");
       delay(1000);
     }
-    videoPlayer->set(0);
+    // carry on where we were before the power went off
+    ResumePoint resumePoint;
+    if (!wifiManagerActive && prefs.getResumePoint(resumePoint) &&
+        ((VideoPlayer *)videoPlayer)->resume(resumePoint))
+    {
+      savedResumePoint = resumePoint;
+    }
+    else
+    {
+      videoPlayer->set(0);
+    }
     delay(500);
   }
 
@@ -231,6 +300,12 @@ void loop()
     lastBatteryUpdate = now;
   }
 
+  if (now - lastResumeCheckpoint > RESUME_CHECKPOINT_MS)
+  {
+    saveResumePoint();
+    lastResumeCheckpoint = now;
+  }
+
   button.update();
   if (wifiManagerActive)
   {
@@ -292,5 +367,19 @@ void loop()
         currentPlayer->next();
       }
     }
+
+    if (button.isTripleClicked() && currentPlayer != nullptr &&
+        currentPlayer == videoPlayer)
+    {
+      VideoPlayer *player = (VideoPlayer *)videoPlayer;
+      if (player->getState() == MediaPlayerState::PAUSED)
+      {
+        player->stepFrame(1);
+      }
+      else
+      {
+        player->setSpeed(nextTrickPlaySpeed(player->getSpeed()));
+      }
+    }
   }
 }
\ No newline at end of file
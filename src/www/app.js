@@ -6,6 +6,7 @@ const stopButton = document.getElementById('stopButton');
 const previewImage = document.getElementById('previewImage');
 const batteryVoltageDisplay = document.getElementById('batteryVoltageDisplay');
 const jpegQualitySlider = document.getElementById('jpegQuality');
+const streamCodecSelect = document.getElementById('streamCodec');
 const scalingModeSelect = document.getElementById('scalingMode');
 const fpsDisplay = document.getElementById('fpsDisplay');
 const frameSizeDisplay = document.getElementById('frameSizeDisplay');
@@ -18,6 +19,13 @@ const timerMinutesSlider = document.getElementById('timerMinutes');
 const timerMinutesDisplay = document.getElementById('timerMinutesDisplay');
 const slideshowIntervalSlider = document.getElementById('slideshowInterval');
 const slideshowIntervalDisplay = document.getElementById('slideshowIntervalDisplay');
+const frameDropPolicySelect = document.getElementById('frameDropPolicy');
+const maxDriftMsSlider = document.getElementById('maxDriftMs');
+const maxDriftMsDisplay = document.getElementById('maxDriftMsDisplay');
+const parallelDecodeSelect = document.getElementById('parallelDecode');
+const loopCacheSelect = document.getElementById('loopCacheMB');
+const webRemoteSelect = document.getElementById('webRemote');
+const scaleModeSelect = document.getElementById('scaleMode');
 const streamingTabLabel = document.getElementById('streamingTabLabel');
 const settingsTabRadio = document.getElementById('tab-settings');
 const splashscreen = document.getElementById('splashscreen');
@@ -31,9 +39,14 @@ const videoSourceSelect = document.getElementById('videoSource');
 const screenStreamOptions = document.getElementById('screenStreamOptions');
 const fileStreamOptions = document.getElementById('fileStreamOptions');
 const selectScreenButton = document.getElementById('selectScreenButton');
+const playbackControls = document.getElementById('playbackControls');
+const playbackSpeedSelect = document.getElementById('playbackSpeed');
+const stepBackButton = document.getElementById('stepBackButton');
+const stepForwardButton = document.getElementById('stepForwardButton');
 
 let lastSsid = '';
 let apMode = false;
+let sdPlayback = false;
 let streamer;
 let batteryInterval = null;
 
@@ -53,9 +66,17 @@ async function fetchSettings() {
       osdLevelSelect.value = settings.osdLevel;
       timerMinutesSlider.value = settings.timerMinutes;
       slideshowIntervalSlider.value = settings.slideshowInterval;
+      frameDropPolicySelect.value = settings.frameDropPolicy;
+      maxDriftMsSlider.value = settings.maxDriftMs;
+      parallelDecodeSelect.value = settings.parallelDecode ? '1' : '0';
+      scaleModeSelect.value = settings.scaleMode;
+      loopCacheSelect.value = settings.loopCacheMB;
+      webRemoteSelect.value = settings.webRemote ? '1' : '0';
       updateTimerDisplay(settings.timerMinutes);
       updateSlideshowIntervalDisplay(settings.slideshowInterval);
+      updateMaxDriftMsDisplay(settings.maxDriftMs);
       apMode = settings.apMode;
+      sdPlayback = settings.sdPlayback;
       if (settings.version) {
         firmwareVersion.textContent = settings.version;
       }
@@ -77,7 +98,13 @@ settingsForm.addEventListener('submit', (event) => {
     brightness: parseInt(brightnessSlider.value),
     osdLevel: parseInt(osdLevelSelect.value),
     timerMinutes: parseInt(timerMinutesSlider.value),
-    slideshowInterval: parseInt(slideshowIntervalSlider.value)
+    slideshowInterval: parseInt(slideshowIntervalSlider.value),
+    frameDropPolicy: parseInt(frameDropPolicySelect.value),
+    maxDriftMs: parseInt(maxDriftMsSlider.value),
+    parallelDecode: parallelDecodeSelect.value === '1',
+    scaleMode: parseInt(scaleModeSelect.value),
+    loopCacheMB: parseInt(loopCacheSelect.value),
+    webRemote: webRemoteSelect.value === '1'
   };
 
   const networkUpdated = (settings.ssid !== lastSsid || settings.pass.length > 0);
@@ -221,6 +248,13 @@ jpegQualitySlider.addEventListener('input', (e) => {
   }
 });
 
+streamCodecSelect.addEventListener('input', (e) => {
+  jpegQualitySlider.disabled = e.target.value !== 'jpeg';
+  if (streamer) {
+    streamer.codec = e.target.value;
+  }
+});
+
 scalingModeSelect.addEventListener('input', (e) => {
   if (streamer) {
     const mode = e.target.value;
@@ -306,14 +340,52 @@ slideshowIntervalSlider.addEventListener('input', (event) => {
   updateSlideshowIntervalDisplay(event.target.value);
 });
 
+function updateMaxDriftMsDisplay(ms) {
+  maxDriftMsDisplay.textContent = `${ms} ms`;
+}
+
+maxDriftMsSlider.addEventListener('input', (event) => {
+  updateMaxDriftMsDisplay(event.target.value);
+});
+
+// Trick play, only offered when the device is playing videos it can seek in
+function fetchPlayback() {
+  fetch('/playback')
+    .then(response => response.json())
+    .then(playback => {
+      playbackControls.style.display = playback.available ? '' : 'none';
+      playbackSpeedSelect.value = playback.speed;
+    })
+    .catch(error => console.warn('Error fetching playback:', error));
+}
+
+function sendPlayback(playback) {
+  fetch('/playback', {
+    method: 'POST',
+    headers: {
+      'Content-Type': 'application/json'
+    },
+    body: JSON.stringify(playback)
+  }).catch(error => console.error('Error controlling playback:', error));
+}
+
+playbackSpeedSelect.addEventListener('change', (event) => {
+  sendPlayback({ speed: parseInt(event.target.value) });
+});
+
+stepBackButton.onclick = () => sendPlayback({ step: -1 });
+stepForwardButton.onclick = () => sendPlayback({ step: 1 });
+
 // Initial setup
 window.onload = async () => {
   const success = await fetchSettings();
   if (success) {
     fetchBatteryStatus();
+    fetchPlayback();
     batteryInterval = setInterval(fetchBatteryStatus, 10000);
   }
-  if (!success || apMode) {
+  // while playing from the SD card there's no stream to send frames to
+  if (!success || apMode || sdPlayback) {
     streamingTabLabel.style.display = 'none';
     settingsTabRadio.checked = true;
   } else {
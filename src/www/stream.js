@@ -1,3 +1,79 @@
+// Tinytron frame codec, see src/TinyFrameFormat.h. This mirrors the encoder
+// in tools/tvfpack.cpp.
+const TINY_FRAME_HEADER_SIZE = 12;
+const TINY_FRAME_FLAG_DELTA = 0x01;
+const TINY_FRAME_KEY_INTERVAL = 15;
+
+function tinyFrameHash(color) {
+  return ((color >> 11) * 3 + ((color >> 5) & 0x3f) * 5 + (color & 0x1f) * 7) & 0x3f;
+}
+
+// Encode RGB565 pixels, as the changes to previous unless it's null.
+function encodeTinyFrame(pixels, previous, width, height, sequence) {
+  // a literal for every pixel is the worst case
+  const out = new Uint8Array(TINY_FRAME_HEADER_SIZE + pixels.length * 3);
+  out.set([0x54, 0x46, 1, previous ? TINY_FRAME_FLAG_DELTA : 0,
+    width & 0xff, width >> 8, height & 0xff, height >> 8,
+    sequence & 0xff, (sequence >> 8) & 0xff, 0, 0]);
+  let pos = TINY_FRAME_HEADER_SIZE;
+  const writeCount = (shortOp, longOp, maxShort, count) => {
+    while (count > maxShort) {
+      const chunk = Math.min(count, 65536);
+      out[pos++] = longOp;
+      out[pos++] = (chunk - 1) & 0xff;
+      out[pos++] = (chunk - 1) >> 8;
+      count -= chunk;
+    }
+    if (count > 0) {
+      out[pos++] = shortOp + count - 1;
+    }
+  };
+
+  const index = new Uint16Array(64);
+  let color = 0;
+  let i = 0;
+  while (i < pixels.length) {
+    let end = i;
+    if (previous && pixels[i] === previous[i]) {
+      while (end < pixels.length && pixels[end] === previous[end]) {
+        end++;
+      }
+      writeCount(0xc0, 0xdf, 31, end - i);
+      color = pixels[end - 1];
+      i = end;
+      continue;
+    }
+    if (pixels[i] === color) {
+      while (end < pixels.length && pixels[end] === color) {
+        end++;
+      }
+      writeCount(0x40, 0x7f, 63, end - i);
+      i = end;
+      continue;
+    }
+    const next = pixels[i++];
+    const hash = tinyFrameHash(next);
+    if (index[hash] === next) {
+      out[pos++] = hash;
+      color = next;
+      continue;
+    }
+    index[hash] = next;
+    const red = (((next >> 11) - (color >> 11) + 16) & 0x1f) - 16;
+    const green = ((((next >> 5) & 0x3f) - ((color >> 5) & 0x3f) + 32) & 0x3f) - 32;
+    const blue = (((next & 0x1f) - (color & 0x1f) + 16) & 0x1f) - 16;
+    if (red >= -2 && red <= 1 && green >= -2 && green <= 1 && blue >= -2 && blue <= 1) {
+      out[pos++] = 0x80 | ((red + 2) << 4) | ((green + 2) << 2) | (blue + 2);
+    } else {
+      out[pos++] = 0xff;
+      out[pos++] = next >> 8;
+      out[pos++] = next & 0xff;
+    }
+    color = next;
+  }
+  return out.subarray(0, pos);
+}
+
 class Streamer {
   constructor(videoElement, previewImage, fpsUpdateCallback, frameSizeUpdateCallback) {
     this.video = videoElement;
@@ -8,6 +84,10 @@ class Streamer {
 
     this.scalingMode = 'letterbox';
     this.jpegQuality = 0.5;
+    // 'jpeg' or 'tinyframe', the lossless codec for flat colour content
+    this.codec = 'jpeg';
+    this.previousPixels = null;
+    this.sequence = 0;
 
     this.ws = null;
     this.videoFrameId = null;
@@ -92,20 +172,15 @@ class Streamer {
         this.scalingMode = 'letterbox';
     }
 
+    if (this.codec === 'tinyframe') {
+      this.sendTinyFrame(canvas, context);
+      return;
+    }
+
     canvas.toBlob(blob => {
       if (blob) {
-        const now = performance.now();
-        if (this.lastFrameTime) {
-          const frameTime = now - this.lastFrameTime;
-          if (frameTime > 0 && frameTime < 1000) {
-            this.frameTimeBuffer.push(frameTime);
-          }
-        }
-        this.lastFrameTime = now;
-        this.frameSizeUpdateCallback(blob.size);
-        const imageUrl = URL.createObjectURL(blob);
-        this.previewImage.src = imageUrl;
-        this.previewImage.onload = () => URL.revokeObjectURL(imageUrl);
+        this.recordFrame(blob.size);
+        this.showPreview(blob);
         if (this.ws && this.ws.readyState === WebSocket.OPEN) {
           this.ws.send(blob);
         }
@@ -113,6 +188,49 @@ class Streamer {
     }, 'image/jpeg', this.jpegQuality);
   }
 
+  sendTinyFrame(canvas, context) {
+    const rgba = context.getImageData(0, 0, canvas.width, canvas.height).data;
+    const pixels = new Uint16Array(canvas.width * canvas.height);
+    for (let i = 0; i < pixels.length; i++) {
+      const p = i * 4;
+      pixels[i] = ((rgba[p] >> 3) << 11) | ((rgba[p + 1] >> 2) << 5) | (rgba[p + 2] >> 3);
+    }
+    // the device skips delta frames after one it dropped, key frames bring it
+    // back in step
+    let frame = encodeTinyFrame(pixels, null, canvas.width, canvas.height, this.sequence);
+    if (this.previousPixels && this.sequence % TINY_FRAME_KEY_INTERVAL !== 0) {
+      const delta = encodeTinyFrame(pixels, this.previousPixels, canvas.width, canvas.height, this.sequence);
+      if (delta.length < frame.length) {
+        frame = delta;
+      }
+    }
+    this.previousPixels = pixels;
+    this.sequence = (this.sequence + 1) & 0xffff;
+    this.recordFrame(frame.length);
+    canvas.toBlob(blob => blob && this.showPreview(blob));
+    if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+      this.ws.send(frame);
+    }
+  }
+
+  recordFrame(size) {
+    const now = performance.now();
+    if (this.lastFrameTime) {
+      const frameTime = now - this.lastFrameTime;
+      if (frameTime > 0 && frameTime < 1000) {
+        this.frameTimeBuffer.push(frameTime);
+      }
+    }
+    this.lastFrameTime = now;
+    this.frameSizeUpdateCallback(size);
+  }
+
+  showPreview(blob) {
+    const imageUrl = URL.createObjectURL(blob);
+    this.previewImage.src = imageUrl;
+    this.previewImage.onload = () => URL.revokeObjectURL(imageUrl);
+  }
+
   start() {
     if (!this.ws || this.ws.readyState !== WebSocket.OPEN) {
       alert("WebSocket is not connected. Please wait.");
@@ -120,6 +238,9 @@ class Streamer {
     }
     this.lastFrameTime = performance.now();
     this.frameTimeBuffer = [];
+    // a new stream starts with a key frame
+    this.previousPixels = null;
+    this.sequence = 0;
     this.fpsInterval = setInterval(() => {
       if (this.frameTimeBuffer.length > 0) {
         const avgInterval = this.frameTimeBuffer.reduce((a, b) => a + b) / this.frameTimeBuffer.length;
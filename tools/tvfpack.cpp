@@ -0,0 +1,450 @@
+// Converts an MJPEG AVI into a Tinytron video file (.tvf), which the device
+// can play with a single aligned read per frame. See
+// src/VideoPlayer/TinyVideoFormat.h for the layout.
+//
+// Build and run on the host:
+//   g++ -O2 -std=c++17 -o tvfpack tools/tvfpack.cpp
+//   ./tvfpack input.avi output.tvf
+//
+// Both plain AVI and OpenDML files (with AVIX segments) are read. The movi
+// lists are walked rather than trusting an index, so files without one work
+// too. Only the video stream is kept.
+//
+// Raw big endian RGB565 frames can be packed with the Tinytron frame codec
+// instead (src/TinyFrameFormat.h), which suits flat colour content:
+//   ffmpeg -i input.mp4 -vf scale=240:240 -r 25 -f rawvideo -pix_fmt rgb565be - |
+//     ./tvfpack -raw 240x240 -fps 25 - output.tvf
+// A key frame is written every 30 frames, or as set with -key, and whenever
+// it's smaller than the changes to the previous frame.
+
+#include "../src/TinyFrameFormat.h"
+#include "../src/VideoPlayer/TinyVideoFormat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define DEFAULT_KEY_INTERVAL 30
+
+struct Frame
+{
+  uint64_t offset;
+  uint32_t size;
+  // encoded frames are held here, AVI frames are copied from the input
+  std::vector<uint8_t> data;
+};
+
+struct VideoContents
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t rate = 0;
+  uint32_t scale = 0;
+  std::vector<Frame> frames;
+};
+
+static bool readAt(FILE *file, uint64_t position, void *dest, size_t length)
+{
+  return fseeko(file, (off_t)position, SEEK_SET) == 0 &&
+         fread(dest, 1, length, file) == length;
+}
+
+static uint32_t readU32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool isVideoChunk(const char *id)
+{
+  return id[2] == 'd' && (id[3] == 'c' || id[3] == 'b');
+}
+
+// Walk the chunks between start and end, stepping into the lists we care
+// about and noting every video chunk.
+static bool walkChunks(FILE *file, uint64_t start, uint64_t end,
+                       VideoContents &video)
+{
+  uint64_t position = start;
+  while (position + 8 <= end)
+  {
+    uint8_t header[12];
+    if (!readAt(file, position, header, 8))
+    {
+      return false;
+    }
+    const char *id = (const char *)header;
+    uint64_t size = readU32(header + 4);
+    uint64_t dataStart = position + 8;
+    uint64_t next = dataStart + size + (size & 1);
+    if (memcmp(id, "LIST", 4) == 0 || memcmp(id, "RIFF", 4) == 0)
+    {
+      if (size < 4 || !readAt(file, dataStart, header + 8, 4))
+      {
+        return false;
+      }
+      const char *type = (const char *)header + 8;
+      if (memcmp(type, "AVI ", 4) == 0 || memcmp(type, "AVIX", 4) == 0 ||
+          memcmp(type, "hdrl", 4) == 0 || memcmp(type, "strl", 4) == 0 ||
+          memcmp(type, "movi", 4) == 0 || memcmp(type, "rec ", 4) == 0)
+      {
+        if (!walkChunks(file, dataStart + 4, dataStart + size, video))
+        {
+          return false;
+        }
+      }
+    }
+    else if (memcmp(id, "avih", 4) == 0 && size >= 40)
+    {
+      uint8_t avih[40];
+      if (!readAt(file, dataStart, avih, sizeof(avih)))
+      {
+        return false;
+      }
+      video.width = readU32(avih + 32);
+      video.height = readU32(avih + 36);
+    }
+    else if (memcmp(id, "strh", 4) == 0 && size >= 28)
+    {
+      uint8_t strh[28];
+      if (!readAt(file, dataStart, strh, sizeof(strh)))
+      {
+        return false;
+      }
+      // the first video stream's rate wins
+      if (memcmp(strh, "vids", 4) == 0 && video.rate == 0)
+      {
+        video.scale = readU32(strh + 20);
+        video.rate = readU32(strh + 24);
+      }
+    }
+    else if (isVideoChunk(id) && size > 0)
+    {
+      // empty chunks carry no picture, the player skips them too
+      video.frames.push_back({dataStart, (uint32_t)size, {}});
+    }
+    position = next;
+  }
+  return true;
+}
+
+static bool readAvi(FILE *file, VideoContents &video)
+{
+  uint8_t header[12];
+  if (!readAt(file, 0, header, sizeof(header)) ||
+      memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "AVI ", 4) != 0)
+  {
+    fprintf(stderr, "Not an AVI file\n");
+    return false;
+  }
+  fseeko(file, 0, SEEK_END);
+  uint64_t fileSize = ftello(file);
+  // the first RIFF is walked together with any AVIX segments that follow it
+  return walkChunks(file, 0, fileSize, video);
+}
+
+static void writeCount(std::vector<uint8_t> &out, uint8_t shortOp,
+                       uint8_t longOp, size_t maxShort, size_t count)
+{
+  while (count > maxShort)
+  {
+    size_t chunk = count < TINY_FRAME_MAX_LONG_COUNT ? count
+                                                     : TINY_FRAME_MAX_LONG_COUNT;
+    out.push_back(longOp);
+    out.push_back((chunk - 1) & 0xFF);
+    out.push_back((chunk - 1) >> 8);
+    count -= chunk;
+  }
+  if (count > 0)
+  {
+    out.push_back(shortOp + count - 1);
+  }
+}
+
+// Encode a frame of RGB565 pixels with the Tinytron frame codec, as the
+// changes to previous unless that's NULL. Mirrors TinyFrameDecoder.
+static void encodeTinyFrame(const uint16_t *pixels, const uint16_t *previous,
+                            int width, int height, uint16_t sequence,
+                            std::vector<uint8_t> &out)
+{
+  TinyFrameHeader header = {};
+  header.magic[0] = TINY_FRAME_MAGIC_0;
+  header.magic[1] = TINY_FRAME_MAGIC_1;
+  header.version = TINY_FRAME_VERSION;
+  header.flags = previous ? TINY_FRAME_FLAG_DELTA : 0;
+  header.width = width;
+  header.height = height;
+  header.sequence = sequence;
+  out.assign((const uint8_t *)&header, (const uint8_t *)(&header + 1));
+
+  uint16_t index[64] = {};
+  uint16_t color = 0;
+  size_t count = (size_t)width * height;
+  size_t i = 0;
+  while (i < count)
+  {
+    size_t end = i;
+    if (previous && pixels[i] == previous[i])
+    {
+      while (end < count && pixels[end] == previous[end])
+      {
+        end++;
+      }
+      writeCount(out, TINY_FRAME_OP_SKIP, TINY_FRAME_OP_SKIP_LONG,
+                 TINY_FRAME_MAX_SHORT_SKIP, end - i);
+      color = pixels[end - 1];
+      i = end;
+      continue;
+    }
+    if (pixels[i] == color)
+    {
+      while (end < count && pixels[end] == color)
+      {
+        end++;
+      }
+      writeCount(out, TINY_FRAME_OP_RUN, TINY_FRAME_OP_RUN_LONG,
+                 TINY_FRAME_MAX_SHORT_RUN, end - i);
+      i = end;
+      continue;
+    }
+    uint16_t next = pixels[i++];
+    uint8_t hash = tinyFrameHash(next);
+    if (index[hash] == next)
+    {
+      out.push_back(TINY_FRAME_OP_INDEX | hash);
+      color = next;
+      continue;
+    }
+    index[hash] = next;
+    // each difference wrapped into the range of its channel
+    int red = (((next >> 11) - (color >> 11) + 16) & 0x1F) - 16;
+    int green = ((((next >> 5) & 0x3F) - ((color >> 5) & 0x3F) + 32) & 0x3F) - 32;
+    int blue = (((next & 0x1F) - (color & 0x1F) + 16) & 0x1F) - 16;
+    if (red >= -2 && red <= 1 && green >= -2 && green <= 1 && blue >= -2 &&
+        blue <= 1)
+    {
+      out.push_back(TINY_FRAME_OP_DIFF | ((red + 2) << 4) | ((green + 2) << 2) |
+                    (blue + 2));
+    }
+    else
+    {
+      out.push_back(TINY_FRAME_OP_RGB);
+      out.push_back(next >> 8);
+      out.push_back(next & 0xFF);
+    }
+    color = next;
+  }
+}
+
+// Read raw big endian RGB565 frames and encode each one, as a delta frame
+// unless a key frame is due or would be smaller.
+static bool readRaw(FILE *file, int width, int height, int keyInterval,
+                    VideoContents &video)
+{
+  size_t pixelCount = (size_t)width * height;
+  std::vector<uint8_t> bytes(pixelCount * 2);
+  std::vector<uint16_t> pixels(pixelCount);
+  std::vector<uint16_t> previous;
+  std::vector<uint8_t> key;
+  std::vector<uint8_t> delta;
+  video.width = width;
+  video.height = height;
+  while (fread(bytes.data(), 1, bytes.size(), file) == bytes.size())
+  {
+    for (size_t i = 0; i < pixelCount; i++)
+    {
+      pixels[i] = (bytes[i * 2] << 8) | bytes[i * 2 + 1];
+    }
+    size_t frameIndex = video.frames.size();
+    uint16_t sequence = (uint16_t)frameIndex;
+    encodeTinyFrame(pixels.data(), NULL, width, height, sequence, key);
+    bool useKey = previous.empty() || frameIndex % keyInterval == 0;
+    if (!useKey)
+    {
+      encodeTinyFrame(pixels.data(), previous.data(), width, height, sequence,
+                      delta);
+      useKey = key.size() <= delta.size();
+    }
+    Frame frame = {0, 0, useKey ? key : delta};
+    frame.size = frame.data.size();
+    video.frames.push_back(std::move(frame));
+    previous = pixels;
+  }
+  return true;
+}
+
+static bool parseRate(const char *text, VideoContents &video)
+{
+  unsigned rate, scale = 1;
+  int fields = sscanf(text, "%u/%u", &rate, &scale);
+  if (fields < 1 || rate == 0 || scale == 0)
+  {
+    return false;
+  }
+  video.rate = rate;
+  video.scale = scale;
+  return true;
+}
+
+static uint32_t sectorsFor(uint64_t bytes)
+{
+  return (uint32_t)((bytes + TINY_VIDEO_SECTOR_SIZE - 1) /
+                    TINY_VIDEO_SECTOR_SIZE);
+}
+
+static bool writePadded(FILE *file, const void *data, size_t length)
+{
+  static const uint8_t zeros[TINY_VIDEO_SECTOR_SIZE] = {};
+  size_t padding = sectorsFor(length) * TINY_VIDEO_SECTOR_SIZE - length;
+  return fwrite(data, 1, length, file) == length &&
+         fwrite(zeros, 1, padding, file) == padding;
+}
+
+static int usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s input.avi output.tvf\n"
+          "       %s -raw WIDTHxHEIGHT -fps RATE[/SCALE] [-key FRAMES] "
+          "input.rgb565 output.tvf\n"
+          "raw input is big endian RGB565 frames, - reads them from stdin\n",
+          name, name);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  VideoContents video;
+  int rawWidth = 0;
+  int rawHeight = 0;
+  int keyInterval = DEFAULT_KEY_INTERVAL;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] != '\0';
+       arg += 2)
+  {
+    if (strcmp(argv[arg], "-raw") == 0)
+    {
+      if (sscanf(argv[arg + 1], "%dx%d", &rawWidth, &rawHeight) != 2 ||
+          rawWidth <= 0 || rawHeight <= 0 || rawWidth > UINT16_MAX ||
+          rawHeight > UINT16_MAX)
+      {
+        return usage(argv[0]);
+      }
+    }
+    else if (strcmp(argv[arg], "-fps") == 0)
+    {
+      if (!parseRate(argv[arg + 1], video))
+      {
+        return usage(argv[0]);
+      }
+    }
+    else if (strcmp(argv[arg], "-key") == 0)
+    {
+      keyInterval = atoi(argv[arg + 1]);
+      if (keyInterval <= 0)
+      {
+        return usage(argv[0]);
+      }
+    }
+    else
+    {
+      return usage(argv[0]);
+    }
+  }
+  if (argc - arg != 2 || (rawWidth > 0) != (video.rate > 0))
+  {
+    return usage(argv[0]);
+  }
+  const char *inputPath = argv[arg];
+  const char *outputPath = argv[arg + 1];
+  bool raw = rawWidth > 0;
+
+  FILE *input = strcmp(inputPath, "-") == 0 && raw ? stdin
+                                                   : fopen(inputPath, "rb");
+  if (!input)
+  {
+    perror(inputPath);
+    return 1;
+  }
+  bool read = raw ? readRaw(input, rawWidth, rawHeight, keyInterval, video)
+                  : readAvi(input, video);
+  if (!read || video.frames.empty())
+  {
+    fprintf(stderr, "No video frames found in %s\n", inputPath);
+    fclose(input);
+    return 1;
+  }
+
+  TinyVideoHeader header = {};
+  memcpy(header.magic, TINY_VIDEO_MAGIC, 4);
+  header.version = TINY_VIDEO_VERSION;
+  header.sectorSize = TINY_VIDEO_SECTOR_SIZE;
+  header.width = video.width;
+  header.height = video.height;
+  header.rate = video.rate;
+  header.scale = video.scale;
+  header.frameCount = video.frames.size();
+  header.tableSector = sectorsFor(sizeof(header));
+
+  // lay the frames out after the table, each on its own sector boundary
+  std::vector<TinyVideoFrameEntry> table(video.frames.size());
+  uint64_t sector = header.tableSector +
+                    sectorsFor(table.size() * sizeof(TinyVideoFrameEntry));
+  for (size_t i = 0; i < video.frames.size(); i++)
+  {
+    table[i].sector = (uint32_t)sector;
+    table[i].size = video.frames[i].size;
+    sector += sectorsFor(video.frames[i].size);
+    // the player turns away files of 2GB or more
+    if (sector * TINY_VIDEO_SECTOR_SIZE > INT32_MAX)
+    {
+      fprintf(stderr, "Output would be too large, files must be under 2GB\n");
+      fclose(input);
+      return 1;
+    }
+  }
+
+  FILE *output = fopen(outputPath, "wb");
+  if (!output)
+  {
+    perror(outputPath);
+    fclose(input);
+    return 1;
+  }
+  bool ok = writePadded(output, &header, sizeof(header)) &&
+            writePadded(output, table.data(),
+                        table.size() * sizeof(TinyVideoFrameEntry));
+  std::vector<uint8_t> buffer;
+  size_t nonJpeg = 0;
+  for (size_t i = 0; ok && i < video.frames.size(); i++)
+  {
+    if (raw)
+    {
+      ok = writePadded(output, video.frames[i].data.data(),
+                       video.frames[i].data.size());
+      continue;
+    }
+    buffer.resize(video.frames[i].size);
+    ok = readAt(input, video.frames[i].offset, buffer.data(),
+                buffer.size()) &&
+         writePadded(output, buffer.data(), buffer.size());
+    if (buffer.size() < 2 || buffer[0] != 0xFF || buffer[1] != 0xD8)
+    {
+      nonJpeg++;
+    }
+  }
+  fclose(input);
+  if (fclose(output) != 0 || !ok)
+  {
+    fprintf(stderr, "Failed to write %s\n", outputPath);
+    return 1;
+  }
+  if (nonJpeg > 0)
+  {
+    fprintf(stderr, "Warning: %zu frames are not JPEG, is this MJPEG?\n",
+            nonJpeg);
+  }
+  printf("Packed %zu frames of %ux%u at %u/%u fps into %s\n",
+         video.frames.size(), video.width, video.height, video.rate,
+         video.scale, outputPath);
+  return 0;
+}